@@ -12,6 +12,8 @@
 #include <netinet/in.h>
 #include <netdb.h>
 
+#include "log.h"
+
 static int aprsis_login(int fd, const char *call,
                         double lat, double lon, double range)
 {
@@ -60,7 +62,7 @@ int aprsis_connect(const char *hostname, int port, const char *mycall,
         if (ret < 0)
                 goto out;
 
-        printf("Connected\n");
+        log_info("Connected\n");
 
  out:
         if (ret) {
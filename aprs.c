@@ -28,6 +28,28 @@
 #include "util.h"
 #include "serial.h"
 #include "nmea.h"
+#include "ubx.h"
+#include "gpsclock.h"
+#include "track.h"
+#include "beacon.h"
+#include "smartbeacon.h"
+#include "txq.h"
+#include "dupe.h"
+#include "ax25.h"
+#include "fastparse.h"
+#include "classify.h"
+#include "pipeline.h"
+#include "store.h"
+#include "rf.h"
+#include "template.h"
+#include "log.h"
+#include "capture.h"
+#include "metrics.h"
+#include "trace.h"
+#include "timespec.h"
+#include "loopstat.h"
+#include "soak.h"
+#include "probes.h"
 #include "aprs-is.h"
 
 #ifndef BUILD
@@ -39,10 +61,6 @@
 #endif
 
 #define MYPOS(s) (&(s)->mypos[(s)->mypos_idx])
-#define OBJNAME(p) ((p)->object_or_item_name ? (p)->object_or_item_name : \
-                    (p)->src_callsign)
-
-#define KEEP_PACKETS 8
 #define KEEP_POSITS  4
 
 #define DO_TYPE_NONE 0
@@ -51,10 +69,9 @@
 
 #define TZ_OFFSET (-8)
 
-struct smart_beacon_point {
-        float int_sec;
-        float speed;
-};
+#define SB_COURSE_WINDOW 5 /* Seconds of fixes averaged for course change */
+
+#define REPLAY_BURST 64 /* Records per main loop pass when replaying fast */
 
 struct state {
         struct {
@@ -62,6 +79,7 @@ struct state {
                 int tnc_rate;
                 char *gps;
                 int gps_rate;
+                int gps_fix_rate;
                 char *tel;
                 int tel_rate;
 
@@ -78,16 +96,28 @@ struct state {
                 int gain;
                 int directivity;
 
-                int atrest_rate;
-                struct smart_beacon_point sb_low;
-                struct smart_beacon_point sb_high;
-                int course_change_min;
-                int course_change_slope;
-                int after_stop;
+                struct sb_config sb;
+                int tx_latency;
 
                 unsigned int do_types;
-
-                char **comments;
+                int posit_format[3]; /* Indexed by DO_TYPE_* */
+                int moving_format;
+                int air_rate;
+                int fast_parse;
+                int parse_threads;
+                int rf_thread;
+                int rt_priority;
+
+                char *log_file;
+                long log_size;
+                int log_level;
+
+                char *capture_file;
+                char *metrics_socket;
+                char *replay_file;
+                int replay_fast;
+
+                struct tmpl *comments;
                 int comments_count;
 
                 char *config;
@@ -104,6 +134,8 @@ struct state {
 
                 struct sockaddr display_to;
 
+                char *aprsis_host;
+                int aprsis_port;
                 unsigned int aprsis_range;
                 int metric_units;
         } conf;
@@ -112,6 +144,8 @@ struct state {
         int mypos_idx;
 
         struct posit last_beacon_pos;
+        struct sb_state sb;
+        struct track track;
 
         struct {
                 double temp1;
@@ -124,22 +158,21 @@ struct state {
         char *mycall;
 
         int tncfd;
+        int tnc_txfd;
         int gpsfd;
         int telfd;
         int dspfd;
 
-        fap_packet_t *last_packet; /* In case we don't store it below */
-        fap_packet_t *recent[KEEP_PACKETS];
-        int recent_idx;
+        struct store store;
         int disp_idx;
 
         char gps_buffer[128];
         int gps_idx;
+        struct ubx_parser ubx;
+        struct timespec gps_read;
+        struct gpsclock clock;
         time_t last_gps_update;
-        time_t last_gps_data;
-        time_t last_beacon;
         time_t last_time_set;
-        time_t last_moving;
         time_t last_status;
 
         fap_packet_t *last_wx;
@@ -148,22 +181,78 @@ struct state {
         int other_beacon_idx;
 
         uint8_t digi_quality;
+        struct txq txq;
+        struct txbuf txbuf;
+        struct dupe_table dupes;
+        struct classifier classify;
+        struct pipeline *pipeline; /* NULL unless tnc:parse_threads */
+        struct rf *rf;             /* NULL unless tnc:rf_thread */
+        time_t last_rf_report;
+
+        struct metrics metrics;
+        struct {
+                unsigned long packets;
+                unsigned long parse_errors;
+                unsigned long digis;
+                unsigned long digi_drops;  /* Queued, but no room to send */
+                unsigned long beacons;
+                unsigned long beacon_errors;
+                unsigned long gps_reads;
+                unsigned long ui_sent;
+                unsigned long ui_errors;
+                struct hist packet;        /* Handling one packet */
+        } stats;
+
+        struct loop_stats loop_stats;
+        time_t last_loop_report;
+        struct soak soak;          /* passes is 0 unless --soak */
+
+        struct trace trace;        /* The packet being handled */
+        struct trace_stats trace_stats;
+
+        struct capture *capture;   /* NULL unless capture:file */
+        struct replay *replay;     /* NULL unless --replay */
+        struct timespec replay_start;
+
+        struct {
+                time_t start;
+                unsigned int count;
+                unsigned long bytes;
+                long saved;
+        } beacon_stats;
 };
 
-int send_kiss_beacon(int fd, char *packet)
+int send_kiss_beacon(struct state *state, char *packet)
 {
-        char buf[512];
-        int ret;
-        unsigned int len = sizeof(buf);
+        uint8_t *buf;
+        int space;
+        int len;
 
-        printf("Sending Packet: %s\n", packet);
+        log_info("Sending Packet: %s\n", packet);
 
-        ret = fap_tnc2_to_kiss(packet, strlen(packet), 0, buf, &len);
-        if (!ret) {
-                printf("Failed to make beacon KISS packet\n");
+        if (state->rf) {
+                if (rf_send(state->rf, packet)) {
+                        log_warn("RF queue full or bad packet, "
+                                 "dropping beacon\n");
+                        return 0;
+                }
                 return 1;
         }
-        return write(fd, buf, len) == len;
+
+        buf = txbuf_reserve(&state->txbuf, &space);
+        if (!buf) {
+                log_warn("TX buffer full, dropping beacon\n");
+                return 0;
+        }
+
+        len = kiss_encode_tnc2(buf, space, packet);
+        if (len < 0) {
+                log_error("Failed to make beacon KISS packet\n");
+                return 0;
+        }
+        txbuf_commit(&state->txbuf, len);
+
+        return txbuf_drain(&state->txbuf, state->tnc_txfd) >= 0;
 }
 
 int send_net_beacon(int fd, char *packet)
@@ -178,10 +267,19 @@ int send_net_beacon(int fd, char *packet)
 
 int send_beacon(struct state *state, char *packet)
 {
+        int ret;
+
         if (STREQ(state->conf.tnc_type, "KISS"))
-                return send_kiss_beacon(state->tncfd, packet);
+                ret = send_kiss_beacon(state, packet);
         else
-                return send_net_beacon(state->tncfd, packet);
+                ret = send_net_beacon(state->tncfd, packet);
+
+        if (ret)
+                state->stats.beacons++;
+        else
+                state->stats.beacon_errors++;
+
+        return ret;
 }
 
 int _ui_send(struct state *state, const char *name, const char *value)
@@ -194,56 +292,34 @@ int _ui_send(struct state *state, const char *name, const char *value)
                                  sizeof(state->conf.display_to));
 
         ret = ui_send(*fd, name, value);
+        PROBE3(ui_send, name, value, ret);
         if (ret < 0) {
+                state->stats.ui_errors++;
                 close(*fd);
                 *fd = -1;
-        }
+        } else
+                state->stats.ui_sent++;
 
         return ret;
 }
 
-fap_packet_t *dan_parseaprs(char *string, int len, int isax25)
+fap_packet_t *dan_parseaprs(struct state *state,
+                            char *string, int len, int isax25)
 {
-        fap_packet_t *fap;
-        char *tmp;
-
-        fap = fap_parseaprs(string, len, isax25);
-        if (fap->error_code)
-                return fap;
-
-        if (fap->comment) {
-                tmp = get_escaped_string(fap->comment);
-                free(fap->comment);
-                fap->comment = tmp;
-        }
-        if (fap->status) {
-                tmp = get_escaped_string(fap->status);
-                free(fap->status);
-                fap->status = tmp;
-        }
+        struct fast_packet fp;
+        fap_packet_t *fap = NULL;
 
-        return fap;
-}
+        PROBE2(parse_start, string, len);
 
-char *format_time(time_t t)
-{
-        static char str[32]; /* STATIC! */
+        if (state->conf.fast_parse && (fast_parse(&fp, string, len) == 0))
+                fap = fast_to_fap(&fp);
+        if (!fap)
+                fap = fap_parseaprs(string, len, isax25);
 
-        if (t > (3600 * 24))
-                snprintf(str, sizeof(str), "%lud%luh",
-                         t / (3600 * 24),
-                         t % (3600 * 24));
-        else if (t > 3600)
-                snprintf(str, sizeof(str), "%luh%lum", t / 3600, (t % 3600) / 60);
-        else if (t > 60)
-                if (t % 60)
-                        snprintf(str, sizeof(str), "%lum%lus", t / 60, t % 60);
-                else
-                        snprintf(str, sizeof(str), "%lu min", t / 60);
-        else
-                snprintf(str, sizeof(str), "%lu sec", t);
+        PROBE2(parse_end, string, fap->error_code == NULL);
 
-        return str;
+        /* Comments and status are escaped as they're displayed */
+        return fap;
 }
 
 const char *format_temp(struct state *state, const char *format, float celsius)
@@ -419,15 +495,21 @@ char *wx_get_report(struct state *state, fap_packet_t *fap)
         return report;
 }
 
-void str_subst(char *string, char c, char s)
+/* The packet's comment, or failing that its status, ready to display.
+ * Points to a buffer reused by the next call.
+ */
+const char *packet_text(fap_packet_t *fap)
 {
-        char *ptr;
+        static char buf[1024]; /* STATIC! */
 
-        if (!string)
-                return;
+        if (fap->comment_len)
+                return escape_markup(buf, sizeof(buf),
+                                     fap->comment, fap->comment_len);
+        else if (fap->status_len)
+                return escape_markup(buf, sizeof(buf),
+                                     fap->status, fap->status_len);
 
-        while ((ptr = strchr(string, c)))
-                *ptr = s;
+        return "";
 }
 
 void update_recent_wx(struct state *state)
@@ -478,26 +560,7 @@ void update_recent_wx(struct state *state)
         _ui_send(state, "WX_NAME", OBJNAME(fap));
         _ui_send(state, "WX_ICON", "/W");
 
-        str_subst(fap->comment, '\n', ' ');
-        str_subst(fap->comment, '\r', ' ');
-        str_subst(fap->status, '\n', ' ');
-        str_subst(fap->status, '\r', ' ');
-
-        if (fap->comment_len) {
-                char buf[512];
-
-                strncpy(buf, fap->comment, fap->comment_len);
-                buf[fap->comment_len] = 0;
-                _ui_send(state, "WX_COMMENT", buf);
-        } else if (fap->status_len) {
-                char buf[512];
-
-                strncpy(buf, fap->status, fap->status_len);
-                buf[fap->comment_len] = 0;
-                _ui_send(state, "WX_COMMENT", buf);
-        } else {
-                _ui_send(state, "WX_COMMENT", "");
-        }
+        _ui_send(state, "WX_COMMENT", packet_text(fap));
 
         free(report);
 }
@@ -532,14 +595,16 @@ void display_wx(struct state *state, fap_packet_t *fap)
             STREQ(OBJNAME(state->last_wx), OBJNAME(fap)) ||
             ((time(NULL) - *state->last_wx->timestamp) > 1800) ||
             ((distance > 0) && (distance <= last_distance))) {
-                printf("Choosing weather dist %.1f <= %.1f, delta %lu sec\n",
-                       distance,
-                       last_distance,
-                       state->last_wx ? time(NULL) - *state->last_wx->timestamp : 0);
+                log_debug("Choosing weather dist %.1f <= %.1f, delta %lu sec\n",
+                          distance,
+                          last_distance,
+                          state->last_wx ? time(NULL) - *state->last_wx->timestamp : 0);
                 fap_free(state->last_wx);
-                state->last_wx = dan_parseaprs(fap->orig_packet,
+                state->last_wx = dan_parseaprs(state, fap->orig_packet,
                                                strlen(fap->orig_packet), 0);
-                state->last_wx->timestamp = malloc(sizeof(*fap->timestamp));
+                if (!state->last_wx->timestamp)
+                        state->last_wx->timestamp =
+                                malloc(sizeof(*fap->timestamp));
                 time(state->last_wx->timestamp);
                 update_recent_wx(state);
         }
@@ -550,21 +615,7 @@ void display_wx(struct state *state, fap_packet_t *fap)
         /* Comment is used for larger WX report, so report the
          * comment (if any) in the smaller course field
          */
-        if (fap->comment_len) {
-                char buf[512];
-
-                strncpy(buf, fap->comment, fap->comment_len);
-                buf[fap->comment_len] = 0;
-                _ui_send(state, "AI_COURSE", buf);
-        } else if (fap->status_len) {
-                char buf[512];
-
-                strncpy(buf, fap->status, fap->status_len);
-                buf[fap->comment_len] = 0;
-                _ui_send(state, "AI_COURSE", buf);
-        } else {
-                _ui_send(state, "AI_COURSE", "");
-        }
+        _ui_send(state, "AI_COURSE", packet_text(fap));
 
         free(report);
 }
@@ -609,12 +660,7 @@ void display_phg(struct state *state, fap_packet_t *fap)
         _ui_send(state, "AI_COMMENT", buf);
         free(buf);
 
-        if (fap->comment) {
-                buf = strndup(fap->comment, fap->comment_len);
-                _ui_send(state, "AI_COURSE", buf);
-                free(buf);
-        } else
-                _ui_send(state, "AI_COURSE", "");
+        _ui_send(state, "AI_COURSE", fap->comment ? packet_text(fap) : "");
 }
 
 void display_posit(struct state *state, fap_packet_t *fap, int isnew)
@@ -636,17 +682,13 @@ void display_posit(struct state *state, fap_packet_t *fap, int isnew)
                 _ui_send(state, "AI_COURSE", "");
 
         if (fap->type && (*fap->type == fapSTATUS)) {
-                strncpy(buf, fap->status, fap->status_len);
-                buf[fap->status_len] = 0;
-                _ui_send(state, "AI_COMMENT", buf);
+                _ui_send(state, "AI_COMMENT", packet_text(fap));
         } else if (fap->format && (*fap->format == fapPOS_MICE)) {
                 fap_mice_mbits_to_message(fap->messagebits, buf);
                 buf[0] = toupper(buf[0]);
                 _ui_send(state, "AI_COMMENT", buf);
         } else if (fap->comment_len) {
-                strncpy(buf, fap->comment, fap->comment_len);
-                buf[fap->comment_len] = 0;
-                _ui_send(state, "AI_COMMENT", buf);
+                _ui_send(state, "AI_COMMENT", packet_text(fap));
         } else if (isnew)
                 _ui_send(state, "AI_COMMENT", "");
 }
@@ -732,30 +774,6 @@ void display_packet(struct state *state, fap_packet_t *fap)
         _ui_send(state, "AI_ICON", buf);
 }
 
-int stored_packet_desc(struct state *state, fap_packet_t *fap,
-                       int index, double mylat, double mylon,
-                       char *buf, int len)
-{
-        if (fap->latitude && fap->longitude)
-                snprintf(buf, len,
-                         "%i:%-9s <small>%s %-2s</small>",
-                         index, OBJNAME(fap),
-                         format_distance(state, "%3.0f%s",
-						 fap_distance(mylon, mylat,
-                                                 *fap->longitude,
-                                                 *fap->latitude)),
-                         direction(get_direction(mylon, mylat,
-                                                 *fap->longitude,
-                                                 *fap->latitude)));
-        else
-                snprintf(buf, len,
-                         "%i:%-9s <small>%s</small>",
-                         index, OBJNAME(fap),
-                         fap->timestamp ? format_time(time(NULL) - *fap->timestamp) : "");
-
-        return 0;
-}
-
 int update_packets_ui(struct state *state)
 {
         int i, j;
@@ -763,15 +781,15 @@ int update_packets_ui(struct state *state)
         char buf[64];
         struct posit *mypos = MYPOS(state);
 
-        if (state->last_packet && (state->disp_idx < 0))
-                display_dist_and_dir(state, state->last_packet);
+        if (state->store.last_packet && (state->disp_idx < 0))
+                display_dist_and_dir(state, state->store.last_packet);
 
-        for (i = KEEP_PACKETS, j = state->recent_idx + 1; i > 0; i--, j++) {
-                fap_packet_t *p = state->recent[j % KEEP_PACKETS];
+        for (i = KEEP_PACKETS, j = state->store.recent_idx + 1; i > 0; i--, j++) {
+                fap_packet_t *p = state->store.recent[j % KEEP_PACKETS];
 
                 sprintf(name, "AL_%02i", i-1);
                 if (p)
-                        stored_packet_desc(state, p, i,
+                        stored_packet_desc(p, i, state->conf.metric_units,
                                            mypos->lat, mypos->lon,
                                            buf, sizeof(buf));
                 else
@@ -784,243 +802,424 @@ int update_packets_ui(struct state *state)
         return 0;
 }
 
-/* Move packets below @index to @index */
-int move_packets(struct state *state, int index)
+int update_mybeacon_status(struct state *state)
 {
+        char buf[512];
+        time_t delta = (time(NULL) - state->sb.last_beacon);
+        uint8_t quality = state->digi_quality;
+        int count = 1;
         int i;
-        const int max = KEEP_PACKETS;
-        int end = (state->recent_idx +1 ) % max;
 
-        fap_free(state->recent[index]);
+        for (i = 1; i < 8; i++)
+                count += (quality >> i) & 0x01;
 
-        for (i = index; i != end; i -= 1) {
-                if (i == 0)
-                        i = KEEP_PACKETS; /* Zero now, KEEP-1 next */
-                state->recent[i % max] = state->recent[(i - 1) % max];
-        }
+        snprintf(buf, sizeof(buf), "%i", count / 2);
+        _ui_send(state, "G_SIGBARS", buf);
 
-        /* This made a hole at the bottom */
-        state->recent[end] = NULL;
+        if (state->sb.last_beacon)
+                snprintf(buf, sizeof(buf), "%s ago", format_time(delta));
+        else
+                snprintf(buf, sizeof(buf), "Never");
+        _ui_send(state, "G_LASTBEACON", buf);
 
         return 0;
 }
 
-int find_packet(struct state *state, fap_packet_t *fap)
+int should_digi_packet(struct state *state, fap_packet_t *fap)
 {
-        int i;
-
-        for (i = 0; i < KEEP_PACKETS; i++)
-                if (state->recent[i] &&
-                    STREQ(OBJNAME(state->recent[i]), OBJNAME(fap)))
-                        return i;
+        if (!state->conf.digi_enabled)
+                return 0;
 
-        return -1;
+        /* Whether the path is for us is decided on the frame itself */
+        return (fap->path_len > 0);
 }
 
-#define SWAP_VAL(new, old, value)                       \
-        do {                                            \
-                if (old->value && !new->value) {        \
-                        new->value = old->value;        \
-                        old->value = 0;                 \
-                }                                       \
-        } while (0);
-
-int merge_packets(fap_packet_t *new, fap_packet_t *old)
-{
-        SWAP_VAL(new, old, speed);
-        SWAP_VAL(new, old, course);
-        SWAP_VAL(new, old, latitude);
-        SWAP_VAL(new, old, longitude);
-        SWAP_VAL(new, old, altitude);
-        SWAP_VAL(new, old, symbol_table);
-        SWAP_VAL(new, old, symbol_code);
-
-        if (old->comment_len && !new->comment_len) {
-                new->comment_len = old->comment_len;
-                new->comment = old->comment;
-                old->comment_len = 0;
-                old->comment = NULL;
-        }
+int digi_packet(struct state *state, uint8_t *frame, int len)
+{
+        uint8_t kiss[TXQ_PACKET];
+        int ret;
 
-        if (old->status_len && !new->status_len) {
-                new->status_len = old->status_len;
-                new->status = old->status;
-                old->status_len = 0;
-                old->status = NULL;
-        }
+        len = ax25_digipeat(frame, len, AX25_MAX_FRAME,
+                            state->mycall, state->conf.digi_alias,
+                            state->conf.digi_append ?
+                            state->conf.digi_path : NULL);
+        if (len < 0)
+                log_warn("DIGI: unable to rewrite path\n");
+        if (len <= 0)
+                return 0;
 
-        return 0;
+        len = kiss_escape(frame, len, kiss, sizeof(kiss));
+        if (len < 0)
+                return 0;
+
+        /* Sent from the main loop once txdelay (ms) has passed */
+        ret = txq_push(&state->txq, kiss, len, state->conf.digi_delay,
+                       &state->trace.at[TR_READ]) == 0;
+        PROBE3(digi_enqueue, len, ret, probe_ns(&state->trace.at[TR_READ]));
+        if (!ret)
+                log_warn("DIGI: TX queue full, dropped %lu\n",
+                         state->txq.dropped);
+        else
+                state->stats.digis++;
+
+        return ret;
 }
 
-int store_packet(struct state *state, fap_packet_t *fap)
+int send_queued(struct state *state)
 {
+        struct timespec rx[TXQ_SLOTS];
+        struct txq_entry *e;
+        int sent = 0;
         int i;
 
-        fap->timestamp = malloc(sizeof(*fap->timestamp));
-        time(fap->timestamp);
-
-        if (state->last_packet &&
-            STREQ(OBJNAME(state->last_packet), OBJNAME(fap))) {
-                /* Received another packet for the latest, merge and bail */
-                merge_packets(fap, state->last_packet);
-                fap_free(state->last_packet);
-                goto out;
+        while ((e = txq_next(&state->txq))) {
+                if (txbuf_put(&state->txbuf, e->data, e->len)) {
+                        state->stats.digi_drops++;
+                        log_warn("DIGI: TX buffer full, dropped %lu\n",
+                                 state->stats.digi_drops);
+                        txq_pop(&state->txq);
+                        continue;
+                }
+                rx[sent] = e->rx;
+                PROBE2(digi_transmit, e->len, probe_ns(&e->rx));
+                txq_pop(&state->txq);
+                _ui_send(state, "I_DG", "1000");
+                log_info("DIGI: sent after %.0f ms (queue %i, max %.0f ms)\n",
+                         state->txq.latency * 1000, state->txq.count,
+                         state->txq.latency_max * 1000);
+                sent++;
         }
 
-        /* If the station has been heard, remove it from the old position
-         * in the list and merge its data into the current one
-         */
-        i = find_packet(state, fap);
-        if (i != -1) {
-                merge_packets(fap, state->recent[i]);
-                move_packets(state, i);
-        }
+        if (sent)
+                txbuf_drain(&state->txbuf, state->tnc_txfd);
 
-        /* Note: we don't store our own packets on the list */
+        for (i = 0; i < sent; i++)
+                trace_digi(&state->trace_stats, &rx[i]);
 
-        if (state->last_packet &&
-            !STREQ(state->last_packet->src_callsign, state->mycall)) {
-                /* Push the previously-current packet onto the list */
-                state->recent_idx = (state->recent_idx + 1) % KEEP_PACKETS;
-                if (state->recent[state->recent_idx])
-                        fap_free(state->recent[state->recent_idx]);
-                state->recent[state->recent_idx] = state->last_packet;
-        }
- out:
-        state->last_packet = fap;
-        update_packets_ui(state);
+        return sent;
+}
 
-        return 0;
+/* Returns 1 if an identical packet was heard in the last DUPE_WINDOW */
+int is_dupe(struct state *state, const char *src, const char *dst,
+            const char *body, int body_len)
+{
+        uint32_t hash;
+
+        /* The RF thread drops them before they get here */
+        if (state->rf)
+                return 0;
+
+        hash = dupe_hash(src, dst, body, body_len);
+
+        return dupe_check(&state->dupes, hash, time(NULL));
 }
 
-int update_mybeacon_status(struct state *state)
+/* Refresh the last-heard time of @call if it's on the list already;
+ * we don't add stations just because they sent a message
+ */
+int update_heard(struct state *state, const char *call)
 {
-        char buf[512];
-        time_t delta = (time(NULL) - state->last_beacon);
-        uint8_t quality = state->digi_quality;
-        int count = 1;
+        fap_packet_t *fap = NULL;
         int i;
 
-        for (i = 1; i < 8; i++)
-                count += (quality >> i) & 0x01;
-
-        snprintf(buf, sizeof(buf), "%i", count / 2);
-        _ui_send(state, "G_SIGBARS", buf);
+        if (state->store.last_packet &&
+            STREQ(state->store.last_packet->src_callsign, call))
+                fap = state->store.last_packet;
+        for (i = 0; !fap && (i < KEEP_PACKETS); i++)
+                if (state->store.recent[i] &&
+                    STREQ(state->store.recent[i]->src_callsign, call))
+                        fap = state->store.recent[i];
+        if (!fap)
+                return 0;
 
-        if (state->last_beacon)
-                snprintf(buf, sizeof(buf), "%s ago", format_time(delta));
-        else
-                snprintf(buf, sizeof(buf), "Never");
-        _ui_send(state, "G_LASTBEACON", buf);
+        if (!fap->timestamp)
+                fap->timestamp = malloc(sizeof(*fap->timestamp));
+        if (fap->timestamp)
+                time(fap->timestamp);
 
-        return 0;
+        return 1;
 }
 
-int should_digi_packet(struct state *state, fap_packet_t *fap)
+/* A packet the classifier says we don't need to decode. It still
+ * counts for dupes and still gets digipeated.
+ */
+int handle_unparsed(struct state *state, struct cls_header *hdr,
+                    enum cls_action action, uint8_t *frame, int frame_len)
 {
-        int len;
-
-        if (!state->conf.digi_enabled)
+        if (is_dupe(state, hdr->src, hdr->dst, hdr->body, hdr->body_len)) {
+                log_debug("DUPE: %lu of %lu\n",
+                          state->dupes.dupes, state->dupes.checked);
                 return 0;
+        }
+
+        log_debug("FILTER: %s %s (%lu of %lu)\n",
+                  cls_name(hdr->class), cls_action_name(action),
+                  state->classify.count[hdr->class], state->classify.skipped);
 
-        len = strlen(state->conf.digi_alias);
+        if (action == CLS_HEARD)
+                update_heard(state, hdr->src);
 
-        /* We digi if the first element of the path is our digi_alias */
-        return ((fap->path_len > 0) &&
-                fap->path && fap->path[0] &&
-                STRNEQ(fap->path[0], state->conf.digi_alias, len));
+        _ui_send(state, "I_RX", "1000");
+        if ((frame_len > 0) && state->conf.digi_enabled)
+                digi_packet(state, frame, frame_len);
+
+        return 0;
 }
 
-int digi_packet(struct state *state, fap_packet_t *fap)
+/* Store, display and digipeat a packet the parser has been through */
+int handle_parsed(struct state *state, fap_packet_t *fap,
+                  uint8_t *frame, int frame_len)
 {
-        char *first_digi_start, *first_digi_end;
-        char *copy_packet = NULL;
-        char *digi_packet = NULL;
-        int ret;
+        if (!fap->error_code) {
+                if (STREQ(fap->src_callsign, state->mycall)) {
+                        state->digi_quality |= 1;
+                        update_mybeacon_status(state);
+                }
+                if (is_dupe(state, fap->src_callsign, fap->dst_callsign,
+                            fap->body, fap->body_len)) {
+                        log_debug("DUPE: %lu of %lu\n",
+                                  state->dupes.dupes, state->dupes.checked);
+                        fap_free(fap);
+                        return 0;
+                }
+                store_packet(&state->store, fap, state->mycall);
+                update_packets_ui(state);
+                trace_mark(&state->trace, TR_STORE);
+                if (state->disp_idx < 0) /* No other packet displayed */
+                        display_packet(state, fap);
+                _ui_send(state, "I_RX", "1000");
+                trace_mark(&state->trace, TR_DISPLAY);
+                if ((frame_len > 0) && should_digi_packet(state, fap))
+                        digi_packet(state, frame, frame_len);
+        } else {
+                char buf[1024];
+                state->stats.parse_errors++;
+                fap_explain_error(*fap->error_code, buf);
+                log_info("ERROR %i: %s\n", *fap->error_code, buf);
+                fap_free(fap);
+        }
 
-        copy_packet = strdup(fap->orig_packet);
-        if (!copy_packet)
-                return 0;
+        return 0;
+}
 
-        first_digi_start = strstr(copy_packet, fap->path[0]);
-        first_digi_end = first_digi_start + strlen(fap->path[0]) + 1;
-        if (state->conf.digi_append)
-                first_digi_end = strchr(first_digi_end, ':');
-        if (!first_digi_start || (first_digi_end <= first_digi_start)) {
-                printf("DIGI: failed to find first digi `%s' in %s\n",
-                       fap->path[0], copy_packet);
-                ret = 0;
-                goto out;
+/* Classify, parse and act on one packet in TNC2 form. @frame is the
+ * raw AX.25, for digipeating, if it came off RF on this thread. The
+ * caller starts state->trace when the packet is first read.
+ */
+int handle_packet(struct state *state, char *packet, int len, int isax25,
+                  uint8_t *frame, int frame_len)
+{
+        fap_packet_t *fap;
+        struct cls_header hdr;
+        enum cls_action action;
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        trace_mark(&state->trace, TR_START);
+        state->stats.packets++;
+
+        log_info("%s\n", packet);
+
+        /* Our own packets always get parsed, for the digi quality meter */
+        action = classify_packet(&state->classify, packet, len, &hdr);
+        if ((action != CLS_PARSE) && !STREQ(hdr.src, state->mycall)) {
+                handle_unparsed(state, &hdr, action, frame, frame_len);
+        } else {
+                fap = dan_parseaprs(state, packet, len, isax25);
+                trace_mark(&state->trace, TR_PARSE);
+                handle_parsed(state, fap, frame, frame_len);
         }
-        *first_digi_start = '\0';
 
-        ret = asprintf(&digi_packet, "%s%s*,%s%s",
-                       copy_packet,
-                       state->mycall,
-                       state->conf.digi_append ? state->conf.digi_path : "",
-                       first_digi_end);
-        if (ret < 0)
-                goto out;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        hist_add(&state->stats.packet, ts_diff(&end, &start));
+        trace_end(&state->trace_stats, &state->trace, packet);
 
-        /* txdelay in ms */
-        usleep(state->conf.digi_delay * 1000);
+        return 0;
+}
 
-        ret = send_beacon(state, digi_packet);
-        _ui_send(state, "I_DG", "1000");
+/* One KISS frame from the TNC, live or replayed */
+int process_kiss(struct state *state, uint8_t *kiss, int kiss_len)
+{
+        char packet[512];
+        unsigned int len = sizeof(packet);
+        uint8_t frame[AX25_MAX_FRAME];
+        int frame_len = 0;
 
- out:
-        free(copy_packet);
-        free(digi_packet);
+        memset(packet, 0, len);
 
-        return ret;
+        if (!decode_kiss_frame(kiss, kiss_len, packet, &len,
+                               frame, &frame_len))
+                return -1;
+
+        while (len && ((packet[len - 1] == '\n') ||
+                       (packet[len - 1] == '\r')))
+                packet[--len] = 0;
+
+        return handle_packet(state, packet, len, 1, frame, frame_len);
+}
+
+/* One line from APRS-IS, live or replayed */
+int process_aprsis_line(struct state *state, char *packet, int len)
+{
+        while (len && ((packet[len - 1] == '\n') ||
+                       (packet[len - 1] == '\r')))
+                packet[--len] = 0;
+
+        return handle_packet(state, packet, len, 0, NULL, 0);
 }
 
 int handle_incoming_packet(struct state *state)
 {
         char packet[512];
         unsigned int len = sizeof(packet);
-        fap_packet_t *fap;
-        int ret;
-        int isax25;
+        uint8_t kiss[512];
+        int kiss_len;
 
-        memset(packet, 0, len);
+        /* Readable now, though a KISS frame may still be arriving */
+        trace_start(&state->trace, NULL);
 
         if (STREQ(state->conf.tnc_type, "KISS")) {
-                isax25 = 1;
-                ret = get_packet(state->tncfd, packet, &len);
-        } else {
-                isax25 = 0;
-                ret = get_packet_text(state->tncfd, packet, &len);
+                kiss_len = read_kiss_frame(state->tncfd, kiss, sizeof(kiss));
+                if (!kiss_len)
+                        return -1;
+                PROBE2(packet_read, kiss_len,
+                       probe_ns(&state->trace.at[TR_READ]));
+                capture_write(state->capture, CAP_TNC, kiss, kiss_len);
+                return process_kiss(state, kiss, kiss_len);
         }
-        if (!ret)
+
+        memset(packet, 0, len);
+
+        if (!get_packet_text(state->tncfd, packet, &len))
                 return -1;
+        PROBE2(packet_read, len, probe_ns(&state->trace.at[TR_READ]));
+        capture_write(state->capture, CAP_APRSIS, packet, len);
 
-        printf("%s\n", packet);
-        fap = dan_parseaprs(packet, len, isax25);
-        if (!fap->error_code) {
-                store_packet(state, fap);
-                if (STREQ(fap->src_callsign, state->mycall)) {
-                        state->digi_quality |= 1;
-                        update_mybeacon_status(state);
-                }
-                if (state->disp_idx < 0) /* No other packet displayed */
-                        display_packet(state, fap);
-                state->last_packet = fap;
-                _ui_send(state, "I_RX", "1000");
-                if (should_digi_packet(state, fap))
-                        digi_packet(state, fap);
-        } else {
-                char buf[1024];
-                fap_explain_error(*fap->error_code, buf);
-                printf("ERROR %i: %s\n", *fap->error_code, buf);
+        return process_aprsis_line(state, packet, len);
+}
+
+/* Packets the RF thread has received, already deduplicated and with
+ * any digipeat already queued over there
+ */
+int handle_rf(struct state *state)
+{
+        struct rf_msg *m;
+        int count = 0;
+
+        while ((m = rf_next(state->rf))) {
+                if (m->digi)
+                        _ui_send(state, "I_DG", "1000");
+                trace_start(&state->trace, &m->rx);
+                handle_packet(state, (char *)m->data, m->len, 1, NULL, 0);
+                rf_pop(state->rf);
+                count++;
         }
 
+        if (HAS_BEEN(state->last_rf_report, 3600)) {
+                rf_report(state->rf);
+                state->last_rf_report = time(NULL);
+        }
+
+        /* Without the TNC there's no RX, digipeating or beaconing, so
+         * better to exit and be restarted than carry on deaf
+         */
+        if (rf_failed(state->rf)) {
+                log_error("RF thread stopped, exiting\n");
+                return -1;
+        }
+
+        return count;
+}
+
+/* Runs on a parser thread: only reads state that is fixed after
+ * startup, everything else happens in handle_pipeline()
+ */
+void parse_item(void *ctx, struct pipe_item *item)
+{
+        struct state *state = ctx;
+
+        item->action = cls_lookup(&state->classify, item->packet, item->len,
+                                  &item->hdr);
+        if ((item->action == CLS_PARSE) ||
+            STREQ(item->hdr.src, state->mycall))
+                item->fap = dan_parseaprs(state, item->packet, item->len, 0);
+}
+
+/* Apply whatever the parser threads have finished, in arrival order */
+int handle_pipeline(struct state *state)
+{
+        struct pipe_item *item;
+        int count = 0;
+
+        while ((item = pipeline_next(state->pipeline))) {
+                /* Stamped on arrival here rather than off the socket,
+                 * so the capture stays in order
+                 */
+                capture_write(state->capture, CAP_APRSIS,
+                              item->packet, item->len);
+                state->stats.packets++;
+                trace_start(&state->trace, &item->rx);
+                trace_mark(&state->trace, TR_START);
+                log_info("%s\n", item->packet);
+                cls_account(&state->classify, &item->hdr, item->action);
+                if (item->fap)
+                        handle_parsed(state, item->fap, NULL, 0);
+                else
+                        handle_unparsed(state, &item->hdr, item->action,
+                                        NULL, 0);
+                trace_end(&state->trace_stats, &state->trace,
+                          item->packet);
+                pipeline_pop(state->pipeline);
+                count++;
+        }
+
+        if (pipeline_eof(state->pipeline)) {
+                log_warn("APRS-IS: connection closed\n");
+                pipeline_stop(state->pipeline);
+                state->pipeline = NULL;
+        }
+
+        return count;
+}
+
+int set_time(struct state *state)
+{
+        struct posit *mypos = MYPOS(state);
+        struct gpsclock *clk = &state->clock;
+
+        if (state->replay)
+                return 1; /* Recorded fixes say nothing about our clock */
+        else if (mypos->qual == 0)
+                return 1; /* No fix, no set */
+        else if (mypos->sats < 3)
+                return 1; /* Not enough sats, don't set */
+
+        if (gpsclock_sample(clk, mypos, &state->gps_read))
+                log_info("Clock: offset %+.6f s jitter %.6f s "
+                         "(%u steps, %u slews)\n",
+                         clk->offset, clk->jitter, clk->steps, clk->slews);
+
         return 0;
 }
 
+/* Append the current fix to the timestamped track */
+void record_fix(struct state *state)
+{
+        struct timespec now;
+
+        if (!MYPOS(state)->qual)
+                return;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        track_push(&state->track, MYPOS(state), &now);
+        PROBE3(gps_fix, (int)(MYPOS(state)->lat * 1e6),
+               (int)(MYPOS(state)->lon * 1e6), MYPOS(state)->sats);
+}
+
 int parse_gps_string(struct state *state)
 {
         char *str = state->gps_buffer;
+        int ret;
 
         if (*str == '\n')
                 str++;
@@ -1029,7 +1228,10 @@ int parse_gps_string(struct state *state)
                 return 0;
 
         if (strncmp(str, "$GPGGA", 6) == 0) {
-                return parse_gga(MYPOS(state), str);
+                ret = parse_gga(MYPOS(state), str);
+                set_time(state);
+                record_fix(state);
+                return ret;
         } else if (strncmp(str, "$GPRMC", 6) == 0) {
                 state->mypos_idx = (state->mypos_idx + 1) % KEEP_POSITS;
                 return parse_rmc(MYPOS(state), str);
@@ -1072,61 +1274,45 @@ int display_gps_info(struct state *state)
         return 0;
 }
 
-int set_time(struct state *state)
+void handle_ubx_data(struct state *state, char *buf, int len)
 {
-        struct posit *mypos = MYPOS(state);
-        time_t tstamp = mypos->tstamp;
-        time_t dstamp = mypos->dstamp;
-        char timestr[64];
         int ret;
-        int hour, min, sec;
-        int day, mon, year;
-
-        if (mypos->qual == 0)
-                return 1; /* No fix, no set */
-        else if (mypos->sats < 3)
-                return 1; /* Not enough sats, don't set */
-        else if (!HAS_BEEN(state->last_time_set, 120))
-                return 1; /* Too recent */
-
-        hour = (tstamp / 10000);
-        min = (tstamp / 100) % 100;
-        sec = tstamp % 100;
+        int i;
 
-        day = (dstamp / 10000);
-        mon = (dstamp / 100) % 100;
-        year = dstamp % 100;
+        for (i = 0; i < len; i++) {
+                if (!ubx_feed(&state->ubx, buf[i]))
+                        continue;
 
-        snprintf(timestr, sizeof(timestr),
-                 "date -u %02i%02i%02i%02i20%02i.%02i",
-                 mon, day,
-                 hour, min,
-                 year, sec);
+                if ((ubx_class(&state->ubx) != UBX_CLASS_NAV) ||
+                    (ubx_id(&state->ubx) != UBX_NAV_PVT))
+                        continue;
 
-        ret = system(timestr);
-        printf("Setting date %s: %s\n", timestr, ret == 0 ? "OK" : "FAIL");
-        state->last_time_set = time(NULL);
+                state->mypos_idx = (state->mypos_idx + 1) % KEEP_POSITS;
+                ret = ubx_parse_nav_pvt(MYPOS(state),
+                                        ubx_payload(&state->ubx),
+                                        ubx_payload_len(&state->ubx));
+                if (!ret)
+                        continue;
 
-        return 0;
+                state->sb.last_gps_data = time(NULL);
+                if (ret & UBX_PVT_TIME)
+                        set_time(state);
+                record_fix(state);
+        }
 }
 
-int handle_gps_data(struct state *state)
+/* Up to 32 bytes from the GPS, NUL-terminated, live or replayed */
+int process_gps(struct state *state, char *buf, int ret)
 {
-        char buf[33];
-        int ret;
         char *cr;
 
-        ret = read(state->gpsfd, buf, 32);
-        buf[ret] = 0; /* Safe because size is +1 */
-
-        if (ret < 0) {
-                perror("gps");
-                return -errno;
-        } else if (ret == 0)
-                return 0;
+        if (STREQ(state->conf.gps_type, "ubx")) {
+                handle_ubx_data(state, buf, ret);
+                goto out;
+        }
 
         if (state->gps_idx + ret > sizeof(state->gps_buffer)) {
-                printf("Clearing overrun buffer\n");
+                log_warn("Clearing overrun buffer\n");
                 state->gps_idx = 0;
         }
 
@@ -1135,21 +1321,20 @@ int handle_gps_data(struct state *state)
                 *cr = 0;
                 strcpy(&state->gps_buffer[state->gps_idx], buf);
                 if (parse_gps_string(state))
-                        state->last_gps_data = time(NULL);
+                        state->sb.last_gps_data = time(NULL);
                 strcpy(state->gps_buffer, cr+1);
                 state->gps_idx = strlen(state->gps_buffer);
         } else {
                 memcpy(&state->gps_buffer[state->gps_idx], buf, ret);
                 state->gps_idx += ret;
         }
-
+ out:
         if (MYPOS(state)->speed > 0)
-                state->last_moving = time(NULL);
+                state->sb.last_moving = time(NULL);
 
         if (HAS_BEEN(state->last_gps_update, 1)) {
                 display_gps_info(state);
                 state->last_gps_update = time(NULL);
-                set_time(state);
                 update_mybeacon_status(state);
                 update_packets_ui(state);
         }
@@ -1157,23 +1342,33 @@ int handle_gps_data(struct state *state)
         return 0;
 }
 
-int handle_telemetry(struct state *state)
+int handle_gps_data(struct state *state)
 {
-        char _buf[512] = "";
-        int i = 0;
+        char buf[33];
         int ret;
-        char *buf = _buf;
-        char *space;
 
-        while (i < sizeof(_buf)) {
-                ret = read(state->telfd, &buf[i], 1);
-                if (buf[i] == '\n')
-                        break;
-                if (ret < 0)
-                        return -ret;
-                else if (ret == 1)
-                        i++;
-        }
+        ret = read(state->gpsfd, buf, 32);
+        clock_gettime(CLOCK_REALTIME, &state->gps_read);
+
+        if (ret < 0) {
+                log_error("gps: %m\n");
+                return -errno;
+        } else if (ret == 0)
+                return 0;
+
+        buf[ret] = 0; /* Safe because size is +1 */
+        capture_write(state->capture, CAP_GPS, buf, ret);
+        state->stats.gps_reads++;
+
+        return process_gps(state, buf, ret);
+}
+
+/* One newline-terminated telemetry line, live or replayed */
+int process_telemetry(struct state *state, char *buf)
+{
+        char _buf[32];
+        int ret;
+        char *space;
 
         while (buf && *buf != '\n') {
                 char name[16];
@@ -1185,18 +1380,18 @@ int handle_telemetry(struct state *state)
 
                 ret = sscanf(buf, "%16[^=]=%16s", (char*)&name, (char*)&value);
                 if (ret != 2) {
-                        printf("Invalid telemetry: %s\n", buf);
+                        log_warn("Invalid telemetry: %s\n", buf);
                         return -EINVAL;
                 }
 
-                buf = space+1;
+                buf = space ? space + 1 : NULL;
 
                 if (STREQ(name, "temp1"))
                         state->tel.temp1 = atof(value);
                 else if (STREQ(name, "voltage"))
                         state->tel.voltage = atof(value);
                 else
-                        printf("Unknown telemetry value %s\n", name);
+                        log_warn("Unknown telemetry value %s\n", name);
         }
 
         snprintf(_buf, sizeof(_buf), "%.1fV", state->tel.voltage);
@@ -1210,17 +1405,123 @@ int handle_telemetry(struct state *state)
         return 0;
 }
 
+int handle_telemetry(struct state *state)
+{
+        char buf[512] = "";
+        int i = 0;
+        int ret;
+
+        while (i < sizeof(buf) - 2) {
+                ret = read(state->telfd, &buf[i], 1);
+                if (buf[i] == '\n')
+                        break;
+                if (ret < 0)
+                        return -ret;
+                else if (ret == 1)
+                        i++;
+        }
+        buf[i] = '\n';
+
+        capture_write(state->capture, CAP_TEL, buf, i + 1);
+
+        return process_telemetry(state, buf);
+}
+
+/* Nanoseconds until the next replayed record is due, by the recorded
+ * spacing since the first one
+ */
+int64_t replay_delay(struct state *state)
+{
+        struct replay *r = state->replay;
+        struct timespec now;
+        int64_t elapsed;
+
+        if (state->conf.replay_fast)
+                return 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = ((now.tv_sec - state->replay_start.tv_sec) * 1000000000LL) +
+                (now.tv_nsec - state->replay_start.tv_nsec);
+
+        return (int64_t)r->at - elapsed;
+}
+
+/* Feed the capture through the same code as the live inputs, timed
+ * as the handler each record stands in for. Returns -1 once it has
+ * all been played.
+ */
+int handle_replay(struct state *state)
+{
+        struct replay *r = state->replay;
+        struct loop_stats *l = &state->loop_stats;
+        struct timespec now;
+        double secs;
+        int count;
+
+        for (count = 0; count < REPLAY_BURST; count++) {
+                if (replay_delay(state) > 0)
+                        return 0;
+
+                trace_start(&state->trace, NULL);
+                loop_enter(l);
+                switch (r->rec.source) {
+                case CAP_TNC:
+                        process_kiss(state, r->data, r->rec.len);
+                        loop_leave(l, LH_TNC);
+                        break;
+                case CAP_APRSIS:
+                        process_aprsis_line(state, (char *)r->data,
+                                            r->rec.len);
+                        loop_leave(l, LH_TNC);
+                        break;
+                case CAP_GPS:
+                        process_gps(state, (char *)r->data, r->rec.len);
+                        loop_leave(l, LH_GPS);
+                        break;
+                case CAP_TEL:
+                        process_telemetry(state, (char *)r->data);
+                        loop_leave(l, LH_TELEMETRY);
+                        break;
+                }
+
+                if (!replay_next(r))
+                        goto done;
+        }
+
+        return 0;
+ done:
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        secs = ts_diff(&now, &state->replay_start);
+        log_info("Replay: %lu records in %.3f s (%.0f/s), "
+                 "%.3f s recorded, %lu gaps cut\n",
+                 r->records, secs, secs > 0 ? r->records / secs : 0.0,
+                 r->at / 1000000000.0, r->rebased);
+
+        return -1;
+}
+
+/* Round again for --soak. The dupe table is emptied, or the second
+ * pass would be dropped as dupes before it got near the store.
+ */
+int replay_again(struct state *state)
+{
+        dupe_clear(&state->dupes);
+        clock_gettime(CLOCK_MONOTONIC, &state->replay_start);
+
+        return replay_rewind(state->replay);
+}
+
 int handle_display_showinfo(struct state *state, int index)
 {
         fap_packet_t *fap;
-        int number = (state->recent_idx + KEEP_PACKETS - index) % KEEP_PACKETS;
+        int number = (state->store.recent_idx + KEEP_PACKETS - index) % KEEP_PACKETS;
 
         state->disp_idx = index;
 
         if (index < 0)
-                fap = state->last_packet;
+                fap = state->store.last_packet;
         else
-                fap = state->recent[number];
+                fap = state->store.recent[number];
         if (!fap)
                 return 1;
 
@@ -1236,9 +1537,9 @@ int handle_display_initkiss(struct state *state)
 
         ret = write(state->tncfd, cmd, strlen(cmd));
         if (ret > 0)
-                printf("Sent KISS initialization command\n");
+                log_info("Sent KISS initialization command\n");
         else
-                printf("Failed to send KISS initialization command: %m\n");
+                log_error("Failed to send KISS initialization command: %m\n");
 
         return 0;
 }
@@ -1253,7 +1554,7 @@ int handle_display(struct state *state)
         if ((ret < 0) || !msg) {
                 close(state->dspfd);
                 state->dspfd = -1;
-                perror("display");
+                log_error("display: %m\n");
                 return -errno;
         }
 
@@ -1265,478 +1566,269 @@ int handle_display(struct state *state)
                 int index = atoi(ui_get_msg_valu(msg));
                 ret = handle_display_showinfo(state, index);
         } else if (STREQ(name, "BEACONNOW")) {
-                state->last_beacon = 0;
+                state->sb.last_beacon = 0;
         } else if (STREQ(name, "INITKISS")) {
                 handle_display_initkiss(state);
         } else {
-                printf("Display said: %s: %s\n",
-                       ui_get_msg_name(msg), ui_get_msg_valu(msg));
+                log_debug("Display said: %s: %s\n",
+                          ui_get_msg_name(msg), ui_get_msg_valu(msg));
         }
  out:
         free(msg);
         return ret;
 }
 
-/* Get a substitution value for a given key (result must be free()'d) */
-char *get_subst(struct state *state, char *key)
+/* Write the value for @var into @buf, as tmpl_render() wants it.
+ * Returns its length, or 0 for a variable we don't know.
+ */
+int comment_var(void *ctx, enum tmpl_var var, char *buf, int size)
 {
-        char *value;
+        struct state *state = ctx;
         struct tm tm;
-        char timestr[16];
         time_t t;
+        int count = 0;
+        int i;
 
-        t = time(NULL);
-        localtime_r(&t, &tm);
-
-        if (STREQ(key, "index"))
-                asprintf(&value, "%i",
-                         state->comment_idx++ % state->conf.comments_count);
-        else if (STREQ(key, "mycall"))
-                value = strdup(state->mycall);
-        else if (STREQ(key, "temp1"))
-                asprintf(&value, "%.0f", state->tel.temp1);
-        else if (STREQ(key, "voltage"))
-                asprintf(&value, "%.1f", state->tel.voltage);
-        else if (STREQ(key, "sats"))
-                asprintf(&value, "%i", MYPOS(state)->sats);
-        else if (STREQ(key, "ver"))
-                asprintf(&value, "v0.1.%04i (%s)", BUILD, REVISION);
-        else if (STREQ(key, "time")) {
-                strftime(timestr, sizeof(timestr), "%H:%M:%S", &tm);
-                value = strdup(timestr);
-        } else if (STREQ(key, "date")) {
-                strftime(timestr, sizeof(timestr), "%m/%d/%Y", &tm);
-                value = strdup(timestr);
-        } else if (STREQ(key, "digiq")) {
-                int count = 0, i;
+        switch (var) {
+        case TV_INDEX:
+                return snprintf(buf, size, "%i",
+                                state->comment_idx++ %
+                                state->conf.comments_count);
+        case TV_MYCALL:
+                return snprintf(buf, size, "%s", state->mycall);
+        case TV_TEMP1:
+                return snprintf(buf, size, "%.0f", state->tel.temp1);
+        case TV_VOLTAGE:
+                return snprintf(buf, size, "%.1f", state->tel.voltage);
+        case TV_SATS:
+                return snprintf(buf, size, "%i", MYPOS(state)->sats);
+        case TV_VER:
+                return snprintf(buf, size, "v0.1.%04i (%s)",
+                                BUILD, REVISION);
+        case TV_TIME:
+        case TV_DATE:
+                t = time(NULL);
+                localtime_r(&t, &tm);
+                return strftime(buf, size,
+                                var == TV_TIME ? "%H:%M:%S" : "%m/%d/%Y",
+                                &tm);
+        case TV_DIGIQ:
                 for (i = 0; i < 8; i++)
                         count += (state->digi_quality >> i) & 0x01;
-                asprintf(&value, "%02.0f%%", (count / 8.0) * 100.0);
-        } else
-                printf("Unknown substitution `%s'", key);
-
-        return value;
-}
-
-/* Given a string with substition variables, do the substitutions
- * and return the new result (which must be free()'d)
- */
-char *process_subst(struct state *state, char *src)
-{
-        char *str;
-        char *ptr1;
-        char *ptr2;
-
-        /* FIXME: might overrun! */
-        str = malloc(strlen(src) * 4);
-        if (!str)
-                return str;
-        str[0] = 0;
-
-        for (ptr1 = src; *ptr1; ptr1++) {
-                char subst[16] = "";
-                char *value = NULL;
-
-                ptr2 = strchr(ptr1, '$');
-                if (!ptr2) {
-                        /* No more substs */
-                        strcat(str, ptr1);
-                        break;
-                }
-
-                /* Copy up to the next variable */
-                strncat(str, ptr1, ptr2-ptr1);
-
-                ptr1 = ptr2+1;
-                ptr2 = strchr(ptr1, '$');
-                if (!ptr2) {
-                        printf("Bad substitution `%s'\n", ptr1);
-                        goto err;
-                }
-
-                strncpy(subst, ptr1, ptr2-ptr1);
-                ptr1 = ptr2;
-
-                value = get_subst(state, subst);
-                if (value) {
-                        strcat(str, value);
-                        free(value);
-                }
+                return snprintf(buf, size, "%02.0f%%",
+                                (count / 8.0) * 100.0);
+        default:
+                return 0;
         }
-
-        return str;
- err:
-        free(str);
-        return NULL;
 }
 
-char *get_comment(struct state *state)
+/* Render the next configured comment into @buf */
+char *get_comment(struct state *state, char *buf, int size)
 {
-        int cmt = state->comment_idx++ % state->conf.comments_count;
+        int cmt;
+
+        buf[0] = 0;
+        if (!state->conf.comments_count)
+                return buf;
 
-        return process_subst(state, state->conf.comments[cmt]);
+        cmt = state->comment_idx++ % state->conf.comments_count;
+        tmpl_render(&state->conf.comments[cmt], buf, size,
+                    comment_var, state);
+
+        return buf;
 }
 
 /*
  * Choose a comment out of the list, and choose a type
  * of (phg, wx, normal) from the list of configured types
- * and construct it.
+ * and construct it in @buf.
  */
-char *choose_data(struct state *state, char *req_icon)
+char *choose_data(struct state *state, char *req_icon, int *type,
+                  char *buf, int size)
 {
-        char *data = NULL;
-        char *comment;
-
-        comment = get_comment(state);
-        if (!comment)
-                comment = strdup("Error");
+        int len = 0;
 
         switch (state->other_beacon_idx++ % 3) {
         case DO_TYPE_WX:
                 if ((state->conf.do_types & DO_TYPE_WX) &&
                     (!HAS_BEEN(state->tel.last_tel, 30))) {
                         *req_icon = '_';
-                        asprintf(&data,
-                                 ".../...g...t%03.0f%s",
-                                 state->tel.temp1,
-                                 comment);
+                        *type = DO_TYPE_WX;
+                        len = snprintf(buf, size,
+                                       ".../...g...t%03.0f",
+                                       state->tel.temp1);
                         break;
                 }
         case DO_TYPE_PHG:
                 if (state->conf.do_types & DO_TYPE_PHG) {
-                        asprintf(&data,
-                                 "PHG%1d%1d%1d%1d%s",
-                                 state->conf.power,
-                                 state->conf.height,
-                                 state->conf.gain,
-                                 state->conf.directivity,
-                                 comment);
+                        *type = DO_TYPE_PHG;
+                        len = snprintf(buf, size,
+                                       "PHG%1d%1d%1d%1d",
+                                       state->conf.power,
+                                       state->conf.height,
+                                       state->conf.gain,
+                                       state->conf.directivity);
                         break;
                 }
         case DO_TYPE_NONE:
-                data = strdup(comment);
+                *type = DO_TYPE_NONE;
                 break;
         }
 
-        free(comment);
-        return data;
+        /* The comment goes straight in after the prefix */
+        if (len < size)
+                get_comment(state, buf + len, size - len);
+
+        return buf;
 }
 
-void separate_minutes(double minutes, unsigned char *min, unsigned char *hun)
+int make_status_beacon(struct state *state, char *buf, int len)
 {
-        double _min, _hun;
+        char data[256];
+        int ret;
 
-        _hun = modf(minutes, &_min);
-        *min = (unsigned char)_min;
-        *hun = (unsigned char)(_hun * 100);
+        ret = snprintf(buf, len,
+                       "%s>%s,%s:>%s",
+                       state->mycall, "APZDMS", state->conf.digi_path,
+                       get_comment(state, data, sizeof(data)));
 
-        printf("min: %hhd hun: %hhd\n", *min, *hun);
+        return ret < len ? ret : -1;
 }
 
-/* Get the @digith digit of a base-ten number
- *
- * 1234
- * |||^-- 0
- * ||^--- 1
- * |^---- 2
- * ^----- 3
+/* Keep a running tally of what position beacons cost us on the air
+ * compared to the plain uncompressed format, and report it hourly
  */
-unsigned char get_digit(int value, int digit)
-{
-        value /= pow(10, digit);
-        return value % 10;
-}
-
-char *make_mice_beacon(struct state *state)
+void account_beacon(struct state *state, int sent, int baseline)
 {
-        char *str = NULL;
+        time_t now = time(NULL);
 
-        struct posit *mypos = MYPOS(state);
-        double ldeg, lmin;
-        double Ldeg, Lmin;
-        int lat;
-        unsigned char north = mypos->lat > 0 ? 0x50 : 0x30;
-        unsigned char lonsc = fabs(mypos->lon) >= 100 ||
-                fabs(mypos->lon) < 10 ? 0x50 : 0x30;
-        unsigned char west = mypos->lon > 0 ? 0x30 : 0x50;
-
-        unsigned char lon_deg, lon_min, lon_hun;
-
-        unsigned char spd_htk;
-        unsigned char spd_crs;
-        unsigned char crs_tud;
-
-        unsigned int atemp;
-        char _altitude[5];
-        char *altitude = &_altitude[0];
-
-        lmin = modf(fabs(mypos->lat), &ldeg) * 60;
-        Lmin = modf(fabs(mypos->lon), &Ldeg) * 60;
-
-        /* Latitude DDMMmm encoded in base-10 */
-        lat = (ldeg * 10000) + (lmin * 100);
-
-        /* Longitude degrees encoded per APRS spec */
-        if (Ldeg <= 9)
-                lon_deg = (int)Ldeg + 118;
-        else if (Ldeg <= 99)
-                lon_deg = (int)Ldeg + 28;
-        else if (Ldeg <= (int)109)
-                lon_deg = (int)Ldeg + 108;
-        else if (Ldeg <= 179)
-                lon_deg = ((int)Ldeg - 100) + 28;
-
-        /* Minutes and hundredths of a minute encoded per APRS spec */
-        separate_minutes(Lmin, &lon_min, &lon_hun);
-        if (Lmin > 10)
-                lon_min += 28;
-        else
-                lon_min += 88;
-        lon_hun += 28;
-
-        /* Speed, hundreds and tens of knots */
-        spd_htk = (mypos->speed / 10) + 108;
-
-        /* Units of speed and course hundreds of degrees */
-        spd_crs = 32 + \
-                (((int)mypos->speed % 10) * 10) + \
-                ((int)mypos->course / 100);
-
-        /* Course tens and units of degrees */
-        crs_tud = ((int)mypos->course % 100) + 28;
-
-        /* Altitude, base-91 */
-        atemp = mypos->alt + 10000;
-        altitude[0] = 33 + (atemp / pow(91, 3));
-        atemp = atemp % (int)pow(91, 3);
-        altitude[1] = 33 + (atemp / pow(91, 2));
-        atemp = atemp % (int)pow(91, 2);
-        altitude[2] = 33 + (atemp / 91);
-        altitude[3] = 33 + (atemp % 91);
-        altitude[4] = '\0';
-        if (altitude[0] == 33)
-                altitude = &altitude[1];
-
-        asprintf(&str,
-                 "%s>%c%c%c%c%c%c,%s:`%c%c%c%c%c%c%c%c%s}",
-                 state->mycall,
-                 get_digit(lat, 5) | 0x50,
-                 get_digit(lat, 4) | 0x30,
-                 get_digit(lat, 3) | 0x50,
-                 get_digit(lat, 2) | north,
-                 get_digit(lat, 1) | lonsc,
-                 get_digit(lat, 0) | west,
-                 state->conf.digi_path,
-                 lon_deg,
-                 lon_min,
-                 lon_hun,
-                 spd_htk,
-                 spd_crs,
-                 crs_tud,
-                 state->conf.icon[1],
-                 state->conf.icon[0],
-                 altitude);
+        if (!state->beacon_stats.start)
+                state->beacon_stats.start = now;
 
-        return str;
-}
+        state->beacon_stats.count++;
+        state->beacon_stats.bytes += sent;
+        state->beacon_stats.saved += baseline - sent;
 
-char *make_status_beacon(struct state *state)
-{
-        char *packet = NULL;
-        char *data = get_comment(state);
+        if (!HAS_BEEN(state->beacon_stats.start, 3600))
+                return;
 
-        asprintf(&packet,
-                 "%s>%s,%s:>%s",
-                 state->mycall, "APZDMS", state->conf.digi_path,
-                 data);
-        free(data);
+        log_info("Beacon: %u beacons, %lu bytes in %s, saved %li bytes "
+                 "(%.1f sec of airtime at %i baud)\n",
+                 state->beacon_stats.count,
+                 state->beacon_stats.bytes,
+                 format_time(now - state->beacon_stats.start),
+                 state->beacon_stats.saved,
+                 (state->beacon_stats.saved * 8.0) / state->conf.air_rate,
+                 state->conf.air_rate);
 
-        return packet;
+        memset(&state->beacon_stats, 0, sizeof(state->beacon_stats));
+        state->beacon_stats.start = now;
 }
 
-char *make_beacon(struct state *state, char *payload)
+/* Build a position beacon in the configured format. Moving beacons
+ * carry no comment (the status beacon follows up with that).
+ */
+int make_beacon(struct state *state, struct posit *mypos, int moving,
+                char *buf, int len)
 {
-        char *data = NULL;
-        char *packet;
-        char _lat[16];
-        char _lon[16];
-        int ret;
+        char data[256];
+        char *payload = "";
         char icon = state->conf.icon[1];
-        struct posit *mypos = MYPOS(state);
-        char course_speed[] = ".../...";
-
-        double lat = fabs(mypos->lat);
-        double lon = fabs(mypos->lon);
-
-        snprintf(_lat, 16, "%02.0f%05.2f%c",
-                 floor(lat),
-                 (lat - floor(lat)) * 60,
-                 mypos->lat > 0 ? 'N' : 'S');
-
-        snprintf(_lon, 16, "%03.0f%05.2f%c",
-                 floor(lon),
-                 (lon - floor(lon)) * 60,
-                 mypos->lon > 0 ? 'E' : 'W');
-
-        if (mypos->speed > 5)
-                snprintf(course_speed, sizeof(course_speed),
-                         "%03.0f/%03.0f",
-                         mypos->course,
-                         mypos->speed);
-        else
-                course_speed[0] = 0;
-
-        if (!payload)
-                payload = data = choose_data(state, &icon);
-
-        ret = asprintf(&packet,
-                       "%s>APZDMS,%s:!%s%c%s%c%s/A=%06i%s",
-                       state->mycall,
-                       state->conf.digi_path,
-                       _lat,
-                       state->conf.icon[0],
-                       _lon,
-                       icon,
-                       course_speed,
-                       (int)M_TO_FT(mypos->alt),
-                       payload);
-
-        free(data);
+        char baseline[512];
+        int type = DO_TYPE_NONE;
+        int format;
+        int ret;
 
-        if (ret < 0)
-                return NULL;
+        if (moving) {
+                format = state->conf.moving_format;
+        } else {
+                payload = choose_data(state, &icon, &type,
+                                      data, sizeof(data));
+                format = state->conf.posit_format[type];
+        }
 
-        return packet;
-}
+        switch (format) {
+        case FMT_MICE:
+                ret = mice_encode(buf, len,
+                                  state->mycall, state->conf.digi_path,
+                                  state->conf.icon, mypos);
+                break;
+        case FMT_COMPRESSED:
+                ret = compressed_encode(buf, len,
+                                        state->mycall, state->conf.digi_path,
+                                        state->conf.icon[0], icon,
+                                        mypos, moving, payload);
+                break;
+        default:
+                ret = posit_encode(buf, len,
+                                   state->mycall, state->conf.digi_path,
+                                   state->conf.icon[0], icon,
+                                   mypos, payload);
+                break;
+        }
 
-double sb_course_change_thresh(struct state *state)
-{
-        double mph = KTS_TO_MPH(MYPOS(state)->speed);
-        double slope = state->conf.course_change_slope;
-        double min = state->conf.course_change_min;
+        if (ret > 0)
+                account_beacon(state, ret,
+                               posit_encode(baseline, sizeof(baseline),
+                                            state->mycall,
+                                            state->conf.digi_path,
+                                            state->conf.icon[0], icon,
+                                            mypos, payload));
 
-        return min + (slope / mph);
+        return ret;
 }
 
 int should_beacon(struct state *state)
 {
         struct posit *mypos = MYPOS(state);
-        time_t delta = time(NULL) - state->last_beacon;
-        time_t sb_min_delta;
-        double speed_frac;
-        double d_speed = state->conf.sb_high.speed - state->conf.sb_low.speed;
-        double d_rate = state->conf.sb_low.int_sec -
-                state->conf.sb_high.int_sec;
-        double sb_thresh = sb_course_change_thresh(state);
-        double sb_change = fabs(state->last_beacon_pos.course - mypos->course);
-
-        char *reason = NULL;
-
-        /* If we went from a NW course to a NE course, the change will be large,
-         * so correct it to the difference instead of assuming we always take
-         * large right turns
-         */
-        if (sb_change > 180)
-                sb_change = 360.0 - sb_change;
+        struct sb_decision d;
+        double course = mypos->course;
+        int ret;
 
-        /* Time required to have passed in order to beacon,
-         * 0 if never, -1 if now
+        /* Compare the course smoothed over the last few fixes against
+         * the one we beaconed, so a single noisy sample doesn't count
+         * as a turn
          */
-        time_t req = 0;
-
-        /* NEVER more often than every 10 seconds! */
-        if (delta < 10)
-                return 0;
+        track_mean_course(&state->track, SB_COURSE_WINDOW, 1.0, &course);
 
-        /* The fractional penetration into the lo/hi zone */
-        speed_frac = (KTS_TO_MPH(mypos->speed) -
-                      state->conf.sb_low.speed) / d_speed;
-
-        /* Determine the fractional that we are slower than the max */
-        sb_min_delta = (d_rate * (1 - speed_frac)) +
-                state->conf.sb_high.int_sec;
-
-        /* Never when we aren't getting data anymore */
-        if (HAS_BEEN(state->last_gps_data, 30)) {
-                mypos->qual = mypos->sats = 0;
-                reason = "NODATA";
-                goto out;
-        }
+        ret = sb_should_beacon(&state->conf.sb, &state->sb, mypos, course,
+                               time(NULL), &d);
+        PROBE3(beacon_decision, d.reason ? d.reason : "", d.req, ret);
 
-        /* Never when we don't have a fix */
-        if (mypos->qual == 0) {
-                reason = "NOLOCK";
-                goto out;
-        }
-
-        /* If we have recently stopped moving, do one beacon */
-        if (state->last_moving &&
-            HAS_BEEN(state->last_moving, state->conf.after_stop)) {
-                state->last_moving = 0;
-                req = -1;
-                reason = "STOPPED";
-                goto out;
-        }
-
-        /* If we're not moving at all, choose the "at rest" rate */
-        if (mypos->speed <= 1) {
-                req = state->conf.atrest_rate;
-                reason = "ATREST";
-                goto out;
-        }
+        if (d.reason) {
+                char tmp[256];
+                if (d.req <= 0)
+                        strcpy(tmp, d.reason);
+                else
+                        sprintf(tmp, "Every %s", format_time(d.req));
+                _ui_send(state, "G_REASON", tmp);
 
-        /* SmartBeaconing: Course Change (only if moving) */
-        if ((sb_change > sb_thresh) && (KTS_TO_MPH(mypos->speed) > 2.0)) {
-                printf("SB: Angle changed by %.0f (>%.0f)\n",
-                       sb_change, sb_thresh);
-                reason = "COURSE";
-                req = -1;
-                goto out;
+                if (d.req == 0)
+                        update_mybeacon_status(state);
+                else if (STREQ(d.reason, "COURSE"))
+                        log_info("SB: Course changed to %.0f\n", course);
         }
 
-        /* SmartBeaconing: Range-based variable speed beaconing */
+        return ret;
+}
 
-        /* If we're going below the low point, use that interval */
-        if (KTS_TO_MPH(mypos->speed) < state->conf.sb_low.speed) {
-                req = state->conf.sb_low.int_sec;
-                reason = "SLOWTO";
-                goto out;
-        }
+/* Our position projected forward to when the beacon will be on the air */
+void get_tx_posit(struct state *state, struct posit *pos)
+{
+        struct timespec when;
 
-        /* If we're going above the high point, use that interval */
-        if (KTS_TO_MPH(mypos->speed) > state->conf.sb_high.speed) {
-                req = state->conf.sb_high.int_sec;
-                reason = "FASTTO";
-                goto out;
-        }
+        *pos = *MYPOS(state);
 
-        /* We must be in the speed zone, so adjust interval according
-         * to the fractional penetration of the speed range
-         */
-        req = sb_min_delta;
-        reason = "FRACTO";
- out:
-        if (reason) {
-                char tmp[256];
-                if (req <= 0)
-                        strcpy(tmp, reason);
-                else
-                        sprintf(tmp, "Every %s", format_time(req));
-                _ui_send(state, "G_REASON", tmp);
-        }
+        clock_gettime(CLOCK_MONOTONIC, &when);
+        ts_add(&when, state->conf.tx_latency * 1000000LL);
 
-        if (req == 0) {
-                update_mybeacon_status(state);
-                return 0;
-        } else if (req == -1)
-                return 1;
-        else
-                return delta > req;
+        track_project(&state->track, &when, &pos->lat, &pos->lon);
 }
 
 int beacon(struct state *state)
 {
-        char *packet;
+        char packet[512];
+        struct posit txpos;
         static time_t max_beacon_check = 0;
 
         /* Don't even check but every half-second */
@@ -1748,50 +1840,37 @@ int beacon(struct state *state)
         if (!should_beacon(state))
                 return 0;
 
-        if (MYPOS(state)->speed > 5) {
-                /* Send a short MIC-E position beacon */
-                packet = make_mice_beacon(state);
-                send_beacon(state, packet);
-                free(packet);
+        get_tx_posit(state, &txpos);
+
+        if (txpos.speed > 5) {
+                /* Send a short (MIC-E by default) position beacon */
+                if (make_beacon(state, &txpos, 1,
+                                packet, sizeof(packet)) > 0)
+                        send_beacon(state, packet);
 
                 if (HAS_BEEN(state->last_status, 120)) {
                         /* Follow up with a status packet */
-                        packet = make_status_beacon(state);
-                        send_beacon(state, packet);
-                        free(packet);
+                        if (make_status_beacon(state, packet,
+                                               sizeof(packet)) > 0)
+                                send_beacon(state, packet);
                         state->last_status = time(NULL);
                 }
         } else {
-                packet = make_beacon(state, NULL);
-                send_beacon(state, packet);
-                free(packet);
+                if (make_beacon(state, &txpos, 0,
+                                packet, sizeof(packet)) > 0)
+                        send_beacon(state, packet);
         }
 
-        state->last_beacon = time(NULL);
+        state->sb.last_beacon = time(NULL);
         state->digi_quality <<= 1;
         update_mybeacon_status(state);
 
         _ui_send(state, "I_TX", "1000");
 
         state->last_beacon_pos = state->mypos[state->mypos_idx];
-
-        return 0;
-}
-
-int redir_log()
-{
-        int fd;
-
-        fd = open("/tmp/aprs.log", O_WRONLY|O_TRUNC|O_CREAT, 0644);
-        if (fd < 0) {
-                perror("/tmp/aprs.log");
-                return -errno;
-        }
-
-        dup2(fd, STDOUT_FILENO);
-        dup2(fd, STDERR_FILENO);
-
-        setvbuf(stdout, NULL, _IONBF, 0);
+        state->sb.last_beacon_course = state->last_beacon_pos.course;
+        track_mean_course(&state->track, SB_COURSE_WINDOW, 1.0,
+                          &state->sb.last_beacon_course);
 
         return 0;
 }
@@ -1816,8 +1895,9 @@ int fake_gps_data(struct state *state)
 
         mypos->qual = 1;
         mypos->sats = 0; /* We may claim qual=1, but no sats */
+        record_fix(state);
 
-        state->last_gps_data = time(NULL);
+        state->sb.last_gps_data = time(NULL);
         state->tel.temp1 = 75;
         state->tel.voltage = 13.8;
         state->tel.last_tel = time(NULL);
@@ -1853,6 +1933,140 @@ int lookup_host(struct state *state, const char *hostname)
         return 0;
 }
 
+/* Everything worth watching in the field, by reference */
+void register_metrics(struct state *state)
+{
+        struct metrics *r = &state->metrics;
+        int i;
+
+        metrics_init(r);
+
+        metric_add(r, "aprs_packets_total", MK_COUNTER,
+                   &state->stats.packets, "Packets received");
+        metric_add(r, "aprs_parse_errors_total", MK_COUNTER,
+                   &state->stats.parse_errors, "Packets libfap rejected");
+        for (i = 0; i < CLS_MAX; i++) {
+                char name[64];
+
+                snprintf(name, sizeof(name),
+                         "aprs_classified_total{class=\"%s\"}",
+                         cls_name(i));
+                metric_add(r, strdup(name), MK_COUNTER,
+                           &state->classify.count[i],
+                           "Packets by class, before filtering");
+        }
+        metric_add(r, "aprs_filtered_total", MK_COUNTER,
+                   &state->classify.skipped,
+                   "Packets not parsed because of [filter]");
+        metric_add(r, "aprs_dupes_total", MK_COUNTER,
+                   &state->dupes.dupes, "Duplicates dropped");
+        metric_add(r, "aprs_digis_total", MK_COUNTER,
+                   &state->stats.digis, "Digipeats queued");
+        metric_add(r, "aprs_digi_dropped_total", MK_COUNTER,
+                   &state->stats.digi_drops,
+                   "Digipeats dropped, TX buffer full");
+        metric_add(r, "aprs_beacons_total", MK_COUNTER,
+                   &state->stats.beacons, "Beacons sent");
+        metric_add(r, "aprs_beacon_errors_total", MK_COUNTER,
+                   &state->stats.beacon_errors, "Beacons that failed");
+        metric_add(r, "aprs_txq_depth", MK_GAUGE_INT,
+                   &state->txq.count, "Digipeats waiting for txdelay");
+        metric_add(r, "aprs_txq_dropped_total", MK_COUNTER,
+                   &state->txq.dropped, "Digipeats dropped, queue full");
+        metric_add(r, "aprs_txbuf_flush_max_seconds", MK_GAUGE_DOUBLE,
+                   &state->txbuf.flush_max, "Longest TNC write backlog");
+        metric_add(r, "aprs_gps_reads_total", MK_COUNTER,
+                   &state->stats.gps_reads, "Reads from the GPS");
+        metric_add(r, "aprs_clock_offset_seconds", MK_GAUGE_DOUBLE,
+                   &state->clock.offset, "GPS minus system time");
+        metric_add(r, "aprs_clock_jitter_seconds", MK_GAUGE_DOUBLE,
+                   &state->clock.jitter, "GPS time jitter");
+        metric_add(r, "aprs_clock_steps", MK_GAUGE_UINT,
+                   &state->clock.steps, "System clock steps");
+        metric_add(r, "aprs_ui_sent_total", MK_COUNTER,
+                   &state->stats.ui_sent, "Display messages sent");
+        metric_add(r, "aprs_ui_errors_total", MK_COUNTER,
+                   &state->stats.ui_errors, "Display messages lost");
+        metric_add(r, "aprs_log_dropped_total", MK_COUNTER_FN,
+                   log_dropped, "Log lines dropped, ring full");
+        metric_add(r, "aprs_packet_seconds", MK_HIST,
+                   &state->stats.packet, "Time to handle one packet");
+        metric_add(r, "aprs_loop_seconds", MK_HIST,
+                   &state->loop_stats.pass, "Main loop pass, minus the wait");
+        metric_add(r, "aprs_loop_wakeups_total", MK_COUNTER,
+                   &state->loop_stats.wakeups, "Main loop passes");
+        metric_add(r, "aprs_loop_wakeups_per_second", MK_GAUGE_DOUBLE,
+                   &state->loop_stats.wakeup_rate,
+                   "Main loop passes, over the last second");
+        metric_add(r, "aprs_loop_stalls_total", MK_COUNTER,
+                   &state->loop_stats.stalls,
+                   "Main loop passes over loop:stall_ms");
+        for (i = 0; i < LH_HANDLERS; i++) {
+                char name[64];
+
+                snprintf(name, sizeof(name),
+                         "aprs_handler_seconds{handler=\"%s\"}",
+                         loop_handler_name(i));
+                metric_add(r, strdup(name), MK_HIST,
+                           &state->loop_stats.wall[i],
+                           "Main loop handlers, wall time per call");
+        }
+        for (i = 0; i < LH_HANDLERS; i++) {
+                char name[64];
+
+                snprintf(name, sizeof(name),
+                         "aprs_handler_cpu_seconds{handler=\"%s\"}",
+                         loop_handler_name(i));
+                metric_add(r, strdup(name), MK_HIST,
+                           &state->loop_stats.cpu[i],
+                           "Main loop handlers, CPU time per call");
+        }
+        for (i = 0; i < LH_HANDLERS; i++) {
+                char name[64];
+
+                snprintf(name, sizeof(name),
+                         "aprs_handler_max_seconds{handler=\"%s\"}",
+                         loop_handler_name(i));
+                metric_add(r, strdup(name), MK_GAUGE_DOUBLE,
+                           &state->loop_stats.wall[i].max,
+                           "Main loop handlers, longest call");
+        }
+        for (i = TR_START; i < TR_STAGES; i++) {
+                char name[64];
+
+                snprintf(name, sizeof(name),
+                         "aprs_stage_seconds{stage=\"%s\"}",
+                         trace_stage_name(i));
+                metric_add(r, strdup(name), MK_HIST,
+                           &state->trace_stats.stage[i],
+                           "Received packets, time spent per stage");
+        }
+        metric_add(r, "aprs_rx_display_seconds", MK_HIST,
+                   &state->trace_stats.total,
+                   "Received packets, read to display");
+        metric_add(r, "aprs_digi_seconds", MK_HIST,
+                   &state->trace_stats.digi,
+                   "Digipeats, read to write to the TNC");
+
+        if (state->rf) {
+                metric_add(r, "aprs_rf_frames_total", MK_COUNTER,
+                           &state->rf->frames, "Frames off the TNC");
+                metric_add(r, "aprs_rf_dupes_total", MK_COUNTER,
+                           &state->rf->dupes.dupes,
+                           "Duplicates the RF thread dropped");
+                metric_add(r, "aprs_rf_digis_total", MK_COUNTER,
+                           &state->rf->digis, "Digipeats sent");
+                metric_add(r, "aprs_rf_rx_dropped_total", MK_COUNTER,
+                           &state->rf->rx.dropped,
+                           "Frames dropped, main thread behind");
+                metric_add(r, "aprs_rf_digi_late_seconds", MK_HIST,
+                           &state->rf->late, "Digipeats, beyond txdelay");
+                metric_add(r, "aprs_rf_digi_seconds", MK_HIST,
+                           &state->rf->rx_tx,
+                           "Digipeats, frame read to write");
+        }
+}
+
 void usage(char *argv0)
 {
         printf("Usage:\n"
@@ -1868,6 +2082,11 @@ void usage(char *argv0)
                "  --display, -d    Host to use for display over INET socket\n"
                "  --netrange, -r   Range (miles) to use for APRS-IS filter\n"
                "  --metric, -m     Display metric units\n"
+               "  --capture, -C    Append raw input to this capture file\n"
+               "  --replay, -R     Take input from this capture file\n"
+               "  --fast           Replay without the recorded pacing\n"
+               "  --soak N         Replay N times, fast, and check the heap\n"
+               "                   stays flat after [soak] warmup passes\n"
                "\n",
                argv0);
 }
@@ -1885,6 +2104,10 @@ int parse_opts(int argc, char **argv, struct state *state)
                 {"display",   1, 0, 'd'},
                 {"netrange",  1, 0, 'r'},
                 {"metric",    0, 0, 'm'},
+                {"capture",   1, 0, 'C'},
+                {"replay",    1, 0, 'R'},
+                {"fast",      0, 0,  2 },
+                {"soak",      1, 0,  3 },
                 {NULL,        0, 0,  0 },
         };
 
@@ -1898,7 +2121,7 @@ int parse_opts(int argc, char **argv, struct state *state)
                 int c;
                 int optidx;
 
-                c = getopt_long(argc, argv, "ht:g:T:c:svd:r:m",
+                c = getopt_long(argc, argv, "ht:g:T:c:svd:r:mC:R:",
                                 lopts, &optidx);
                 if (c == -1)
                         break;
@@ -1935,6 +2158,18 @@ int parse_opts(int argc, char **argv, struct state *state)
                 case 'm':
                         state->conf.metric_units = 1;
                         break;
+                case 'C':
+                        state->conf.capture_file = optarg;
+                        break;
+                case 'R':
+                        state->conf.replay_file = optarg;
+                        break;
+                case 2:
+                        state->conf.replay_fast = 1;
+                        break;
+                case 3:
+                        state->soak.passes = atoi(optarg);
+                        break;
                 case '?':
                         printf("Unknown option\n");
                         return -1;
@@ -2008,6 +2243,22 @@ int parse_ini(char *filename, struct state *state)
                 state->conf.tnc = iniparser_getstring(ini, "tnc:port", NULL);
         state->conf.tnc_rate = iniparser_getint(ini, "tnc:rate", 9600);
         state->conf.tnc_type = iniparser_getstring(ini, "tnc:type", "KISS");
+        state->conf.air_rate = iniparser_getint(ini, "tnc:air_rate", 1200);
+
+        /* APRS-IS server for tnc:type = NET, as host[:port] */
+        tmp = iniparser_getstring(ini, "tnc:host", "oregon.aprs2.net");
+        state->conf.aprsis_host = strdup(tmp);
+        tmp = strchr(state->conf.aprsis_host, ':');
+        if (tmp) {
+                *tmp = 0;
+                state->conf.aprsis_port = atoi(tmp + 1);
+        } else
+                state->conf.aprsis_port = 14580;
+        state->conf.fast_parse = iniparser_getint(ini, "tnc:fast_parse", 1);
+        state->conf.parse_threads = iniparser_getint(ini,
+                                                     "tnc:parse_threads", 0);
+        state->conf.rf_thread = iniparser_getint(ini, "tnc:rf_thread", 0);
+        state->conf.rt_priority = iniparser_getint(ini, "tnc:rt_priority", 0);
 
         tmp = iniparser_getstring(ini, "tnc:init_kiss_cmd", "");
         state->conf.init_kiss_cmd = process_tnc_cmd(tmp);
@@ -2016,12 +2267,43 @@ int parse_ini(char *filename, struct state *state)
                 state->conf.gps = iniparser_getstring(ini, "gps:port", NULL);
         state->conf.gps_type = iniparser_getstring(ini, "gps:type", "static");
         state->conf.gps_rate = iniparser_getint(ini, "gps:rate", 4800);
+        state->conf.gps_fix_rate = iniparser_getint(ini, "gps:fix_rate", 1);
+        state->clock.fudge = iniparser_getint(ini, "gps:time_fudge", 0) / 1000.0;
 
         if (!state->conf.tel)
                 state->conf.tel = iniparser_getstring(ini, "telemetry:port",
                                                       NULL);
         state->conf.tel_rate = iniparser_getint(ini, "telemetry:rate", 9600);
 
+        state->conf.log_file = iniparser_getstring(ini, "log:file",
+                                                   "/tmp/aprs.log");
+        state->conf.log_size = iniparser_getint(ini, "log:max_size",
+                                                1024) * 1024L;
+        state->conf.log_level = log_level_parse(
+                iniparser_getstring(ini, "log:level", "info"));
+        if (state->conf.log_level < 0) {
+                printf("ERROR: log:level must be debug, info, "
+                       "warn or error\n");
+                return -EINVAL;
+        }
+
+        state->conf.metrics_socket = iniparser_getstring(ini, "metrics:socket",
+                                                         "/tmp/aprs_metrics");
+        state->trace_stats.sample = iniparser_getint(ini, "trace:sample", 0);
+        state->trace_stats.outlier = iniparser_getint(ini, "trace:outlier_ms",
+                                                      0) / 1000.0;
+        state->loop_stats.budget = iniparser_getint(ini, "loop:stall_ms",
+                                                    250) / 1000.0;
+
+        state->soak.warmup = iniparser_getint(ini, "soak:warmup", 1);
+        state->soak.max_growth = iniparser_getint(ini, "soak:max_growth_kb",
+                                                  64) * 1024L;
+
+        if (!state->conf.capture_file)
+                state->conf.capture_file = iniparser_getstring(ini,
+                                                               "capture:file",
+                                                               NULL);
+
         state->mycall = iniparser_getstring(ini, "station:mycall", "N0CAL-7");
         state->conf.icon = iniparser_getstring(ini, "station:icon", "/>");
 
@@ -2040,30 +2322,25 @@ int parse_ini(char *filename, struct state *state)
         state->conf.directivity = iniparser_getint(ini, "station:directivity",
                                                    0);
 
-        state->conf.atrest_rate = iniparser_getint(ini,
-                                                   "beaconing:atrest_rate",
-                                                   600);
-        state->conf.sb_low.speed = iniparser_getint(ini,
-                                                    "beaconing:min_speed",
-                                                    10);
-        state->conf.sb_low.int_sec = iniparser_getint(ini,
-                                                      "beaconing:min_rate",
-                                                      600);
-        state->conf.sb_high.speed = iniparser_getint(ini,
-                                                     "beaconing:max_speed",
-                                                     60);
-        state->conf.sb_high.int_sec = iniparser_getint(ini,
-                                                       "beaconing:max_rate",
-                                                       60);
-        state->conf.course_change_min = iniparser_getint(ini,
-                                                         "beaconing:course_change_min",
-                                                         30);
-        state->conf.course_change_slope = iniparser_getint(ini,
-                                                           "beaconing:course_change_slope",
-                                                           255);
-        state->conf.after_stop = iniparser_getint(ini,
-                                                  "beaconing:after_stop",
-                                                  180);
+        sb_load_config(ini, &state->conf.sb);
+        cls_load_config(ini, &state->classify);
+        state->conf.tx_latency = iniparser_getint(ini,
+                                                  "beaconing:tx_latency",
+                                                  300);
+
+        /* Weather stays uncompressed unless asked for, since the
+         * compressed form wants wind data in the cs bytes
+         */
+        tmp = iniparser_getstring(ini, "beaconing:format", "uncompressed");
+        state->conf.posit_format[DO_TYPE_NONE] = parse_format(
+                iniparser_getstring(ini, "beaconing:format_posit", tmp), 0);
+        state->conf.posit_format[DO_TYPE_PHG] = parse_format(
+                iniparser_getstring(ini, "beaconing:format_phg", tmp), 0);
+        state->conf.posit_format[DO_TYPE_WX] = parse_format(
+                iniparser_getstring(ini, "beaconing:format_weather",
+                                    "uncompressed"), 0);
+        state->conf.moving_format = parse_format(
+                iniparser_getstring(ini, "beaconing:format_moving", "mice"), 1);
 
         state->conf.static_lat = iniparser_getdouble(ini,
                                                      "static:lat",
@@ -2115,37 +2392,46 @@ int parse_ini(char *filename, struct state *state)
 
         tmp = iniparser_getstring(ini, "comments:enabled", "");
         if (strlen(tmp) != 0) {
+                char **names;
                 int i;
 
-                state->conf.comments = parse_list(tmp,
-                                                  &state->conf.comments_count);
-                if (!state->conf.comments)
+                names = parse_list(tmp, &state->conf.comments_count);
+                if (!names)
                         return -EINVAL;
 
+                state->conf.comments = calloc(state->conf.comments_count,
+                                              sizeof(*state->conf.comments));
+                if (!state->conf.comments)
+                        return -ENOMEM;
+
+                /* Catch bad $subst$ now rather than at beacon time */
                 for (i = 0; i < state->conf.comments_count; i++) {
                         char section[32];
 
                         snprintf(section, sizeof(section),
-                                 "comments:%s", state->conf.comments[i]);
-                        free(state->conf.comments[i]);
-                        state->conf.comments[i] = iniparser_getstring(ini,
-                                                                      section,
-                                                                      "INVAL");
+                                 "comments:%s", names[i]);
+                        free(names[i]);
+                        tmp = iniparser_getstring(ini, section, "INVAL");
+                        if (tmpl_compile(&state->conf.comments[i], tmp))
+                                return -EINVAL;
                 }
+                free(names);
         }
         return 0;
 }
 
 int main(int argc, char **argv)
 {
-        int i;
+        int status = 0;
 
         fd_set fds;
+        fd_set wfds;
 
         struct state state;
         memset(&state, 0, sizeof(state));
 
         state.dspfd = -1;
+        state.tnc_txfd = -1;
 
         printf("APRS v0.1.%04i (%s)\n", BUILD, REVISION);
 
@@ -2161,27 +2447,71 @@ int main(int argc, char **argv)
                 exit(1);
         }
 
-        if (!state.conf.verbose)
-                redir_log();
+        /* With -v, the log goes to the terminal */
+        if (log_start(state.conf.verbose ? NULL : state.conf.log_file,
+                      state.conf.log_size, state.conf.log_level)) {
+                printf("Failed to start logging\n");
+                exit(1);
+        }
+        /* The exit(1)s below would otherwise lose what's in the ring */
+        atexit(log_stop);
 
         if (state.conf.testing)
                 state.digi_quality = 0xFF;
 
-        for (i = 0; i < KEEP_PACKETS; i++)
-                state.recent[i] = NULL;
-
         /* Init our static information before we might login to aprs-is below */
         if (STREQ(state.conf.gps_type, "static"))
                 fake_gps_data(&state);
 
-        if (state.conf.tnc && STREQ(state.conf.tnc_type, "KISS")) {
+        if (state.conf.capture_file) {
+                state.capture = capture_open(state.conf.capture_file);
+                if (!state.capture) {
+                        printf("Failed to open capture %s: %m\n",
+                               state.conf.capture_file);
+                        exit(1);
+                }
+        }
+
+        /* Replayed input stands in for all the devices, and whatever
+         * we would transmit goes nowhere
+         */
+        if (state.conf.replay_file) {
+                state.replay = replay_open(state.conf.replay_file);
+                if (!state.replay || !replay_next(state.replay)) {
+                        printf("Failed to read capture %s\n",
+                               state.conf.replay_file);
+                        exit(1);
+                }
+                state.conf.gps = state.conf.tel = NULL;
+                state.tncfd = -1;
+                state.tnc_txfd = open("/dev/null", O_WRONLY);
+
+                if (state.soak.passes) {
+                        if (state.soak.passes <= state.soak.warmup) {
+                                printf("--soak needs more than %i passes\n",
+                                       state.soak.warmup);
+                                exit(1);
+                        }
+                        state.conf.replay_fast = 1;
+                        soak_start(&state.soak, &state.loop_stats);
+                }
+        } else if (state.soak.passes) {
+                printf("--soak needs a capture to --replay\n");
+                exit(1);
+        } else if (state.conf.tnc && STREQ(state.conf.tnc_type, "KISS")) {
                 state.tncfd = serial_open(state.conf.tnc, state.conf.tnc_rate, 1);
                 if (state.tncfd < 0) {
                         printf("Failed to open TNC: %m\n");
                         exit(1);
                 }
+                state.tnc_txfd = serial_open_tx(state.conf.tnc);
+                if (state.tnc_txfd < 0) {
+                        printf("Failed to open TNC for TX: %m\n");
+                        exit(1);
+                }
         } else if (STREQ(state.conf.tnc_type, "NET")) {
-                state.tncfd = aprsis_connect("oregon.aprs2.net", 14580,
+                state.tncfd = aprsis_connect(state.conf.aprsis_host,
+                                             state.conf.aprsis_port,
                                              state.mycall,
                                              MYPOS(&state)->lat,
                                              MYPOS(&state)->lon,
@@ -2189,6 +2519,40 @@ int main(int argc, char **argv)
         } else
                 state.tncfd = -1;
 
+        if ((state.tncfd >= 0) && state.conf.rf_thread &&
+            STREQ(state.conf.tnc_type, "KISS")) {
+                struct rf_config rfc = {
+                        .mycall = state.mycall,
+                        .alias = state.conf.digi_alias,
+                        .append_path = state.conf.digi_append ?
+                                state.conf.digi_path : NULL,
+                        .digi_enabled = state.conf.digi_enabled,
+                        .digi_delay = state.conf.digi_delay,
+                        .priority = state.conf.rt_priority,
+                        .capture = state.capture,
+                };
+
+                state.rf = rf_start(state.tncfd, state.tnc_txfd, &rfc);
+                if (!state.rf) {
+                        printf("Failed to start RF thread\n");
+                        exit(1);
+                }
+                state.last_rf_report = time(NULL);
+        }
+
+        /* Only worth it for the text feed; RF is never that busy */
+        if ((state.tncfd >= 0) && state.conf.parse_threads &&
+            !STREQ(state.conf.tnc_type, "KISS")) {
+                state.pipeline = pipeline_start(state.tncfd,
+                                                state.conf.parse_threads,
+                                                parse_item, &state);
+                if (!state.pipeline) {
+                        printf("Failed to start %i parser threads\n",
+                               state.conf.parse_threads);
+                        exit(1);
+                }
+        }
+
         handle_display_initkiss(&state);
 
         if (state.conf.gps) {
@@ -2197,6 +2561,9 @@ int main(int argc, char **argv)
                         perror(state.conf.gps);
                         exit(1);
                 }
+                if (STREQ(state.conf.gps_type, "ubx"))
+                        ubx_configure(state.gpsfd, state.conf.gps_fix_rate,
+                                      state.conf.gps_rate);
         } else
                 state.gpsfd = -1;
 
@@ -2211,15 +2578,30 @@ int main(int argc, char **argv)
 
         state.disp_idx = -1;
 
+        register_metrics(&state);
+        if (strlen(state.conf.metrics_socket) &&
+            metrics_listen(&state.metrics, state.conf.metrics_socket))
+                log_warn("Unable to serve metrics on %s: %m\n",
+                         state.conf.metrics_socket);
+
         _ui_send(&state, "AI_CALLSIGN", "HELLO");
 
+        clock_gettime(CLOCK_MONOTONIC, &state.replay_start);
+        state.last_loop_report = time(NULL);
+
         while (1) {
                 int ret;
                 struct timeval tv = {1, 0};
+                struct loop_stats *l = &state.loop_stats;
 
                 FD_ZERO(&fds);
+                FD_ZERO(&wfds);
 
-                if (state.tncfd > 0)
+                if (state.pipeline)
+                        FD_SET(pipeline_fd(state.pipeline), &fds);
+                else if (state.rf)
+                        FD_SET(rf_fd(state.rf), &fds);
+                else if (state.tncfd > 0)
                         FD_SET(state.tncfd, &fds);
                 if (state.gpsfd > 0)
                         FD_SET(state.gpsfd, &fds);
@@ -2227,35 +2609,114 @@ int main(int argc, char **argv)
                         FD_SET(state.telfd, &fds);
                 if (state.dspfd > 0)
                         FD_SET(state.dspfd, &fds);
+                if (state.metrics.fd >= 0)
+                        FD_SET(state.metrics.fd, &fds);
+                if (txbuf_pending(&state.txbuf))
+                        FD_SET(state.tnc_txfd, &wfds);
 
                 if (STREQ(state.conf.gps_type, "static"))
                         fake_gps_data(&state);
 
-                ret = select(100, &fds, NULL, NULL, &tv);
+                if (state.replay) {
+                        int64_t ns = replay_delay(&state);
+
+                        if (ns < 1000000000LL) {
+                                tv.tv_sec = 0;
+                                tv.tv_usec = ns > 0 ? (ns + 999) / 1000 : 0;
+                        }
+                }
+
+                txq_timeout(&state.txq, &tv);
+
+                ret = select(100, &fds, &wfds, NULL, &tv);
+                loop_begin(l);
                 if (ret == -1) {
-                        perror("select");
+                        log_error("select: %m\n");
                         if (errno == EBADF)
                                 break;
                         continue;
                 } else if (ret > 0) {
-                        if (FD_ISSET(state.tncfd, &fds))
+                        loop_enter(l);
+                        if (state.pipeline &&
+                            FD_ISSET(pipeline_fd(state.pipeline), &fds)) {
+                                handle_pipeline(&state);
+                                loop_leave(l, LH_TNC);
+                        } else if (state.rf &&
+                                   FD_ISSET(rf_fd(state.rf), &fds)) {
+                                if (handle_rf(&state) < 0) {
+                                        status = 1;
+                                        break;
+                                }
+                                loop_leave(l, LH_TNC);
+                        } else if (FD_ISSET(state.tncfd, &fds)) {
                                 handle_incoming_packet(&state);
-                        if (FD_ISSET(state.gpsfd, &fds))
+                                loop_leave(l, LH_TNC);
+                        }
+                        if (FD_ISSET(state.gpsfd, &fds)) {
+                                loop_enter(l);
                                 handle_gps_data(&state);
-                        if (FD_ISSET(state.telfd, &fds))
+                                loop_leave(l, LH_GPS);
+                        }
+                        if (FD_ISSET(state.telfd, &fds)) {
+                                loop_enter(l);
                                 handle_telemetry(&state);
-                        if (FD_ISSET(state.dspfd, &fds))
+                                loop_leave(l, LH_TELEMETRY);
+                        }
+                        if (FD_ISSET(state.dspfd, &fds)) {
+                                loop_enter(l);
                                 handle_display(&state);
+                                loop_leave(l, LH_DISPLAY);
+                        }
+                        if (FD_ISSET(state.tnc_txfd, &wfds)) {
+                                loop_enter(l);
+                                txbuf_drain(&state.txbuf, state.tnc_txfd);
+                                loop_leave(l, LH_TXBUF);
+                        }
+                        if ((state.metrics.fd >= 0) &&
+                            FD_ISSET(state.metrics.fd, &fds)) {
+                                loop_enter(l);
+                                metrics_serve(&state.metrics);
+                                loop_leave(l, LH_METRICS);
+                        }
                 } else {
                         /* Work to do if no other events */
+                        loop_enter(l);
                         update_packets_ui(&state);
+                        loop_leave(l, LH_UI);
+                }
+
+                if (state.replay && (handle_replay(&state) < 0)) {
+                        if (!state.soak.passes ||
+                            !soak_pass(&state.soak, l, state.replay->records) ||
+                            !replay_again(&state))
+                                break;
                 }
 
+                loop_enter(l);
+                send_queued(&state);
+                loop_leave(l, LH_DIGI);
+
+                loop_enter(l);
                 beacon(&state);
+                loop_leave(l, LH_BEACON);
+
                 fflush(NULL);
+
+                loop_end(l);
+                if (HAS_BEEN(state.last_loop_report, 3600)) {
+                        loop_report(l);
+                        state.last_loop_report = time(NULL);
+                }
         }
 
+        if (state.soak.passes && soak_report(&state.soak, &state.loop_stats))
+                status = 1;
+
+        if (state.rf)
+                rf_stop(state.rf);
+
         fap_cleanup();
+        log_stop();
 
-        return 0;
+        return status;
 }
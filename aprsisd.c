@@ -0,0 +1,340 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+/* APRS-IS stand-in
+ *
+ * Takes one client at a time, accepts its "user ... filter ..." login
+ * and streams a corpus of TNC2 lines to it at a fixed rate, so aprs's
+ * NET input can be driven and measured without the internet. Once a
+ * second it reports how many lines went out and how long write()
+ * blocked; when the client can't keep up, the achieved rate falls
+ * behind and the blocked time climbs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_LINES 65536
+#define OUT_BUF   65536
+#define TICK_NS   1000000 /* Pacing granularity */
+
+struct server {
+        char **lines;
+        int count;
+
+        int port;
+        int rate;              /* Lines per second, 0 for flat out */
+        int segment;           /* Bytes per write(), 0 for whole batches */
+        unsigned long limit;   /* Lines per client, 0 for no limit */
+
+        char buf[OUT_BUF];
+        int len;
+
+        unsigned long sent;
+        double blocked;        /* Seconds spent in write() */
+};
+
+static double now_secs(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static int load_lines(struct server *s, const char *path)
+{
+        char line[512];
+        FILE *fp;
+
+        fp = fopen(path, "r");
+        if (!fp)
+                return -errno;
+
+        s->lines = calloc(MAX_LINES, sizeof(char *));
+        if (!s->lines) {
+                fclose(fp);
+                return -ENOMEM;
+        }
+
+        while (fgets(line, sizeof(line), fp) && (s->count < MAX_LINES)) {
+                line[strcspn(line, "\r\n")] = 0;
+                if (!line[0] || (line[0] == '#'))
+                        continue;
+                s->lines[s->count++] = strdup(line);
+        }
+
+        fclose(fp);
+
+        return s->count ? 0 : -EINVAL;
+}
+
+static int write_all(int fd, const char *buf, int len)
+{
+        int ret;
+
+        while (len > 0) {
+                ret = write(fd, buf, len);
+                if (ret < 0 && errno == EINTR)
+                        continue;
+                if (ret <= 0)
+                        return -1;
+                buf += ret;
+                len -= ret;
+        }
+
+        return 0;
+}
+
+/* Send what's buffered, @segment bytes to a write(). With TCP_NODELAY
+ * each of those goes out as its own segment, if the window allows.
+ */
+static int flush_out(struct server *s, int fd)
+{
+        double start = now_secs();
+        int chunk = s->segment ? s->segment : s->len;
+        int off;
+        int ret = 0;
+
+        for (off = 0; off < s->len; off += chunk) {
+                if (chunk > s->len - off)
+                        chunk = s->len - off;
+                ret = write_all(fd, s->buf + off, chunk);
+                if (ret)
+                        break;
+        }
+
+        s->blocked += now_secs() - start;
+        s->len = 0;
+
+        return ret;
+}
+
+/* The login is one line; all we need from it is the callsign */
+static int read_login(int fd, char *call, int size)
+{
+        char line[512];
+        int len = 0;
+        int ret;
+
+        while (len < sizeof(line) - 1) {
+                ret = read(fd, &line[len], 1);
+                if (ret <= 0)
+                        return -1;
+                if (line[len] == '\n')
+                        break;
+                len++;
+        }
+        line[len] = 0;
+        line[strcspn(line, "\r")] = 0;
+
+        printf("Login: %s\n", line);
+
+        if (sscanf(line, "user %15s", call) != 1)
+                return -1;
+        call[size - 1] = 0;
+
+        return 0;
+}
+
+static void serve(struct server *s, int fd)
+{
+        char call[16];
+        char hello[128];
+        double start, last_report, due;
+        unsigned long idx = 0;
+        unsigned long last_sent = 0;
+        double last_blocked = 0;
+        int one = 1;
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (write_all(fd, "# aprsisd 0.1\r\n", 15))
+                return;
+        if (read_login(fd, call, sizeof(call)))
+                return;
+        snprintf(hello, sizeof(hello),
+                 "# logresp %s unverified, server aprsisd\r\n", call);
+        if (write_all(fd, hello, strlen(hello)))
+                return;
+
+        s->sent = 0;
+        s->blocked = 0;
+        start = last_report = now_secs();
+
+        while (!s->limit || (s->sent < s->limit)) {
+                double now = now_secs();
+
+                /* Lines due by now, or a buffer's worth flat out */
+                due = s->rate ? (now - start) * s->rate : s->sent + MAX_LINES;
+
+                while ((s->sent < due) &&
+                       (!s->limit || (s->sent < s->limit))) {
+                        const char *line = s->lines[idx++ % s->count];
+                        int len = strlen(line);
+
+                        if (s->len + len + 2 > sizeof(s->buf))
+                                break;
+                        memcpy(s->buf + s->len, line, len);
+                        memcpy(s->buf + s->len + len, "\r\n", 2);
+                        s->len += len + 2;
+                        s->sent++;
+                }
+
+                if (s->len && flush_out(s, fd)) {
+                        printf("Client went away\n");
+                        break;
+                }
+
+                now = now_secs();
+                if (now - last_report >= 1.0) {
+                        printf("%s: %lu lines, %.0f/s, %.0f ms blocked\n",
+                               call, s->sent,
+                               (s->sent - last_sent) / (now - last_report),
+                               (s->blocked - last_blocked) * 1000);
+                        last_report = now;
+                        last_sent = s->sent;
+                        last_blocked = s->blocked;
+                }
+
+                if (s->rate) {
+                        struct timespec tick = {0, TICK_NS};
+
+                        nanosleep(&tick, NULL);
+                }
+        }
+
+        printf("%s: %lu lines in %.3f s (%.0f/s), %.3f s blocked\n",
+               call, s->sent, now_secs() - start,
+               s->sent / (now_secs() - start), s->blocked);
+}
+
+static int listen_on(int port)
+{
+        struct sockaddr_in sa;
+        int one = 1;
+        int sock;
+
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0)
+                return -errno;
+
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_ANY);
+        sa.sin_port = htons(port);
+
+        if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) ||
+            listen(sock, 1)) {
+                close(sock);
+                return -errno;
+        }
+
+        return sock;
+}
+
+void usage(char *argv0)
+{
+        printf("Usage:\n"
+               "%s [OPTS] CORPUS\n"
+               "  CORPUS is a file of TNC2 packets, one per line\n"
+               "Options:\n"
+               "  --help, -h       This help message\n"
+               "  --port, -p       TCP port to listen on (default 14580)\n"
+               "  --rate, -r       Lines per second (default 1000, 0=max)\n"
+               "  --segment, -s    Bytes per write (default 0, whole batch)\n"
+               "  --count, -n      Lines per client (default 0, no limit)\n"
+               "\n",
+               argv0);
+}
+
+int main(int argc, char **argv)
+{
+        static struct option lopts[] = {
+                {"help",    0, 0, 'h'},
+                {"port",    1, 0, 'p'},
+                {"rate",    1, 0, 'r'},
+                {"segment", 1, 0, 's'},
+                {"count",   1, 0, 'n'},
+                {NULL,      0, 0,  0 },
+        };
+        static struct server s;
+        int sock;
+        int fd;
+
+        s.port = 14580;
+        s.rate = 1000;
+
+        while (1) {
+                int c;
+                int optidx;
+
+                c = getopt_long(argc, argv, "hp:r:s:n:", lopts, &optidx);
+                if (c == -1)
+                        break;
+
+                switch (c) {
+                case 'h':
+                        usage(argv[0]);
+                        return 1;
+                case 'p':
+                        s.port = atoi(optarg);
+                        break;
+                case 'r':
+                        s.rate = atoi(optarg);
+                        break;
+                case 's':
+                        s.segment = atoi(optarg);
+                        break;
+                case 'n':
+                        s.limit = strtoul(optarg, NULL, 10);
+                        break;
+                default:
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+
+        if (optind >= argc) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        if (load_lines(&s, argv[optind])) {
+                printf("No packets in %s\n", argv[optind]);
+                return 1;
+        }
+
+        signal(SIGPIPE, SIG_IGN);
+        setvbuf(stdout, NULL, _IOLBF, 0); /* Reports, even when piped */
+
+        sock = listen_on(s.port);
+        if (sock < 0) {
+                printf("Unable to listen on %i: %s\n",
+                       s.port, strerror(-sock));
+                return 1;
+        }
+
+        printf("Serving %i packets on port %i at %i lines/s\n",
+               s.count, s.port, s.rate);
+
+        while ((fd = accept(sock, NULL, NULL)) >= 0) {
+                serve(&s, fd);
+                close(fd);
+        }
+
+        return 0;
+}
@@ -0,0 +1,449 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "ax25.h"
+
+#define STRNEQ(x,y,n) (strncmp(x, y, n) == 0)
+
+/* Feed one byte from the TNC. When it completes a frame, returns the
+ * length of the escaped frame (FEND to FEND) in k->buf, which stays
+ * valid until the next call; otherwise returns 0. A FEND that closes
+ * one frame also opens the next.
+ */
+int kiss_rx_byte(struct kiss_rx *k, uint8_t byte)
+{
+        int len;
+
+        if (byte == KISS_FEND) {
+                len = k->len;
+                k->buf[0] = KISS_FEND;
+                k->len = 1;
+                if (len <= 1)
+                        return 0;
+                k->buf[len] = KISS_FEND;
+                return len + 1;
+        }
+
+        if (k->len == 0)
+                return 0; /* Not in a frame yet */
+
+        if (k->len >= sizeof(k->buf) - 1) {
+                k->len = 0; /* Runaway, wait for the next FEND */
+                return 0;
+        }
+
+        k->buf[k->len++] = byte;
+
+        return 0;
+}
+
+/* Strip the FENDs and command byte of a KISS data frame and undo the
+ * escaping. Returns the AX.25 frame length, or -1.
+ */
+int kiss_unescape(const uint8_t *kiss, int len, uint8_t *frame, int max)
+{
+        int i = 0;
+        int out = 0;
+
+        while ((i < len) && (kiss[i] == KISS_FEND))
+                i++;
+
+        /* Port/command byte; only data frames carry AX.25 */
+        if ((i >= len) || ((kiss[i] & 0x0F) != 0))
+                return -1;
+        i++;
+
+        for (; (i < len) && (kiss[i] != KISS_FEND); i++) {
+                uint8_t byte = kiss[i];
+
+                if (byte == KISS_FESC) {
+                        if (++i >= len)
+                                return -1;
+                        byte = kiss[i] == KISS_TFEND ? KISS_FEND : KISS_FESC;
+                }
+
+                if (out == max)
+                        return -1;
+                frame[out++] = byte;
+        }
+
+        return out;
+}
+
+/* Wrap an AX.25 frame as a KISS data frame on port 0. Returns the
+ * KISS length, or -1 if @max is too small.
+ */
+int kiss_escape(const uint8_t *frame, int len, uint8_t *kiss, int max)
+{
+        int out = 0;
+        int i;
+
+        if (max < 3)
+                return -1;
+
+        kiss[out++] = KISS_FEND;
+        kiss[out++] = 0x00;
+
+        for (i = 0; i < len; i++) {
+                if ((frame[i] == KISS_FEND) || (frame[i] == KISS_FESC)) {
+                        if (out + 2 > max - 1)
+                                return -1;
+                        kiss[out++] = KISS_FESC;
+                        kiss[out++] = frame[i] == KISS_FEND ?
+                                KISS_TFEND : KISS_TFESC;
+                } else {
+                        if (out + 1 > max - 1)
+                                return -1;
+                        kiss[out++] = frame[i];
+                }
+        }
+
+        kiss[out++] = KISS_FEND;
+
+        return out;
+}
+
+static int kiss_put(uint8_t *kiss, int *out, int max, uint8_t byte)
+{
+        /* Always leave room for the closing FEND */
+        if ((byte == KISS_FEND) || (byte == KISS_FESC)) {
+                if (*out + 3 > max)
+                        return -1;
+                kiss[(*out)++] = KISS_FESC;
+                kiss[(*out)++] = byte == KISS_FEND ? KISS_TFEND : KISS_TFESC;
+        } else {
+                if (*out + 2 > max)
+                        return -1;
+                kiss[(*out)++] = byte;
+        }
+
+        return 0;
+}
+
+/* Encode @len bytes of "CALL-N" (optionally "CALL-N*" for a repeated
+ * digi) into a 7-byte address, extension bit clear
+ */
+static int ax25_addr(uint8_t *addr, const char *call, int len)
+{
+        int ssid = 0;
+        int i = 0;
+        int h = 0;
+
+        if ((len > 0) && (call[len - 1] == '*')) {
+                h = AX25_H_BIT;
+                len--;
+        }
+
+        for (; (i < len) && (call[i] != '-'); i++) {
+                char c = call[i];
+
+                if (i == 6)
+                        return -1;
+                if ((c >= 'a') && (c <= 'z'))
+                        c -= 'a' - 'A';
+                addr[i] = c << 1;
+        }
+        if (i == 0)
+                return -1;
+        memset(&addr[i], ' ' << 1, 6 - i);
+
+        if (i < len) {
+                for (i++; i < len; i++) {
+                        if ((call[i] < '0') || (call[i] > '9'))
+                                return -1;
+                        ssid = (ssid * 10) + (call[i] - '0');
+                }
+                if (ssid > 15)
+                        return -1;
+        }
+
+        addr[6] = 0x60 | (ssid << 1) | h;
+
+        return 0;
+}
+
+static int kiss_put_addr(uint8_t *kiss, int *out, int max,
+                         const char *call, int len, int flags)
+{
+        uint8_t addr[AX25_ADDR_LEN];
+        int i;
+
+        if (ax25_addr(addr, call, len))
+                return -1;
+        addr[6] |= flags;
+
+        if (*out + AX25_ADDR_LEN + 1 <= max) {
+                /* Shifted ASCII is never FEND or FESC, SSID bytes can't be */
+                for (i = 0; i < AX25_ADDR_LEN; i++)
+                        if ((addr[i] == KISS_FEND) || (addr[i] == KISS_FESC))
+                                break;
+                if (i == AX25_ADDR_LEN) {
+                        memcpy(&kiss[*out], addr, AX25_ADDR_LEN);
+                        *out += AX25_ADDR_LEN;
+                        return 0;
+                }
+        }
+
+        for (i = 0; i < AX25_ADDR_LEN; i++)
+                if (kiss_put(kiss, out, max, addr[i]))
+                        return -1;
+
+        return 0;
+}
+
+/* Build an AX.25 UI frame and KISS-escape it into @kiss in one pass.
+ * @path is a comma-separated digipeater list (may be empty). Returns
+ * the KISS length, or -1 if it does not fit in @max.
+ */
+int kiss_encode_ui(uint8_t *kiss, int max,
+                   const char *src, const char *dst, const char *path,
+                   const char *info, int info_len)
+{
+        int out = 0;
+        int ndigi = 0;
+        int i;
+
+        if (max < 3)
+                return -1;
+
+        kiss[out++] = KISS_FEND;
+        kiss[out++] = 0x00;
+
+        if (kiss_put_addr(kiss, &out, max, dst, strlen(dst), AX25_C_BIT))
+                return -1;
+        if (kiss_put_addr(kiss, &out, max, src, strlen(src),
+                          *path ? 0 : AX25_EXT_BIT))
+                return -1;
+
+        while (*path) {
+                const char *end = strchr(path, ',');
+                int n = end ? end - path : strlen(path);
+
+                if (++ndigi > AX25_MAX_DIGIS)
+                        return -1;
+                if (kiss_put_addr(kiss, &out, max, path, n,
+                                  end ? 0 : AX25_EXT_BIT))
+                        return -1;
+
+                path += end ? n + 1 : n;
+        }
+
+        if (kiss_put(kiss, &out, max, AX25_CTRL_UI) ||
+            kiss_put(kiss, &out, max, AX25_PID_NONE))
+                return -1;
+
+        if (out + (2 * info_len) + 1 <= max) {
+                /* Fits even if every byte needs escaping */
+                for (i = 0; i < info_len; i++) {
+                        uint8_t byte = info[i];
+
+                        if ((byte == KISS_FEND) || (byte == KISS_FESC)) {
+                                kiss[out++] = KISS_FESC;
+                                kiss[out++] = byte == KISS_FEND ?
+                                        KISS_TFEND : KISS_TFESC;
+                        } else {
+                                kiss[out++] = byte;
+                        }
+                }
+        } else {
+                for (i = 0; i < info_len; i++)
+                        if (kiss_put(kiss, &out, max, info[i]))
+                                return -1;
+        }
+
+        kiss[out++] = KISS_FEND;
+
+        return out;
+}
+
+/* As kiss_encode_ui(), taking the fields from a TNC2 "SRC>DST,PATH:info"
+ * string such as the beacon encoders produce
+ */
+int kiss_encode_tnc2(uint8_t *kiss, int max, const char *packet)
+{
+        char src[16], dst[16], path[128];
+        const char *gt = strchr(packet, '>');
+        const char *colon = strchr(packet, ':');
+        const char *comma;
+        int n;
+
+        if (!gt || !colon || (colon < gt) || (gt - packet >= sizeof(src)))
+                return -1;
+        memcpy(src, packet, gt - packet);
+        src[gt - packet] = 0;
+
+        comma = memchr(gt, ',', colon - gt);
+        n = (comma ? comma : colon) - (gt + 1);
+        if (n >= sizeof(dst))
+                return -1;
+        memcpy(dst, gt + 1, n);
+        dst[n] = 0;
+
+        n = comma ? colon - (comma + 1) : 0;
+        if (n >= sizeof(path))
+                return -1;
+        memcpy(path, comma ? comma + 1 : colon, n);
+        path[n] = 0;
+
+        return kiss_encode_ui(kiss, max, src, dst, path,
+                              colon + 1, strlen(colon + 1));
+}
+
+/* Encode "CALL-N" into a 7-byte address, H and extension bits clear */
+int ax25_put_call(uint8_t *addr, const char *call)
+{
+        int len = strlen(call);
+
+        if ((len > 0) && (call[len - 1] == '*'))
+                return -1;
+
+        return ax25_addr(addr, call, len);
+}
+
+/* Decode a 7-byte address into "CALL-N" (or "CALL" for SSID 0) */
+int ax25_get_call(const uint8_t *addr, char *call, int len)
+{
+        char base[7];
+        int ssid = (addr[6] >> 1) & 0x0F;
+        int i;
+
+        for (i = 0; i < 6; i++) {
+                base[i] = addr[i] >> 1;
+                if (base[i] == ' ')
+                        break;
+        }
+        base[i] = 0;
+
+        if (ssid)
+                return snprintf(call, len, "%s-%i", base, ssid);
+        else
+                return snprintf(call, len, "%s", base);
+}
+
+static int ax25_addr_count(const uint8_t *frame, int len)
+{
+        int i;
+
+        for (i = 0; (i + 1) * AX25_ADDR_LEN <= len; i++)
+                if (frame[(i * AX25_ADDR_LEN) + 6] & AX25_EXT_BIT)
+                        return i + 1;
+
+        return -1;
+}
+
+static int ax25_set_ssid(uint8_t *addr, int ssid)
+{
+        addr[6] = (addr[6] & ~0x1E) | (ssid << 1);
+
+        return ssid;
+}
+
+/* Rewrite the digipeater path of @frame in place, if the first digi
+ * that has not yet repeated it is @alias (prefix match, as in the
+ * TNC2 days) or @mycall:
+ *
+ *  - With @append_path, that digi and the rest of the path become
+ *    mycall*,append_path
+ *  - A WIDEn-N style alias with N > 1 gets mycall* inserted ahead of it
+ *    and N decremented
+ *  - Otherwise it is replaced by mycall*
+ *
+ * Returns the new frame length, 0 if the frame is not for us, or -1 if
+ * it is malformed or the result would not fit in @max.
+ */
+int ax25_digipeat(uint8_t *frame, int len, int max,
+                  const char *mycall, const char *alias,
+                  const char *append_path)
+{
+        uint8_t path[AX25_MAX_DIGIS * AX25_ADDR_LEN];
+        uint8_t me[AX25_ADDR_LEN];
+        char call[16];
+        int naddr = ax25_addr_count(frame, len);
+        int ndigi;
+        int first;
+        int out;
+        int ssid;
+        int i;
+
+        if (naddr < 3 || naddr > (2 + AX25_MAX_DIGIS))
+                return naddr < 0 ? -1 : 0;
+        ndigi = naddr - 2;
+
+        for (first = 0; first < ndigi; first++)
+                if (!(frame[(2 + first) * AX25_ADDR_LEN + 6] & AX25_H_BIT))
+                        break;
+        if (first == ndigi)
+                return 0;
+
+        ax25_get_call(&frame[(2 + first) * AX25_ADDR_LEN], call, sizeof(call));
+        if (strcmp(call, mycall) &&
+            !STRNEQ(call, alias, strlen(alias)))
+                return 0;
+
+        if (ax25_put_call(me, mycall))
+                return -1;
+        me[6] |= AX25_H_BIT;
+
+        /* Build the new path after the digis that already repeated it */
+        memcpy(path, &frame[2 * AX25_ADDR_LEN], first * AX25_ADDR_LEN);
+        out = first;
+        memcpy(&path[out++ * AX25_ADDR_LEN], me, AX25_ADDR_LEN);
+
+        ssid = (frame[(2 + first) * AX25_ADDR_LEN + 6] >> 1) & 0x0F;
+
+        if (append_path) {
+                const char *ptr = append_path;
+
+                while (*ptr) {
+                        const char *end = strchr(ptr, ',');
+                        int n = end ? end - ptr : strlen(ptr);
+
+                        if ((out == AX25_MAX_DIGIS) || (n >= sizeof(call)))
+                                return -1;
+                        memcpy(call, ptr, n);
+                        call[n] = 0;
+                        if (ax25_put_call(&path[out++ * AX25_ADDR_LEN], call))
+                                return -1;
+
+                        ptr += n;
+                        if (*ptr == ',')
+                                ptr++;
+                }
+        } else {
+                i = first;
+                if (strcmp(call, mycall) && (ssid > 1)) {
+                        /* Keep the alias, one hop used up */
+                        if (ndigi == AX25_MAX_DIGIS)
+                                return -1;
+                } else {
+                        i++;
+                }
+
+                memcpy(&path[out * AX25_ADDR_LEN],
+                       &frame[(2 + i) * AX25_ADDR_LEN],
+                       (ndigi - i) * AX25_ADDR_LEN);
+                if (i == first)
+                        ax25_set_ssid(&path[out * AX25_ADDR_LEN], ssid - 1);
+                out += ndigi - i;
+        }
+
+        for (i = 0; i < out; i++)
+                path[(i * AX25_ADDR_LEN) + 6] &= ~AX25_EXT_BIT;
+        path[((out - 1) * AX25_ADDR_LEN) + 6] |= AX25_EXT_BIT;
+
+        /* Slide the control/PID/info to fit the new path */
+        if (len + (out - ndigi) * AX25_ADDR_LEN > max)
+                return -1;
+
+        memmove(&frame[(2 + out) * AX25_ADDR_LEN],
+                &frame[naddr * AX25_ADDR_LEN],
+                len - (naddr * AX25_ADDR_LEN));
+        memcpy(&frame[2 * AX25_ADDR_LEN], path, out * AX25_ADDR_LEN);
+        frame[(AX25_ADDR_LEN * 2) - 1] &= ~AX25_EXT_BIT;
+
+        return len + (out - ndigi) * AX25_ADDR_LEN;
+}
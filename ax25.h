@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __AX25_H
+#define __AX25_H
+
+#include <stdint.h>
+
+#define AX25_ADDR_LEN  7
+#define AX25_MAX_DIGIS 8
+#define AX25_MAX_FRAME 512
+
+#define AX25_H_BIT     0x80    /* Has-been-repeated, digi addresses */
+#define AX25_EXT_BIT   0x01    /* Set on the last address */
+#define AX25_C_BIT     0x80    /* Command, on the destination */
+
+#define KISS_FEND  0xC0
+#define KISS_FESC  0xDB
+#define KISS_TFEND 0xDC
+#define KISS_TFESC 0xDD
+
+#define AX25_CTRL_UI   0x03
+#define AX25_PID_NONE  0xF0
+
+/* Incremental KISS receiver, for reading a TNC in whatever chunks the
+ * driver hands us
+ */
+struct kiss_rx {
+        uint8_t buf[AX25_MAX_FRAME * 2];
+        int len;
+};
+
+int kiss_rx_byte(struct kiss_rx *k, uint8_t byte);
+int kiss_unescape(const uint8_t *kiss, int len, uint8_t *frame, int max);
+int kiss_escape(const uint8_t *frame, int len, uint8_t *kiss, int max);
+
+int kiss_encode_ui(uint8_t *kiss, int max,
+                   const char *src, const char *dst, const char *path,
+                   const char *info, int info_len);
+int kiss_encode_tnc2(uint8_t *kiss, int max, const char *packet);
+
+int ax25_put_call(uint8_t *addr, const char *call);
+int ax25_get_call(const uint8_t *addr, char *call, int len);
+int ax25_digipeat(uint8_t *frame, int len, int max,
+                  const char *mycall, const char *alias,
+                  const char *append_path);
+
+#endif
@@ -0,0 +1,281 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "beacon.h"
+
+#define M_TO_FT(m) (m * 3.2808399)
+
+/* Mic-E destination characters: plain digit, or digit with the
+ * message/N/100/W bit set
+ */
+static const char mice_dest[2][10] = {
+        { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9' },
+        { 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y' },
+};
+
+static const int pow10_tbl[] = { 1, 10, 100, 1000, 10000, 100000 };
+static const unsigned int pow91_tbl[] = { 1, 91, 91 * 91, 91 * 91 * 91 };
+
+/* Compression type byte: current fix, software origin, and whether
+ * the cs bytes came from a GGA (altitude) or not (course/speed)
+ */
+#define COMP_TYPE_CRS_SPD (33 + 0x22)
+#define COMP_TYPE_ALT     (33 + 0x32)
+
+struct outbuf {
+        char *ptr;
+        char *end;
+};
+
+static void out_chr(struct outbuf *o, char c)
+{
+        if (o->ptr < o->end)
+                *o->ptr = c;
+        o->ptr++;
+}
+
+static void out_str(struct outbuf *o, const char *s)
+{
+        while (*s)
+                out_chr(o, *s++);
+}
+
+/* Zero-padded decimal, like %0*i */
+static void out_num(struct outbuf *o, int value, int width)
+{
+        char tmp[12];
+        unsigned int v;
+        int i = 0;
+
+        if (value < 0) {
+                out_chr(o, '-');
+                v = -value;
+                width--;
+        } else
+                v = value;
+
+        do {
+                tmp[i++] = '0' + (v % 10);
+                v /= 10;
+        } while (v || (i < width));
+
+        while (i)
+                out_chr(o, tmp[--i]);
+}
+
+static int out_finish(struct outbuf *o, char *buf)
+{
+        if (o->ptr > o->end)
+                return -1;
+
+        *o->ptr = '\0';
+
+        return o->ptr - buf;
+}
+
+/* DDMM.mm (@deg_width 2) or DDDMM.mm (@deg_width 3) */
+static void out_latlon(struct outbuf *o, double value, int deg_width)
+{
+        int deg = (int)floor(value);
+        int hmin = (int)rint((value - deg) * 6000);
+
+        if (hmin >= 6000) {
+                deg++;
+                hmin -= 6000;
+        }
+
+        out_num(o, deg, deg_width);
+        out_num(o, hmin / 100, 2);
+        out_chr(o, '.');
+        out_num(o, hmin % 100, 2);
+}
+
+/* Four base-91 digits, most significant first */
+static void out_base91(struct outbuf *o, unsigned int value)
+{
+        int i;
+
+        for (i = 3; i >= 0; i--) {
+                out_chr(o, 33 + (value / pow91_tbl[i]));
+                value %= pow91_tbl[i];
+        }
+}
+
+int mice_encode(char *buf, int len,
+                const char *call, const char *path, const char *icon,
+                struct posit *pos)
+{
+        struct outbuf o = { buf, buf + len - 1 };
+        double ldeg, lmin;
+        double Ldeg, Lmin;
+        double _min, _hun;
+        int lat;
+        int north = pos->lat > 0;
+        int lonsc = fabs(pos->lon) >= 100 || fabs(pos->lon) < 10;
+        int west = pos->lon <= 0;
+        int lon_deg = 0;
+        int lon_min, lon_hun;
+        int speed = (int)pos->speed;
+        int course = (int)pos->course;
+        unsigned int atemp;
+        int i;
+
+        lmin = modf(fabs(pos->lat), &ldeg) * 60;
+        Lmin = modf(fabs(pos->lon), &Ldeg) * 60;
+
+        /* Latitude DDMMmm encoded in base-10 */
+        lat = (ldeg * 10000) + (lmin * 100);
+
+        /* Longitude degrees encoded per APRS spec */
+        if (Ldeg <= 9)
+                lon_deg = (int)Ldeg + 118;
+        else if (Ldeg <= 99)
+                lon_deg = (int)Ldeg + 28;
+        else if (Ldeg <= 109)
+                lon_deg = (int)Ldeg + 108;
+        else if (Ldeg <= 179)
+                lon_deg = ((int)Ldeg - 100) + 28;
+
+        /* Minutes and hundredths of a minute encoded per APRS spec */
+        _hun = modf(Lmin, &_min);
+        lon_min = (int)_min + (Lmin > 10 ? 28 : 88);
+        lon_hun = (int)(_hun * 100) + 28;
+
+        out_str(&o, call);
+        out_chr(&o, '>');
+        out_chr(&o, mice_dest[1][(lat / pow10_tbl[5]) % 10]);
+        out_chr(&o, mice_dest[0][(lat / pow10_tbl[4]) % 10]);
+        out_chr(&o, mice_dest[1][(lat / pow10_tbl[3]) % 10]);
+        out_chr(&o, mice_dest[north][(lat / pow10_tbl[2]) % 10]);
+        out_chr(&o, mice_dest[lonsc][(lat / pow10_tbl[1]) % 10]);
+        out_chr(&o, mice_dest[west][lat % 10]);
+        out_chr(&o, ',');
+        out_str(&o, path);
+        out_str(&o, ":`");
+
+        out_chr(&o, lon_deg);
+        out_chr(&o, lon_min);
+        out_chr(&o, lon_hun);
+
+        /* Speed (knots) and course, split across three bytes */
+        out_chr(&o, (unsigned char)((pos->speed / 10) + 108));
+        out_chr(&o, 32 + ((speed % 10) * 10) + (course / 100));
+        out_chr(&o, (course % 100) + 28);
+
+        out_chr(&o, icon[1]);
+        out_chr(&o, icon[0]);
+
+        /* Altitude, base-91, meters above -10km, leading zero dropped */
+        atemp = pos->alt + 10000;
+        for (i = 3; i >= 0; i--) {
+                char digit = 33 + (atemp / pow91_tbl[i]);
+
+                atemp %= pow91_tbl[i];
+                if ((i == 3) && (digit == 33))
+                        continue;
+                out_chr(&o, digit);
+        }
+        out_chr(&o, '}');
+
+        return out_finish(&o, buf);
+}
+
+int posit_encode(char *buf, int len,
+                 const char *call, const char *path,
+                 char table, char symbol,
+                 struct posit *pos, const char *payload)
+{
+        struct outbuf o = { buf, buf + len - 1 };
+
+        out_str(&o, call);
+        out_str(&o, ">APZDMS,");
+        out_str(&o, path);
+        out_str(&o, ":!");
+
+        out_latlon(&o, fabs(pos->lat), 2);
+        out_chr(&o, pos->lat > 0 ? 'N' : 'S');
+        out_chr(&o, table);
+        out_latlon(&o, fabs(pos->lon), 3);
+        out_chr(&o, pos->lon > 0 ? 'E' : 'W');
+        out_chr(&o, symbol);
+
+        if (pos->speed > 5) {
+                out_num(&o, (int)rint(pos->course), 3);
+                out_chr(&o, '/');
+                out_num(&o, (int)rint(pos->speed), 3);
+        }
+
+        out_str(&o, "/A=");
+        out_num(&o, (int)M_TO_FT(pos->alt), 6);
+        out_str(&o, payload);
+
+        return out_finish(&o, buf);
+}
+
+/* APRS compressed position: /YYYYXXXX$csT
+ *
+ * If @with_speed is set (and we're moving) the cs bytes carry course
+ * and speed, otherwise they carry altitude.
+ */
+int compressed_encode(char *buf, int len,
+                      const char *call, const char *path,
+                      char table, char symbol,
+                      struct posit *pos, int with_speed, const char *payload)
+{
+        struct outbuf o = { buf, buf + len - 1 };
+        double alt_ft = M_TO_FT(pos->alt);
+        int cs;
+
+        out_str(&o, call);
+        out_str(&o, ">APZDMS,");
+        out_str(&o, path);
+        out_str(&o, ":!");
+
+        out_chr(&o, table);
+        out_base91(&o, (unsigned int)(380926.0 * (90.0 - pos->lat)));
+        out_base91(&o, (unsigned int)(190463.0 * (180.0 + pos->lon)));
+        out_chr(&o, symbol);
+
+        if (with_speed && (pos->speed > 0)) {
+                cs = (int)rint(log(pos->speed + 1) / log(1.08));
+                if (cs > 90)
+                        cs = 90;
+                out_chr(&o, 33 + (((int)rint(pos->course) % 360) / 4));
+                out_chr(&o, 33 + cs);
+                out_chr(&o, COMP_TYPE_CRS_SPD);
+        } else if (alt_ft >= 1) {
+                cs = (int)rint(log(alt_ft) / log(1.002));
+                if (cs > (91 * 91) - 1)
+                        cs = (91 * 91) - 1;
+                out_chr(&o, 33 + (cs / 91));
+                out_chr(&o, 33 + (cs % 91));
+                out_chr(&o, COMP_TYPE_ALT);
+        } else {
+                /* No cs data */
+                out_str(&o, "  ");
+                out_chr(&o, COMP_TYPE_CRS_SPD);
+        }
+
+        out_str(&o, payload);
+
+        return out_finish(&o, buf);
+}
+
+/* A [beaconing] format name, as FMT_*. Mic-E is only for @moving */
+int parse_format(const char *name, int moving)
+{
+        if (!strcmp(name, "uncompressed"))
+                return FMT_UNCOMPRESSED;
+        else if (!strcmp(name, "compressed"))
+                return FMT_COMPRESSED;
+        else if (!strcmp(name, "mice") && moving)
+                return FMT_MICE;
+
+        printf("WARNING: Unknown beacon format %s\n", name);
+
+        return moving ? FMT_MICE : FMT_UNCOMPRESSED;
+}
@@ -0,0 +1,32 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __BEACON_H
+#define __BEACON_H
+
+#include <time.h>
+
+#include "nmea.h"
+
+#define FMT_UNCOMPRESSED 0
+#define FMT_COMPRESSED   1
+#define FMT_MICE         2
+
+/* All return the packet length, or -1 if @len is too small.
+ * @icon is the two-character table/symbol pair.
+ */
+int mice_encode(char *buf, int len,
+                const char *call, const char *path, const char *icon,
+                struct posit *pos);
+int posit_encode(char *buf, int len,
+                 const char *call, const char *path,
+                 char table, char symbol,
+                 struct posit *pos, const char *payload);
+int compressed_encode(char *buf, int len,
+                      const char *call, const char *path,
+                      char table, char symbol,
+                      struct posit *pos, int with_speed, const char *payload);
+
+int parse_format(const char *name, int moving);
+
+#endif
@@ -0,0 +1,1093 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+/* Hot-path benchmarks. Each group first checks its output against
+ * known-good results, then reports the cost per operation. With -m
+ * the results come out tab-separated (name, ns/op, allocs/op, ops/s)
+ * with everything else commented out, for diffing between changes.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <sys/socket.h>
+
+#include <fap.h>
+
+#include "nmea.h"
+#include "beacon.h"
+#include "ax25.h"
+#include "txq.h"
+#include "fastparse.h"
+#include "classify.h"
+#include "pipeline.h"
+#include "store.h"
+#include "util.h"
+#include "template.h"
+#include "ui.h"
+
+#define CALL "KK7DS-9"
+#define PATH "WIDE1-1,WIDE2-1"
+#define ICON "/>"
+
+#define FT_TO_M(ft) (ft / 3.2808399)
+
+/* Produced by the original asprintf()/pow() encoders in aprs.c */
+struct beacon_golden {
+        double lat, lon, alt, speed, course;
+        const char *mice;
+        const char *posit;
+} beacon_golden[] = {
+        {45.525, -122.9164, 123, 55, 123,
+         "KK7DS-9>T5SQUP,WIDE1-1,WIDE2-1:`2R~qS3>/\"57}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!4531.50N/12254.98W>123/055/A=000403Hello"},
+        {45.525, -122.9164, 0, 0, 0,
+         "KK7DS-9>T5SQUP,WIDE1-1,WIDE2-1:`2R~l \034>/\"3r}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!4531.50N/12254.98W>/A=000000Hello"},
+        {-33.8688, 151.2093, 58, 12.3, 271,
+         "KK7DS-9>S3U2Q2,WIDE1-1,WIDE2-1:`O(Sm6c>/\"4Q}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!3352.13S/15112.56E>271/012/A=000190Hello"},
+        {51.4779, -0.0015, 45, 7.5, 89,
+         "KK7DS-9>U1RXVW,WIDE1-1,WIDE2-1:`vX%lfu>/\"4D}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!5128.67N/00000.09W>089/008/A=000147Hello"},
+        {64.1466, -21.9426, 1200, 33, 359,
+         "KK7DS-9>V4PX7Y,WIDE1-1,WIDE2-1:`1TSoAW>/\"A(}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!6408.80N/02156.56W>359/033/A=003937Hello"},
+        {19.4326, -99.1332, 2240, 99, 180,
+         "KK7DS-9>Q9RU9U,WIDE1-1,WIDE2-1:`\177_\177u{l>/\"LO}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!1925.96N/09907.99W>180/099/A=007349Hello"},
+        {1.3521, 103.8198, 15, 8, 45,
+         "KK7DS-9>P1RQQ2,WIDE1-1,WIDE2-1:`\323M.lpI>/\"4&}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!0121.13N/10349.19E>045/008/A=000049Hello"},
+        {37.7749, -122.4194, -2, 65, 301,
+         "KK7DS-9>S7TVTY,WIDE1-1,WIDE2-1:`25,rU\035>/\"3p}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!3746.49N/12225.16W>301/065/A=-00006Hello"},
+        {40.7128, -74.0060, 10, 19, 12,
+         "KK7DS-9>T0TR7V,WIDE1-1,WIDE2-1:`fX@mz(>/\"4!}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!4042.77N/07400.36W>012/019/A=000032Hello"},
+        {-22.9068, -43.1729, 11, 120, 200,
+         "KK7DS-9>R2U44P,WIDE1-1,WIDE2-1:`G&Ax\"\034>/\"4\"}",
+         "KK7DS-9>APZDMS,WIDE1-1,WIDE2-1:!2254.41S/04310.37W>200/120/A=000036Hello"},
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+/* Everything in the process, libfap and the parser threads included,
+ * allocates through these, so allocs/op is exact
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocs;
+
+void *malloc(size_t size)
+{
+        __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+        __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+        return __libc_realloc(ptr, size);
+}
+
+static int machine;
+static unsigned long start_allocs;
+
+static double now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+/* Marks the start of a timed loop, for report() */
+static double bench_start(void)
+{
+        start_allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+
+        return now_ns();
+}
+
+/* For loops timed in pieces, with setup between that shouldn't count */
+static void report_total(const char *name, int iters,
+                         double total_ns, unsigned long total_allocs)
+{
+        double ns = total_ns / iters;
+        double per = (double)total_allocs / iters;
+
+        if (machine)
+                printf("%s\t%.1f\t%.2f\t%.0f\n", name, ns, per, 1e9 / ns);
+        else
+                printf("%-24s %10.1f ns/op %6.2f allocs/op %12.0f ops/s\n",
+                       name, ns, per, 1e9 / ns);
+}
+
+static void report(const char *name, int iters, double start)
+{
+        report_total(name, iters, now_ns() - start,
+                     __atomic_load_n(&allocs, __ATOMIC_RELAXED) -
+                     start_allocs);
+}
+
+/* Anything that isn't a result */
+static void note(const char *fmt, ...)
+{
+        va_list ap;
+
+        if (machine)
+                printf("# ");
+
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+}
+
+static void golden_posit(struct beacon_golden *g, struct posit *pos)
+{
+        memset(pos, 0, sizeof(*pos));
+        pos->lat = g->lat;
+        pos->lon = g->lon;
+        pos->alt = g->alt;
+        pos->speed = g->speed;
+        pos->course = g->course;
+}
+
+int check_beacons(void)
+{
+        char buf[256];
+        struct posit pos;
+        int fail = 0;
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(beacon_golden); i++) {
+                struct beacon_golden *g = &beacon_golden[i];
+
+                golden_posit(g, &pos);
+
+                mice_encode(buf, sizeof(buf), CALL, PATH, ICON, &pos);
+                if (strcmp(buf, g->mice)) {
+                        printf("FAIL mice[%i]: %s\n", i, buf);
+                        fail++;
+                }
+
+                posit_encode(buf, sizeof(buf), CALL, PATH, ICON[0], ICON[1],
+                             &pos, "Hello");
+                if (strcmp(buf, g->posit)) {
+                        printf("FAIL posit[%i]: %s\n", i, buf);
+                        fail++;
+                }
+        }
+
+        /* Examples from the APRS 1.01 spec, chapter 9 */
+        memset(&pos, 0, sizeof(pos));
+        pos.lat = 49.5;
+        pos.lon = -72.75;
+        pos.course = 88;
+        pos.speed = 36.2;
+        pos.alt = FT_TO_M(10004);
+
+        compressed_encode(buf, sizeof(buf), CALL, PATH, ICON[0], ICON[1],
+                          &pos, 1, "");
+        if (strcmp(buf, CALL ">APZDMS," PATH ":!/5L!!<*e7>7PC")) {
+                printf("FAIL compressed crs/spd: %s\n", buf);
+                fail++;
+        }
+
+        compressed_encode(buf, sizeof(buf), CALL, PATH, ICON[0], ICON[1],
+                          &pos, 0, "");
+        if (strcmp(buf, CALL ">APZDMS," PATH ":!/5L!!<*e7>S]S")) {
+                printf("FAIL compressed alt: %s\n", buf);
+                fail++;
+        }
+
+        /* Must refuse, not overrun, a short buffer */
+        if (mice_encode(buf, 16, CALL, PATH, ICON, &pos) != -1) {
+                printf("FAIL mice: short buffer accepted\n");
+                fail++;
+        }
+
+        return fail;
+}
+
+void bench_beacons(int iters)
+{
+        char buf[256];
+        struct posit pos;
+        double start;
+        int i;
+
+        golden_posit(&beacon_golden[0], &pos);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++)
+                mice_encode(buf, sizeof(buf), CALL, PATH, ICON, &pos);
+        report("mice_encode", iters, start);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++)
+                posit_encode(buf, sizeof(buf), CALL, PATH, ICON[0], ICON[1],
+                             &pos, "Hello");
+        report("posit_encode", iters, start);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++)
+                compressed_encode(buf, sizeof(buf), CALL, PATH,
+                                  ICON[0], ICON[1], &pos, 1, "Hello");
+        report("compressed_encode", iters, start);
+}
+
+#define GGA "$GPGGA,123519.50,4531.500,N,12254.984,W,1,08,0.9,123.4,M,46.9,M,,*7B"
+#define RMC "$GPRMC,123519.50,A,4531.500,N,12254.984,W,055.0,123.0,181026,003.1,W*5D"
+
+int check_nmea(void)
+{
+        char buf[128];
+        struct posit pos;
+        int fail = 0;
+
+        memset(&pos, 0, sizeof(pos));
+
+        strcpy(buf, GGA);
+        if (!valid_checksum(buf) || !parse_gga(&pos, buf) ||
+            (fabs(pos.lat - 45.525) > 1e-6) ||
+            (fabs(pos.lon + 122.9164) > 1e-6) ||
+            (pos.qual != 1) || (pos.sats != 8) || (pos.alt != 123.4) ||
+            (pos.tstamp != 123519) || (pos.tnsec != 500000000)) {
+                printf("FAIL gga: %f,%f q%i s%i %f\n",
+                       pos.lat, pos.lon, pos.qual, pos.sats, pos.alt);
+                fail++;
+        }
+
+        strcpy(buf, RMC);
+        if (!valid_checksum(buf) || !parse_rmc(&pos, buf) ||
+            (pos.speed != 55) || (pos.course != 123) ||
+            (pos.dstamp != 181026)) {
+                printf("FAIL rmc: %f %f %i\n",
+                       pos.speed, pos.course, pos.dstamp);
+                fail++;
+        }
+
+        strcpy(buf, GGA);
+        buf[10] = '9';
+        if (valid_checksum(buf)) {
+                printf("FAIL checksum: accepted a corrupt sentence\n");
+                fail++;
+        }
+
+        return fail;
+}
+
+/* The parsers write into the sentence, so the copy is part of it */
+void bench_nmea(int iters)
+{
+        char buf[128];
+        struct posit pos;
+        double start;
+        int i;
+
+        strcpy(buf, GGA);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++)
+                valid_checksum(buf);
+        report("valid_checksum", iters, start);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                strcpy(buf, GGA);
+                parse_gga(&pos, buf);
+        }
+        report("parse_gga", iters, start);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                strcpy(buf, RMC);
+                parse_rmc(&pos, buf);
+        }
+        report("parse_rmc", iters, start);
+}
+
+/* One display update each way over a local socket */
+void bench_ui(int iters)
+{
+        struct ui_msg *msg;
+        double start;
+        int fds[2];
+        int i;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+                return;
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                ui_send(fds[0], "AI_COMMENT", "Software v0.1.1234 up 12:34");
+                if (ui_get_msg(fds[1], &msg) <= 0)
+                        break;
+                free(msg);
+        }
+        report("ui_send+ui_get_msg", iters, start);
+
+        close(fds[0]);
+        close(fds[1]);
+}
+
+static int fap_kiss(const char *packet, uint8_t *kiss, unsigned int *len)
+{
+        return fap_tnc2_to_kiss(packet, strlen(packet), 0, (char *)kiss, len);
+}
+
+int check_kiss(void)
+{
+        uint8_t native[1024], ref[1024];
+        unsigned int ref_len;
+        int len;
+        int fail = 0;
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(beacon_golden); i++) {
+                const char *packets[] = {
+                        beacon_golden[i].mice, beacon_golden[i].posit
+                };
+                int j;
+
+                for (j = 0; j < 2; j++) {
+                        ref_len = sizeof(ref);
+                        if (!fap_kiss(packets[j], ref, &ref_len)) {
+                                printf("FAIL libfap kiss[%i/%i]\n", i, j);
+                                fail++;
+                                continue;
+                        }
+
+                        len = kiss_encode_tnc2(native, sizeof(native),
+                                               packets[j]);
+
+                        /* We always set the AX.25 v2 command bit on the
+                         * destination; don't fail on libfap's choice
+                         */
+                        if (len > 8)
+                                native[8] = (native[8] & 0x7F) |
+                                        (ref[8] & 0x80);
+                        if ((len != ref_len) || memcmp(native, ref, len)) {
+                                printf("FAIL kiss[%i/%i]: %i vs %u bytes\n",
+                                       i, j, len, ref_len);
+                                fail++;
+                        }
+                }
+        }
+
+        return fail;
+}
+
+/* Frames run together with a shared FEND, plus line noise up front,
+ * must come back out of the byte-at-a-time receiver unchanged
+ */
+int check_deframe(void)
+{
+        static uint8_t stream[16384];
+        uint8_t kiss[1024];
+        struct kiss_rx rx;
+        int offsets[ARRAY_SIZE(beacon_golden) + 1];
+        int pos = 0;
+        int fail = 0;
+        int got = 0;
+        int len;
+        int i;
+
+        memset(&rx, 0, sizeof(rx));
+        memcpy(stream, "\x01noise", 6);
+        pos = 6;
+
+        for (i = 0; i < ARRAY_SIZE(beacon_golden); i++) {
+                len = kiss_encode_tnc2(kiss, sizeof(kiss),
+                                       beacon_golden[i].posit);
+                /* Drop the trailing FEND; the next frame's opens it */
+                offsets[i] = pos;
+                memcpy(stream + pos, kiss, len - 1);
+                pos += len - 1;
+        }
+        offsets[i] = pos;
+        stream[pos++] = KISS_FEND;
+
+        for (i = 0; i < pos; i++) {
+                len = kiss_rx_byte(&rx, stream[i]);
+                if (!len)
+                        continue;
+                if ((got >= ARRAY_SIZE(beacon_golden)) ||
+                    (len != offsets[got + 1] - offsets[got] + 1) ||
+                    memcmp(rx.buf, stream + offsets[got], len - 1)) {
+                        printf("FAIL deframe[%i]: %i bytes\n", got, len);
+                        fail++;
+                }
+                got++;
+        }
+
+        if (got != ARRAY_SIZE(beacon_golden)) {
+                printf("FAIL deframe: %i frames\n", got);
+                fail++;
+        }
+
+        return fail;
+}
+
+/* Encode and hand to the fd, as send_kiss_beacon() did before and does
+ * now; "latency" is from having the TNC2 text to the write completing
+ */
+void bench_kiss(int iters)
+{
+        static struct txbuf txbuf;
+        const char *packet = beacon_golden[0].posit;
+        uint8_t buf[1024];
+        unsigned int len;
+        uint8_t *ptr;
+        double start, t0, worst_fap = 0, worst_native = 0;
+        int space;
+        int fd;
+        int i;
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                len = sizeof(buf);
+                fap_kiss(packet, buf, &len);
+        }
+        report("fap_tnc2_to_kiss", iters, start);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++)
+                kiss_encode_tnc2(buf, sizeof(buf), packet);
+        report("kiss_encode_tnc2", iters, start);
+
+        fd = open("/dev/null", O_WRONLY | O_NONBLOCK);
+        if (fd < 0)
+                return;
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                t0 = now_ns();
+                len = sizeof(buf);
+                fap_kiss(packet, buf, &len);
+                if (write(fd, buf, len) != len)
+                        break;
+                if (now_ns() - t0 > worst_fap)
+                        worst_fap = now_ns() - t0;
+        }
+        report("fap+write", iters, start);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                t0 = now_ns();
+                ptr = txbuf_reserve(&txbuf, &space);
+                txbuf_commit(&txbuf,
+                             kiss_encode_tnc2(ptr, space, packet));
+                txbuf_drain(&txbuf, fd);
+                if (now_ns() - t0 > worst_native)
+                        worst_native = now_ns() - t0;
+        }
+        report("native+txbuf", iters, start);
+
+        note("%-24s %10.1f ns fap, %.1f ns native\n", "worst case",
+             worst_fap, worst_native);
+
+        close(fd);
+}
+
+#define CORPUS_MAX 1024
+
+static char *corpus[CORPUS_MAX];
+static int corpus_len;
+
+static int load_corpus(const char *path)
+{
+        char line[512];
+        FILE *fp;
+
+        fp = fopen(path, "r");
+        if (!fp)
+                return -1;
+
+        while (fgets(line, sizeof(line), fp) && (corpus_len < CORPUS_MAX)) {
+                line[strcspn(line, "\r\n")] = 0;
+                if (!line[0] || (line[0] == '#'))
+                        continue;
+                corpus[corpus_len++] = strdup(line);
+        }
+
+        fclose(fp);
+
+        return corpus_len;
+}
+
+static int str_differ(const char *a, const char *b)
+{
+        if (!a || !b)
+                return a != b;
+        return strcmp(a, b);
+}
+
+#define PTR_DIFFER(a, b, tol) \
+        ((!(a) != !(b)) || ((a) && (fabs(*(a) - *(b)) > (tol))))
+
+/* The fields we actually use from a parsed packet. libfap rounds some
+ * unit conversions differently, hence the tolerances.
+ */
+static const char *fap_differ(fap_packet_t *a, fap_packet_t *b)
+{
+        int i;
+
+        if (PTR_DIFFER(a->type, b->type, 0))
+                return "type";
+        if (PTR_DIFFER(a->format, b->format, 0))
+                return "format";
+        if (str_differ(a->src_callsign, b->src_callsign))
+                return "src";
+        if (str_differ(a->dst_callsign, b->dst_callsign))
+                return "dst";
+        if (a->path_len != b->path_len)
+                return "path_len";
+        for (i = 0; i < a->path_len; i++)
+                if (str_differ(a->path[i], b->path[i]))
+                        return "path";
+        if (PTR_DIFFER(a->latitude, b->latitude, 1e-4))
+                return "latitude";
+        if (PTR_DIFFER(a->longitude, b->longitude, 1e-4))
+                return "longitude";
+        if (PTR_DIFFER(a->altitude, b->altitude, 0.05))
+                return "altitude";
+        if (PTR_DIFFER(a->course, b->course, 0))
+                return "course";
+        if (PTR_DIFFER(a->speed, b->speed, 0.05))
+                return "speed";
+        if ((a->symbol_table != b->symbol_table) ||
+            (a->symbol_code != b->symbol_code))
+                return "symbol";
+        if (PTR_DIFFER(a->messaging, b->messaging, 0))
+                return "messaging";
+        if (str_differ(a->messagebits, b->messagebits))
+                return "messagebits";
+        if ((a->comment_len != b->comment_len) ||
+            (a->comment && memcmp(a->comment, b->comment, a->comment_len)))
+                return "comment";
+        if ((a->status_len != b->status_len) ||
+            (a->status && memcmp(a->status, b->status, a->status_len)))
+                return "status";
+        if (!a->wx_report != !b->wx_report)
+                return "wx_report";
+        if (a->wx_report) {
+                fap_wx_report_t *x = a->wx_report, *y = b->wx_report;
+
+                if (PTR_DIFFER(x->wind_dir, y->wind_dir, 0) ||
+                    PTR_DIFFER(x->wind_speed, y->wind_speed, 0.05) ||
+                    PTR_DIFFER(x->wind_gust, y->wind_gust, 0.05) ||
+                    PTR_DIFFER(x->temp, y->temp, 0.05) ||
+                    PTR_DIFFER(x->rain_1h, y->rain_1h, 0.05) ||
+                    PTR_DIFFER(x->rain_24h, y->rain_24h, 0.05) ||
+                    PTR_DIFFER(x->rain_midnight, y->rain_midnight, 0.05) ||
+                    PTR_DIFFER(x->humidity, y->humidity, 0) ||
+                    PTR_DIFFER(x->pressure, y->pressure, 0.05))
+                        return "wx";
+        }
+
+        return NULL;
+}
+
+struct escape_golden {
+        const char *in;
+        int size;
+        const char *out;
+} escape_golden[] = {
+        {"plain", 64, "plain"},
+        {"<b>Tom & Jerry</b>", 64, "&lt;b&gt;Tom &amp; Jerry&lt;/b&gt;"},
+        {"line\r\nbreak\ttab\x7f", 64, "line  break tab "},
+        {"ab&cd", 6, "ab"},          /* Don't split the entity */
+        {"ab&cd", 9, "ab&amp;c"},
+};
+
+int check_escape(void)
+{
+        char buf[64];
+        int fail = 0;
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(escape_golden); i++) {
+                struct escape_golden *g = &escape_golden[i];
+
+                escape_markup(buf, g->size, g->in, strlen(g->in));
+                if (strcmp(buf, g->out)) {
+                        printf("FAIL escape[%i]: %s\n", i, buf);
+                        fail++;
+                }
+        }
+
+        return fail;
+}
+
+void bench_escape(int iters)
+{
+        const char *text = "Using a home-built tracker <http://danplanet.com> "
+                "& the TEMP1-1,WIDE2-1 path to digi, see you on 146.52";
+        int len = strlen(text);
+        char buf[1024];
+        double start;
+        int i;
+
+        start = bench_start();
+        for (i = 0; i < iters; i++)
+                escape_markup(buf, sizeof(buf), text, len);
+        report("escape_markup", iters, start);
+}
+
+static int bench_var(void *ctx, enum tmpl_var var, char *buf, int size)
+{
+        return snprintf(buf, size, "<%i>", var);
+}
+
+struct tmpl_golden {
+        const char *src;
+        int size;
+        const char *out;       /* NULL if it must not compile */
+} tmpl_golden[] = {
+        {"Using a home-built tracker", 64, "Using a home-built tracker"},
+        {"Software $ver$", 64, "Software <5>"},
+        {"$mycall$ $sats$ sats$digiq$", 64, "<1> <4> sats<8>"},
+        {"Software $ver$", 12, "Software <5"},
+        {"Software $vers$", 64, NULL},
+        {"Costs $5", 64, NULL},
+};
+
+int check_template(void)
+{
+        struct tmpl t;
+        char buf[64];
+        int fail = 0;
+        int ret;
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(tmpl_golden); i++) {
+                struct tmpl_golden *g = &tmpl_golden[i];
+
+                ret = tmpl_compile(&t, g->src);
+                if (!g->out) {
+                        if (!ret) {
+                                printf("FAIL template[%i]: accepted\n", i);
+                                fail++;
+                        }
+                        continue;
+                }
+
+                tmpl_render(&t, buf, g->size, bench_var, NULL);
+                if (ret || strcmp(buf, g->out)) {
+                        printf("FAIL template[%i]: %s\n", i, buf);
+                        fail++;
+                }
+        }
+
+        return fail;
+}
+
+void bench_template(int iters)
+{
+        struct tmpl t;
+        char buf[256];
+        double start;
+        int i;
+
+        tmpl_compile(&t, "Software $ver$ up at $time$, $sats$ sats");
+
+        start = bench_start();
+        for (i = 0; i < iters; i++)
+                tmpl_render(&t, buf, sizeof(buf), bench_var, NULL);
+        report("tmpl_render", iters, start);
+}
+
+/* Everything the fast path accepts must come out as libfap would
+ * have parsed it; everything else must be left to libfap.
+ */
+int check_parse(void)
+{
+        struct fast_packet fp;
+        fap_packet_t *fast, *ref;
+        const char *field;
+        int fail = 0;
+        int hits = 0;
+        int i;
+
+        for (i = 0; i < corpus_len; i++) {
+                int len = strlen(corpus[i]);
+
+                if (fast_parse(&fp, corpus[i], len))
+                        continue;
+                hits++;
+
+                ref = fap_parseaprs(corpus[i], len, 0);
+                if (ref->error_code) {
+                        printf("FAIL parse: libfap rejects %s\n", corpus[i]);
+                        fail++;
+                        fap_free(ref);
+                        continue;
+                }
+
+                fast = fast_to_fap(&fp);
+                field = fap_differ(fast, ref);
+                if (field) {
+                        printf("FAIL parse %s: %s\n", field, corpus[i]);
+                        fail++;
+                }
+
+                fap_free(fast);
+                fap_free(ref);
+        }
+
+        note("fast_parse handles %i of %i corpus packets\n",
+             hits, corpus_len);
+
+        return fail;
+}
+
+/* Whatever the classifier lets us skip by default must carry nothing
+ * the display would have used. Third-party packets are the exception:
+ * libfap decodes the inner packet, and we choose not to show those.
+ */
+int check_classify(void)
+{
+        struct classifier cls;
+        struct cls_header hdr;
+        fap_packet_t *fap;
+        int fail = 0;
+        int i;
+
+        memset(&cls, 0, sizeof(cls));
+        cls_load_config(NULL, &cls);
+
+        for (i = 0; i < corpus_len; i++) {
+                int len = strlen(corpus[i]);
+
+                if (classify_packet(&cls, corpus[i], len, &hdr) == CLS_PARSE)
+                        continue;
+                if (hdr.class == CLS_THIRDPARTY)
+                        continue;
+
+                fap = fap_parseaprs(corpus[i], len, 0);
+                if (!fap->error_code &&
+                    (fap->latitude || fap->wx_report || fap->telemetry ||
+                     fap->phg || fap->status)) {
+                        printf("FAIL classify %s: %s\n",
+                               cls_name(hdr.class), corpus[i]);
+                        fail++;
+                }
+                fap_free(fap);
+        }
+
+        note("classifier skips %lu of %i corpus packets\n",
+             cls.skipped, corpus_len);
+
+        return fail;
+}
+
+void bench_parse(int iters)
+{
+        struct fast_packet fp;
+        struct classifier cls;
+        struct cls_header hdr;
+        double start;
+        int lens[CORPUS_MAX];
+        int i;
+
+        if (!corpus_len)
+                return;
+
+        for (i = 0; i < corpus_len; i++)
+                lens[i] = strlen(corpus[i]);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                int j = i % corpus_len;
+
+                fap_free(fap_parseaprs(corpus[j], lens[j], 0));
+        }
+        report("fap_parseaprs", iters, start);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                int j = i % corpus_len;
+
+                fast_parse(&fp, corpus[j], lens[j]);
+        }
+        report("fast_parse", iters, start);
+
+        /* What dan_parseaprs() now does per packet */
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                int j = i % corpus_len;
+
+                if (fast_parse(&fp, corpus[j], lens[j]) == 0)
+                        fap_free(fast_to_fap(&fp));
+                else
+                        fap_free(fap_parseaprs(corpus[j], lens[j], 0));
+        }
+        report("fast+fallback", iters, start);
+
+        memset(&cls, 0, sizeof(cls));
+        cls_load_config(NULL, &cls);
+
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                int j = i % corpus_len;
+
+                classify_packet(&cls, corpus[j], lens[j], &hdr);
+        }
+        report("classify_packet", iters, start);
+}
+
+static fap_packet_t *bench_fap(const char *packet)
+{
+        return fap_parseaprs(packet, strlen(packet), 0);
+}
+
+/* A station heard again comes off the list with its position carried
+ * over; our own packets never go on it
+ */
+int check_store(void)
+{
+        struct store store;
+        fap_packet_t *last;
+        int fail = 0;
+        int count = 0;
+        int i;
+
+        memset(&store, 0, sizeof(store));
+
+        store_packet(&store, bench_fap("N0AAA>APRS:!4531.50N/12254.98W>"), CALL);
+        store_packet(&store, bench_fap("N0BBB>APRS:!4532.50N/12253.98W>"), CALL);
+        store_packet(&store, bench_fap(CALL ">APRS:!4533.50N/12252.98W>"), CALL);
+        store_packet(&store, bench_fap("N0CCC>APRS:!4534.50N/12251.98W>"), CALL);
+        store_packet(&store, bench_fap("N0AAA>APRS:>Status only"), CALL);
+
+        last = store.last_packet;
+        if (!STREQ(OBJNAME(last), "N0AAA") || !last->latitude ||
+            !last->status_len) {
+                printf("FAIL store: N0AAA not merged\n");
+                fail++;
+        }
+
+        if (find_packet(&store, last) != -1) {
+                printf("FAIL store: N0AAA still on the list\n");
+                fail++;
+        }
+
+        for (i = 0; i < KEEP_PACKETS; i++)
+                if (store.recent[i])
+                        count++;
+        if ((count != 2) ||
+            !STREQ(OBJNAME(store.recent[store.recent_idx]), "N0CCC")) {
+                printf("FAIL store: %i on the list, newest %s\n", count,
+                       store.recent[store.recent_idx] ?
+                       OBJNAME(store.recent[store.recent_idx]) : "none");
+                fail++;
+        }
+
+        store_clear(&store);
+
+        return fail;
+}
+
+/* Parsing isn't part of it, so each corpus-sized batch is parsed
+ * first and only the stores are timed
+ */
+void bench_store(int iters)
+{
+        fap_packet_t *faps[CORPUS_MAX];
+        struct store store;
+        unsigned long total_allocs = 0;
+        double total_ns = 0;
+        double start;
+        char buf[64];
+        int done, n;
+        int i;
+
+        if (!corpus_len)
+                return;
+
+        memset(&store, 0, sizeof(store));
+
+        for (done = 0; done < iters; done += n) {
+                n = iters - done;
+                if (n > corpus_len)
+                        n = corpus_len;
+
+                for (i = 0; i < n; i++)
+                        faps[i] = bench_fap(corpus[i]);
+
+                start = bench_start();
+                for (i = 0; i < n; i++)
+                        store_packet(&store, faps[i], CALL);
+                total_ns += now_ns() - start;
+                total_allocs += __atomic_load_n(&allocs, __ATOMIC_RELAXED) -
+                        start_allocs;
+        }
+        report_total("store_packet", iters, total_ns, total_allocs);
+
+        /* What update_packets_ui() does per list entry */
+        start = bench_start();
+        for (i = 0; i < iters; i++) {
+                fap_packet_t *p = store.recent[i % KEEP_PACKETS];
+
+                if (p)
+                        stored_packet_desc(p, i % KEEP_PACKETS, 0,
+                                           45.525, -122.916,
+                                           buf, sizeof(buf));
+        }
+        report("stored_packet_desc", iters, start);
+
+        store_clear(&store);
+}
+
+static void bench_parse_item(void *ctx, struct pipe_item *item)
+{
+        struct fast_packet fp;
+
+        if (fast_parse(&fp, item->packet, item->len) == 0)
+                item->fap = fast_to_fap(&fp);
+        else
+                item->fap = fap_parseaprs(item->packet, item->len, 0);
+}
+
+/* Push the corpus file through the threaded parser from a file,
+ * the way the APRS-IS feed would arrive on a socket
+ */
+static void bench_pipeline_workers(const char *path, int workers)
+{
+        struct pipeline *p;
+        struct pipe_item *item;
+        struct pollfd pfd;
+        char name[32];
+        double start;
+        int count = 0;
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return;
+
+        start = bench_start();
+        p = pipeline_start(fd, workers, bench_parse_item, NULL);
+        if (!p) {
+                close(fd);
+                return;
+        }
+
+        pfd.fd = pipeline_fd(p);
+        pfd.events = POLLIN;
+
+        while (!pipeline_eof(p)) {
+                while ((item = pipeline_next(p))) {
+                        fap_free(item->fap);
+                        pipeline_pop(p);
+                        count++;
+                }
+                if (!pipeline_eof(p))
+                        poll(&pfd, 1, 100);
+        }
+
+        snprintf(name, sizeof(name), "pipeline x%i", workers);
+        report(name, count, start);
+
+        pipeline_stop(p);
+        close(fd);
+}
+
+void bench_pipeline(int iters)
+{
+        char path[] = "/tmp/aprsbench.XXXXXX";
+        FILE *fp;
+        int fd;
+        int i;
+
+        if (!corpus_len)
+                return;
+
+        fd = mkstemp(path);
+        if (fd < 0)
+                return;
+
+        fp = fdopen(fd, "w");
+        for (i = 0; i < iters; i++)
+                fprintf(fp, "%s\r\n", corpus[i % corpus_len]);
+        fclose(fp);
+
+        bench_pipeline_workers(path, 1);
+        bench_pipeline_workers(path, 2);
+        bench_pipeline_workers(path, 4);
+
+        unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+        const char *path = "examples/packets.txt";
+        int iters = 200000;
+        int fail;
+        int c;
+
+        while ((c = getopt(argc, argv, "m")) != -1) {
+                if (c != 'm') {
+                        printf("Usage: %s [-m] [ITERS [CORPUS]]\n", argv[0]);
+                        return 1;
+                }
+                machine = 1;
+        }
+
+        if (optind < argc)
+                iters = atoi(argv[optind++]);
+        if (optind < argc)
+                path = argv[optind++];
+
+        if (load_corpus(path) < 0)
+                note("No packet corpus at %s, skipping parser\n", path);
+
+        fail = check_beacons();
+        fail += check_nmea();
+        fail += check_kiss();
+        fail += check_deframe();
+        fail += check_escape();
+        fail += check_template();
+        fail += check_parse();
+        fail += check_classify();
+        fail += check_store();
+        if (fail) {
+                printf("%i golden check(s) failed\n", fail);
+                return 1;
+        }
+
+        if (machine)
+                printf("#name\tns/op\tallocs/op\tops/s\n");
+
+        bench_beacons(iters);
+        bench_nmea(iters);
+        bench_ui(iters);
+        bench_kiss(iters);
+        bench_parse(iters);
+        bench_store(iters);
+        bench_escape(iters);
+        bench_template(iters);
+        bench_pipeline(iters);
+
+        return 0;
+}
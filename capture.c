@@ -0,0 +1,155 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "capture.h"
+
+/* Open @path for appending, starting it with the magic if it's new.
+ * The first record written is flagged as the start of a session.
+ * Returns NULL on failure.
+ */
+struct capture *capture_open(const char *path)
+{
+        struct capture *c;
+        struct stat st;
+
+        c = calloc(1, sizeof(*c));
+        if (!c)
+                return NULL;
+
+        c->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (c->fd < 0)
+                goto err;
+
+        if (fstat(c->fd, &st) == 0 && st.st_size == 0 &&
+            write(c->fd, CAP_MAGIC, 8) != 8) {
+                close(c->fd);
+                goto err;
+        }
+        c->new_session = 1;
+
+        return c;
+ err:
+        free(c);
+        return NULL;
+}
+
+/* One writev() per record, so records from different threads don't
+ * interleave in the file
+ */
+void capture_write(struct capture *c, enum cap_source source,
+                   const void *data, int len)
+{
+        struct cap_record rec;
+        struct timespec ts;
+        struct iovec iov[2];
+
+        if (!c)
+                return;
+
+        if (len > CAP_MAX_LEN)
+                len = CAP_MAX_LEN;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        rec.ts = (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+        rec.len = len;
+        rec.source = source;
+        rec.flags = 0;
+        if (__atomic_exchange_n(&c->new_session, 0, __ATOMIC_RELAXED))
+                rec.flags |= CAP_SESSION;
+
+        iov[0].iov_base = &rec;
+        iov[0].iov_len = sizeof(rec);
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = len;
+
+        if (writev(c->fd, iov, 2) == sizeof(rec) + len)
+                __atomic_add_fetch(&c->records, 1, __ATOMIC_RELAXED);
+        else
+                __atomic_add_fetch(&c->failed, 1, __ATOMIC_RELAXED);
+}
+
+/* Returns NULL if @path can't be read or isn't a capture */
+struct replay *replay_open(const char *path)
+{
+        struct replay *r;
+        char magic[8];
+
+        r = calloc(1, sizeof(*r));
+        if (!r)
+                return NULL;
+
+        r->fp = fopen(path, "r");
+        if (!r->fp)
+                goto err;
+
+        if ((fread(magic, 1, 8, r->fp) != 8) ||
+            memcmp(magic, CAP_MAGIC, 8)) {
+                fclose(r->fp);
+                goto err;
+        }
+
+        return r;
+ err:
+        free(r);
+        return NULL;
+}
+
+/* Read the next record into r->rec and r->data. Returns 1, or 0 at
+ * the end (or a truncated last record).
+ *
+ * A capture appended to over several runs has the downtime between
+ * them, and CLOCK_MONOTONIC starts again after a reboot. So r->at
+ * follows the recorded gaps, except that a new session or a
+ * timestamp going backwards plays straight on, and no gap is played
+ * for longer than CAP_MAX_GAP.
+ */
+int replay_next(struct replay *r)
+{
+        if (fread(&r->rec, sizeof(r->rec), 1, r->fp) != 1)
+                return 0;
+
+        if ((r->rec.len > CAP_MAX_LEN) ||
+            (fread(r->data, 1, r->rec.len, r->fp) != r->rec.len))
+                return 0;
+        r->data[r->rec.len] = 0;
+
+        if (!r->records++) {
+                r->at = 0;
+        } else if ((r->rec.flags & CAP_SESSION) || (r->rec.ts < r->last)) {
+                r->rebased++;
+        } else if (r->rec.ts - r->last > CAP_MAX_GAP) {
+                r->at += CAP_MAX_GAP;
+                r->rebased++;
+        } else {
+                r->at += r->rec.ts - r->last;
+        }
+        r->last = r->rec.ts;
+
+        return 1;
+}
+
+/* Back to the first record, for another pass. Returns as replay_next() */
+int replay_rewind(struct replay *r)
+{
+        if (fseek(r->fp, strlen(CAP_MAGIC), SEEK_SET))
+                return 0;
+        r->records = 0;
+        r->rebased = 0;
+
+        return replay_next(r);
+}
+
+void replay_close(struct replay *r)
+{
+        fclose(r->fp);
+        free(r);
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CAP_MAGIC   "APRSCAP1"
+#define CAP_MAX_LEN 2048
+
+/* Longest quiet spell a replay sits through, in ns */
+#define CAP_MAX_GAP (60 * 1000000000ULL)
+
+enum cap_source {
+        CAP_TNC = 1,           /* Raw KISS frame, FEND to FEND */
+        CAP_APRSIS,            /* One APRS-IS line, CR/LF stripped */
+        CAP_GPS,               /* Whatever one read() of the GPS got */
+        CAP_TEL,               /* One telemetry line */
+};
+
+/* On disk, in host byte order, after the 8-byte magic */
+struct cap_record {
+        uint64_t ts;           /* CLOCK_MONOTONIC, ns */
+        uint16_t len;
+        uint8_t source;
+        uint8_t flags;         /* CAP_SESSION, or zero */
+} __attribute__ ((packed));
+
+#define CAP_SESSION 0x01       /* First record since capture_open() */
+
+struct capture {
+        int fd;
+        unsigned long records;
+        unsigned long failed;
+        int new_session;       /* Next record gets CAP_SESSION */
+};
+
+struct replay {
+        FILE *fp;
+        struct cap_record rec;
+        uint8_t data[CAP_MAX_LEN + 1]; /* NUL-terminated for text */
+        uint64_t last;         /* ts of the record before */
+        uint64_t at;           /* ns into the replay this one plays at */
+        unsigned long records;
+        unsigned long rebased; /* Gaps cut short, new sessions included */
+};
+
+struct capture *capture_open(const char *path);
+void capture_write(struct capture *c, enum cap_source source,
+                   const void *data, int len);
+
+struct replay *replay_open(const char *path);
+int replay_next(struct replay *r);
+int replay_rewind(struct replay *r);
+void replay_close(struct replay *r);
+
+#endif
@@ -0,0 +1,182 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "classify.h"
+
+static const char *cls_names[CLS_MAX] = {
+        [CLS_POSIT] = "posit",
+        [CLS_WX] = "weather",
+        [CLS_STATUS] = "status",
+        [CLS_TELEMETRY] = "telemetry",
+        [CLS_OBJECT] = "object",
+        [CLS_MESSAGE] = "message",
+        [CLS_BULLETIN] = "bulletin",
+        [CLS_QUERY] = "query",
+        [CLS_THIRDPARTY] = "thirdparty",
+        [CLS_OTHER] = "other",
+};
+
+static const char *action_names[] = {
+        [CLS_PARSE] = "parse",
+        [CLS_HEARD] = "heard",
+        [CLS_DROP] = "drop",
+};
+
+/* The display only uses positions, weather, PHG, status and telemetry,
+ * so by default the rest just keeps its sender's last-heard time fresh
+ */
+static const enum cls_action default_action[CLS_MAX] = {
+        [CLS_POSIT] = CLS_PARSE,
+        [CLS_WX] = CLS_PARSE,
+        [CLS_STATUS] = CLS_PARSE,
+        [CLS_TELEMETRY] = CLS_PARSE,
+        [CLS_OBJECT] = CLS_PARSE,
+        [CLS_MESSAGE] = CLS_HEARD,
+        [CLS_BULLETIN] = CLS_HEARD,
+        [CLS_QUERY] = CLS_HEARD,
+        [CLS_THIRDPARTY] = CLS_HEARD,
+        [CLS_OTHER] = CLS_PARSE,
+};
+
+const char *cls_name(enum cls_class class)
+{
+        return class < CLS_MAX ? cls_names[class] : "?";
+}
+
+const char *cls_action_name(enum cls_action action)
+{
+        return action <= CLS_DROP ? action_names[action] : "?";
+}
+
+/* Rules are filter:<class> = parse|heard|drop */
+void cls_load_config(dictionary *ini, struct classifier *c)
+{
+        char key[32];
+        char *val;
+        int i, j;
+
+        for (i = 0; i < CLS_MAX; i++) {
+                c->action[i] = default_action[i];
+
+                snprintf(key, sizeof(key), "filter:%s", cls_names[i]);
+                val = iniparser_getstring(ini, key, NULL);
+                if (!val)
+                        continue;
+
+                for (j = CLS_PARSE; j <= CLS_DROP; j++)
+                        if (strcmp(val, action_names[j]) == 0)
+                                break;
+                if (j > CLS_DROP)
+                        printf("WARNING: Unknown filter action %s=%s\n",
+                               key, val);
+                else
+                        c->action[i] = j;
+        }
+}
+
+static enum cls_class class_of(const char *body, int len)
+{
+        if (len < 1)
+                return CLS_OTHER;
+
+        switch (body[0]) {
+        case '!':
+        case '=':
+        case '/':
+        case '@':
+        case '`':
+        case '\'':
+        case '$':
+                return CLS_POSIT;
+        case '_':
+        case '#':
+        case '*':
+                return CLS_WX;
+        case '>':
+                return CLS_STATUS;
+        case 'T':
+                return CLS_TELEMETRY;
+        case ';':
+        case ')':
+                return CLS_OBJECT;
+        case ':':
+                /* :BLNn     :text, including announcements */
+                if ((len > 4) && (strncmp(body + 1, "BLN", 3) == 0))
+                        return CLS_BULLETIN;
+                return CLS_MESSAGE;
+        case '?':
+                return CLS_QUERY;
+        case '}':
+                return CLS_THIRDPARTY;
+        default:
+                return CLS_OTHER;
+        }
+}
+
+static int copy_call(char *dst, const char *src, int len)
+{
+        if ((len < 1) || (len >= CLS_CALL_LEN))
+                return -1;
+
+        memcpy(dst, src, len);
+        dst[len] = 0;
+
+        return 0;
+}
+
+/* Look only at SRC>DST,PATH: and the data type identifier. Anything
+ * we can't make sense of goes to the full parser, which will produce
+ * a proper error for it. This doesn't touch @c, so parser threads
+ * can share one classifier.
+ */
+enum cls_action cls_lookup(const struct classifier *c,
+                           const char *packet, int len,
+                           struct cls_header *hdr)
+{
+        const char *gt, *colon, *end;
+
+        hdr->class = CLS_MAX;
+
+        gt = memchr(packet, '>', len);
+        colon = memchr(packet, ':', len);
+        if (!gt || !colon || (colon < gt))
+                return CLS_PARSE;
+
+        for (end = gt + 1; (end < colon) && (*end != ','); end++);
+
+        if (copy_call(hdr->src, packet, gt - packet) ||
+            copy_call(hdr->dst, gt + 1, end - (gt + 1)))
+                return CLS_PARSE;
+
+        hdr->body = colon + 1;
+        hdr->body_len = len - (hdr->body - packet);
+        hdr->class = class_of(hdr->body, hdr->body_len);
+
+        return c->action[hdr->class];
+}
+
+void cls_account(struct classifier *c, struct cls_header *hdr,
+                 enum cls_action action)
+{
+        if (hdr->class == CLS_MAX)
+                return;
+
+        c->count[hdr->class]++;
+        if (action != CLS_PARSE)
+                c->skipped++;
+}
+
+enum cls_action classify_packet(struct classifier *c,
+                                const char *packet, int len,
+                                struct cls_header *hdr)
+{
+        enum cls_action action;
+
+        action = cls_lookup(c, packet, len, hdr);
+        cls_account(c, hdr, action);
+
+        return action;
+}
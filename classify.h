@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __CLASSIFY_H
+#define __CLASSIFY_H
+
+#include <iniparser.h>
+
+/* What a packet is, from its data type identifier alone */
+enum cls_class {
+        CLS_POSIT = 0,
+        CLS_WX,
+        CLS_STATUS,
+        CLS_TELEMETRY,
+        CLS_OBJECT,
+        CLS_MESSAGE,
+        CLS_BULLETIN,
+        CLS_QUERY,
+        CLS_THIRDPARTY,
+        CLS_OTHER,
+        CLS_MAX,
+};
+
+/* What we do with it */
+enum cls_action {
+        CLS_PARSE = 0,         /* Full decode, store and display */
+        CLS_HEARD,             /* Only refresh the station's last heard */
+        CLS_DROP,              /* Nothing beyond dupe checks and digi */
+};
+
+#define CLS_CALL_LEN 12
+
+struct cls_header {
+        char src[CLS_CALL_LEN];
+        char dst[CLS_CALL_LEN];
+        const char *body;
+        int body_len;
+        enum cls_class class;  /* CLS_MAX if the header didn't parse */
+};
+
+struct classifier {
+        enum cls_action action[CLS_MAX];
+        unsigned long count[CLS_MAX];
+        unsigned long skipped;
+};
+
+void cls_load_config(dictionary *ini, struct classifier *c);
+enum cls_action cls_lookup(const struct classifier *c,
+                           const char *packet, int len,
+                           struct cls_header *hdr);
+void cls_account(struct classifier *c, struct cls_header *hdr,
+                 enum cls_action action);
+enum cls_action classify_packet(struct classifier *c,
+                                const char *packet, int len,
+                                struct cls_header *hdr);
+const char *cls_name(enum cls_class class);
+const char *cls_action_name(enum cls_action action);
+
+#endif
@@ -0,0 +1,92 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dupe.h"
+
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME  16777619U
+
+static uint32_t fnv_add(uint32_t h, const char *data, int len)
+{
+        int i;
+
+        for (i = 0; i < len; i++) {
+                h ^= (unsigned char)data[i];
+                h *= FNV_PRIME;
+        }
+
+        return h;
+}
+
+static uint32_t fnv_add_str(uint32_t h, const char *str)
+{
+        for (; str && *str; str++) {
+                h ^= (unsigned char)*str;
+                h *= FNV_PRIME;
+        }
+
+        return h;
+}
+
+/* FNV-1a of source, destination and information field. The digi path
+ * is left out on purpose: that is what differs between two copies.
+ */
+uint32_t dupe_hash(const char *src, const char *dst,
+                   const char *body, int body_len)
+{
+        uint32_t h = FNV_OFFSET;
+
+        h = fnv_add_str(h, src);
+        h = fnv_add(h, ">", 1);
+        h = fnv_add_str(h, dst);
+        h = fnv_add(h, ":", 1);
+        h = fnv_add(h, body, body_len);
+
+        return h;
+}
+
+/* Returns 1 if @hash was seen in the last DUPE_WINDOW seconds, else
+ * records it and returns 0. Expired slots are reused in place, and
+ * if the probe run is full the oldest entry in it is evicted.
+ */
+int dupe_check(struct dupe_table *t, uint32_t hash, time_t now)
+{
+        struct dupe_entry *free_slot = NULL;
+        struct dupe_entry *oldest = NULL;
+        int i;
+
+        t->checked++;
+
+        for (i = 0; i < DUPE_PROBE; i++) {
+                struct dupe_entry *e;
+
+                e = &t->slots[(hash + i) & (DUPE_SLOTS - 1)];
+
+                if (!e->seen || ((now - e->seen) > DUPE_WINDOW)) {
+                        if (!free_slot)
+                                free_slot = e;
+                } else if (e->hash == hash) {
+                        t->dupes++;
+                        return 1;
+                } else if (!oldest || (e->seen < oldest->seen)) {
+                        oldest = e;
+                }
+        }
+
+        if (!free_slot)
+                free_slot = oldest;
+
+        free_slot->hash = hash;
+        free_slot->seen = now;
+
+        return 0;
+}
+
+/* Forget everything seen, and the counts */
+void dupe_clear(struct dupe_table *t)
+{
+        memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,31 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __DUPE_H
+#define __DUPE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define DUPE_SLOTS  256        /* Power of two */
+#define DUPE_PROBE  16         /* Slots searched per lookup */
+#define DUPE_WINDOW 30         /* Seconds a packet counts as a dupe */
+
+struct dupe_entry {
+        uint32_t hash;
+        time_t seen;           /* 0 if never used */
+};
+
+struct dupe_table {
+        struct dupe_entry slots[DUPE_SLOTS];
+
+        unsigned long checked;
+        unsigned long dupes;
+};
+
+uint32_t dupe_hash(const char *src, const char *dst,
+                   const char *body, int body_len);
+int dupe_check(struct dupe_table *t, uint32_t hash, time_t now);
+void dupe_clear(struct dupe_table *t);
+
+#endif
@@ -2,8 +2,13 @@
 #define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <math.h>
 
+#include "ubx.h"
+
 struct pos {
         double lat;
         double lon;
@@ -65,15 +70,68 @@ void make_rmc(FILE *fp, struct pos *pos)
         fprintf(fp, "%s%s\r", str, checksum(str));
 }
 
-int main()
+static void put_u16(uint8_t *p, uint16_t v)
+{
+        p[0] = v & 0xFF;
+        p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+        p[0] = v & 0xFF;
+        p[1] = (v >> 8) & 0xFF;
+        p[2] = (v >> 16) & 0xFF;
+        p[3] = v >> 24;
+}
+
+void make_nav_pvt(FILE *fp, struct pos *pos)
+{
+        uint8_t pvt[UBX_NAV_PVT_LEN];
+        uint8_t pkt[UBX_NAV_PVT_LEN + UBX_OVERHEAD];
+        time_t now = time(NULL);
+        struct tm tm;
+        int len;
+
+        gmtime_r(&now, &tm);
+        memset(pvt, 0, sizeof(pvt));
+
+        put_u32(&pvt[0], (now % 604800) * 1000);  /* iTOW */
+        put_u16(&pvt[4], tm.tm_year + 1900);
+        pvt[6] = tm.tm_mon + 1;
+        pvt[7] = tm.tm_mday;
+        pvt[8] = tm.tm_hour;
+        pvt[9] = tm.tm_min;
+        pvt[10] = tm.tm_sec;
+        pvt[11] = 0x07;                          /* date, time, resolved */
+        pvt[20] = 3;                             /* 3D fix */
+        pvt[21] = 0x01;                          /* gnssFixOK */
+        pvt[23] = 4;                             /* numSV */
+        put_u32(&pvt[24], (int32_t)lround(pos->lon * 1e7));
+        put_u32(&pvt[28], (int32_t)lround(pos->lat * 1e7));
+        put_u32(&pvt[32], 1100);                 /* height, mm */
+        put_u32(&pvt[36], 1100);                 /* hMSL, mm */
+        put_u32(&pvt[60], (int32_t)lround(pos->speed / 0.00194384449));
+        put_u32(&pvt[64], (int32_t)lround(pos->course * 1e5));
+
+        len = ubx_make_packet(pkt, sizeof(pkt), UBX_CLASS_NAV, UBX_NAV_PVT,
+                              pvt, sizeof(pvt));
+        fwrite(pkt, 1, len, fp);
+}
+
+int main(int argc, char **argv)
 {
         struct pos pos = {45.525, 122.9164, 55.0, 123.0};
         int i = 0;
+        int ubx = (argc > 1) && (strcmp(argv[1], "ubx") == 0);
 
         while (1) {
                 i++;
-                make_gga(stdout, &pos);
-                make_rmc(stdout, &pos);
+                if (ubx) {
+                        make_nav_pvt(stdout, &pos);
+                } else {
+                        make_gga(stdout, &pos);
+                        make_rmc(stdout, &pos);
+                }
                 fflush(NULL);
                 sleep(1);
 
@@ -0,0 +1,704 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+/* Fast path for the packet formats that make up most of what we hear:
+ * plain and compressed positions, Mic-E, status and weather. Anything
+ * this can't decode exactly the way libfap would (DAO, telemetry, PHG,
+ * ambiguity, objects, messages, odd callsigns...) is refused, and the
+ * caller hands it to fap_parseaprs() instead.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "fastparse.h"
+
+#define KNOT_TO_KMH 1.852
+#define FT_TO_M     0.3048
+#define MPH_TO_MS   0.44704
+#define HINCH_TO_MM 0.254
+
+#define IS_DIGIT(c) (((c) >= '0') && ((c) <= '9'))
+#define IS_UPPER(c) (((c) >= 'A') && ((c) <= 'Z'))
+#define IS_B91(c)   (((c) >= 0x21) && ((c) <= 0x7b))
+
+static int digits(const char *s, int n)
+{
+        int v = 0;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                if (!IS_DIGIT(s[i]))
+                        return -1;
+                v = (v * 10) + (s[i] - '0');
+        }
+
+        return v;
+}
+
+static int b91(const char *s, int n)
+{
+        int v = 0;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                if (!IS_B91(s[i]))
+                        return -1;
+                v = (v * 91) + (s[i] - 33);
+        }
+
+        return v;
+}
+
+/* CALL[-SSID], AX.25 rules. Path entries (@path) may also be APRS-IS
+ * names (q-constructs, servers) and carry a has-been-repeated '*'.
+ */
+static int fast_call(char *out, const char *s, int len, int path)
+{
+        int i;
+        int ssid;
+
+        if ((len <= 0) || (len >= FAST_CALL_LEN))
+                return -1;
+
+        memcpy(out, s, len);
+        out[len] = 0;
+
+        if (path) {
+                if (s[len - 1] == '*')
+                        len--;
+                if ((len < 1) || (len > 9))
+                        return -1;
+                for (i = 0; i < len; i++)
+                        if (!IS_UPPER(s[i]) && !IS_DIGIT(s[i]) &&
+                            (s[i] != '-') && ((s[i] < 'a') || (s[i] > 'z')))
+                                return -1;
+                return 0;
+        }
+
+        for (i = 0; (i < len) && (s[i] != '-'); i++)
+                if (!IS_UPPER(s[i]) && !IS_DIGIT(s[i]))
+                        return -1;
+        if ((i == 0) || (i > 6))
+                return -1;
+
+        if (i < len) {
+                ssid = digits(s + i + 1, len - i - 1);
+                if ((len - i - 1 < 1) || (len - i - 1 > 2) ||
+                    (ssid < 1) || (ssid > 15) || (s[i + 1] == '0'))
+                        return -1;
+        }
+
+        return 0;
+}
+
+static int fast_header(struct fast_packet *p, const char *s, int len)
+{
+        const char *end = memchr(s, ':', len);
+        const char *ptr;
+        const char *next;
+
+        if (!end)
+                return -1;
+
+        ptr = memchr(s, '>', end - s);
+        if (!ptr || fast_call(p->src, s, ptr - s, 0))
+                return -1;
+        ptr++;
+
+        next = memchr(ptr, ',', end - ptr);
+        if (fast_call(p->dst, ptr, (next ? next : end) - ptr, 0))
+                return -1;
+
+        p->path_len = 0;
+        while (next) {
+                ptr = next + 1;
+                next = memchr(ptr, ',', end - ptr);
+                if ((p->path_len == FAST_MAX_PATH) ||
+                    fast_call(p->path[p->path_len++], ptr,
+                              (next ? next : end) - ptr, 1))
+                        return -1;
+        }
+
+        p->body = end + 1;
+        p->body_len = len - (p->body - s);
+        if (p->body_len < 1)
+                return -1;
+
+        return 0;
+}
+
+/* A !DAO! extension anywhere in @s; libfap would take it out */
+static int fast_has_dao(const char *s, int len)
+{
+        int i;
+
+        for (i = 0; i + 4 < len; i++)
+                if ((s[i] == '!') && (s[i + 4] == '!') && IS_B91(s[i + 1]) &&
+                    (s[i + 2] >= 0x20) && (s[i + 2] <= 0x7b) &&
+                    (s[i + 3] >= 0x20) && (s[i + 3] <= 0x7b))
+                        return 1;
+
+        return 0;
+}
+
+/* Copy @len bytes of comment into p->text, refusing anything libfap
+ * would have cleaned up (unprintables, whitespace at either end)
+ */
+static int fast_text(struct fast_packet *p, const char *s, int len)
+{
+        int i;
+
+        if (len >= FAST_TEXT_LEN)
+                return -1;
+
+        for (i = 0; i < len; i++)
+                if ((s[i] < 0x20) || (s[i] > 0x7e))
+                        return -1;
+
+        if (len && ((s[0] == ' ') || (s[len - 1] == ' ')))
+                return -1;
+
+        memcpy(p->text, s, len);
+        p->text[len] = 0;
+        p->text_len = len;
+        if (len)
+                p->have |= FAST_HAVE_TEXT;
+
+        return 0;
+}
+
+/* Comment after a position: optional course/speed extension, /A=,
+ * then the text itself
+ */
+static int fast_comment(struct fast_packet *p, const char *s, int len, int ext)
+{
+        char buf[FAST_TEXT_LEN];
+        const char *alt;
+        int n;
+
+        if ((len >= 7) && (strspn(s, "0123456789. ") >= 3) && (s[3] == '/') &&
+            (strspn(s + 4, "0123456789. ") >= 3)) {
+                int course = digits(s, 3);
+                int speed = digits(s + 4, 3);
+
+                if (!ext || (course < 0) || (speed < 0))
+                        return -1;
+
+                p->course = ((course >= 1) && (course <= 360)) ? course : 0;
+                p->speed = speed * KNOT_TO_KMH;
+                p->have |= FAST_HAVE_COURSE | FAST_HAVE_SPEED;
+                s += 7;
+                len -= 7;
+        } else if ((len >= 7) &&
+                   (!strncmp(s, "PHG", 3) || !strncmp(s, "RNG", 3) ||
+                    !strncmp(s, "DFS", 3))) {
+                return -1;
+        }
+
+        if (memchr(s, '|', len))
+                return -1;
+
+        if (len >= sizeof(buf))
+                return -1;
+        memcpy(buf, s, len);
+        buf[len] = 0;
+
+        alt = strstr(buf, "/A=");
+        if (alt) {
+                int ft;
+
+                if (alt[3] == '-')
+                        ft = digits(alt + 4, 5);
+                else
+                        ft = digits(alt + 3, 6);
+                if (ft < 0)
+                        return -1;
+
+                p->alt = (alt[3] == '-' ? -ft : ft) * FT_TO_M;
+                p->have |= FAST_HAVE_ALT;
+
+                n = alt - buf;
+                memmove(buf + n, buf + n + 9, len - n - 9 + 1);
+                len -= 9;
+        }
+
+        if (fast_has_dao(buf, len))
+                return -1;
+
+        /* One separator may be left ahead of the comment */
+        s = buf;
+        if (len && ((*s == '/') || (*s == ' '))) {
+                s++;
+                len--;
+        }
+
+        return fast_text(p, s, len);
+}
+
+/* Strict Peet/Davis style: wind/gust/temp, then any of r p P h b */
+static int fast_wx(struct fast_packet *p, const char *s, int len, int posless)
+{
+        const char *end = s + len;
+        int dir, spd, gust, temp;
+        int v;
+
+        if (posless) {
+                if ((len < 16) || (s[0] != 'c') || (s[4] != 's'))
+                        return -1;
+        } else if ((len < 15) || (s[3] != '/')) {
+                return -1;
+        }
+        s += posless;
+
+        dir = digits(s, 3);
+        spd = digits(s + 4, 3);
+        if ((s[7] != 'g') || (s[11] != 't'))
+                return -1;
+        gust = digits(s + 8, 3);
+        if (s[12] == '-') {
+                v = digits(s + 13, 2);
+                temp = -v;
+        } else {
+                v = temp = digits(s + 12, 3);
+        }
+        if ((dir < 0) || (spd < 0) || (gust < 0) || (v < 0))
+                return -1;
+
+        p->wx.wind_dir = dir;
+        p->wx.wind_speed = spd * MPH_TO_MS;
+        p->wx.wind_gust = gust * MPH_TO_MS;
+        p->wx.temp = (temp - 32) / 1.8;
+        p->wx.have = FAST_WX_DIR | FAST_WX_SPEED | FAST_WX_GUST | FAST_WX_TEMP;
+        s += 15;
+
+        while (s < end) {
+                unsigned int bit;
+                int n;
+
+                switch (*s) {
+                case 'r': bit = FAST_WX_RAIN_1H;  n = 3; break;
+                case 'p': bit = FAST_WX_RAIN_24H; n = 3; break;
+                case 'P': bit = FAST_WX_RAIN_MID; n = 3; break;
+                case 'h': bit = FAST_WX_HUMID;    n = 2; break;
+                case 'b': bit = FAST_WX_PRESS;    n = 5; break;
+                default:
+                        return -1;
+                }
+
+                if ((p->wx.have & bit) || (end - s < n + 1))
+                        return -1;
+                v = digits(s + 1, n);
+                if ((v < 0) || ((s + n + 1 < end) && IS_DIGIT(s[n + 1])))
+                        return -1;
+
+                switch (bit) {
+                case FAST_WX_RAIN_1H:  p->wx.rain_1h = v * HINCH_TO_MM; break;
+                case FAST_WX_RAIN_24H: p->wx.rain_24h = v * HINCH_TO_MM; break;
+                case FAST_WX_RAIN_MID: p->wx.rain_midnight = v * HINCH_TO_MM; break;
+                case FAST_WX_HUMID:    p->wx.humidity = v ? v : 100; break;
+                case FAST_WX_PRESS:    p->wx.pressure = v / 10.0; break;
+                }
+                p->wx.have |= bit;
+                s += n + 1;
+        }
+
+        p->have |= FAST_HAVE_WX;
+
+        return 0;
+}
+
+static int fast_symbol_table(char c)
+{
+        return (c == '/') || (c == '\\') || IS_UPPER(c) || IS_DIGIT(c);
+}
+
+static int fast_uncompressed(struct fast_packet *p, const char *s, int len)
+{
+        int latd, latm, lath, lond, lonm, lonh;
+
+        if (len < 19)
+                return -1;
+
+        latd = digits(s, 2);
+        latm = digits(s + 2, 2);
+        lath = digits(s + 5, 2);
+        lond = digits(s + 9, 3);
+        lonm = digits(s + 12, 2);
+        lonh = digits(s + 15, 2);
+        if ((latd < 0) || (latm < 0) || (lath < 0) ||
+            (lond < 0) || (lonm < 0) || (lonh < 0) ||
+            (s[4] != '.') || (s[14] != '.') ||
+            (latd > 89) || (latm > 59) || (lond > 179) || (lonm > 59))
+                return -1;
+        if (((s[7] != 'N') && (s[7] != 'S')) ||
+            ((s[17] != 'E') && (s[17] != 'W')) ||
+            !fast_symbol_table(s[8]) ||
+            (s[18] < 0x21) || (s[18] > 0x7e))
+                return -1;
+
+        p->lat = latd + ((latm + (lath / 100.0)) / 60.0);
+        p->lon = lond + ((lonm + (lonh / 100.0)) / 60.0);
+        if (s[7] == 'S')
+                p->lat = -p->lat;
+        if (s[17] == 'W')
+                p->lon = -p->lon;
+
+        p->symbol_table = s[8];
+        p->symbol_code = s[18];
+        p->format = fapPOS_UNCOMPRESSED;
+        p->pos_resolution = 18.52;
+        p->have |= FAST_HAVE_POS;
+
+        if (p->symbol_code == '_')
+                return fast_wx(p, s + 19, len - 19, 0);
+        else
+                return fast_comment(p, s + 19, len - 19, 1);
+}
+
+static int fast_compressed(struct fast_packet *p, const char *s, int len)
+{
+        int lat, lon;
+        int c, sp, t;
+
+        if (len < 13)
+                return -1;
+
+        lat = b91(s + 1, 4);
+        lon = b91(s + 5, 4);
+        if ((lat < 0) || (lon < 0) || (s[9] < 0x21) || (s[9] > 0x7e) ||
+            (s[9] == '_'))
+                return -1;
+
+        p->lat = 90.0 - (lat / 380926.0);
+        p->lon = -180.0 + (lon / 190463.0);
+        p->symbol_table = ((s[0] >= 'a') && (s[0] <= 'j')) ?
+                '0' + (s[0] - 'a') : s[0];
+        p->symbol_code = s[9];
+        p->format = fapPOS_COMPRESSED;
+        p->pos_resolution = 0.291;
+        p->have |= FAST_HAVE_POS;
+
+        if (s[10] != ' ') {
+                c = b91(s + 10, 1);
+                sp = b91(s + 11, 1);
+                t = b91(s + 12, 1);
+                if ((c < 0) || (sp < 0) || (t < 0))
+                        return -1;
+
+                if ((t & 0x18) == 0x10) {
+                        p->alt = pow(1.002, (c * 91) + sp) * FT_TO_M;
+                        p->have |= FAST_HAVE_ALT;
+                } else if (c <= 89) {
+                        p->course = c ? c * 4 : 360;
+                        p->speed = (pow(1.08, sp) - 1) * KNOT_TO_KMH;
+                        p->have |= FAST_HAVE_COURSE | FAST_HAVE_SPEED;
+                } else {
+                        return -1;
+                }
+        }
+
+        return fast_comment(p, s + 13, len - 13, 0);
+}
+
+static int fast_position(struct fast_packet *p)
+{
+        const char *s = p->body + 1;
+        int len = p->body_len - 1;
+
+        p->type = fapLOCATION;
+        p->messaging = (p->body[0] == '=') || (p->body[0] == '@');
+        p->have |= FAST_HAVE_MSGING;
+
+        /* Timestamped; store_packet() stamps arrival time anyway */
+        if ((p->body[0] == '/') || (p->body[0] == '@')) {
+                if ((len < 7) || (digits(s, 6) < 0) || !strchr("zh/", s[6]))
+                        return -1;
+                s += 7;
+                len -= 7;
+        }
+
+        if (len < 1)
+                return -1;
+        else if (IS_DIGIT(*s))
+                return fast_uncompressed(p, s, len);
+        else if ((*s == '/') || (*s == '\\') || IS_UPPER(*s) ||
+                 ((*s >= 'a') && (*s <= 'j')))
+                return fast_compressed(p, s, len);
+
+        return -1;
+}
+
+static int fast_mice(struct fast_packet *p)
+{
+        const char *d = p->dst;
+        const char *b = p->body;
+        char buf[FAST_TEXT_LEN];
+        int lat[6];
+        int lond, lonm, lonh;
+        int speed, course;
+        int len;
+        int i;
+
+        if ((strlen(d) < 6) || (d[6] && (d[6] != '-')) || (p->body_len < 9))
+                return -1;
+
+        for (i = 0; i < 6; i++) {
+                if (IS_DIGIT(d[i]))
+                        lat[i] = d[i] - '0';
+                else if ((d[i] >= 'A') && (d[i] <= 'J'))
+                        lat[i] = d[i] - 'A';
+                else if ((d[i] >= 'P') && (d[i] <= 'Y'))
+                        lat[i] = d[i] - 'P';
+                else
+                        return -1; /* Ambiguity, or not Mic-E */
+
+                if (i < 3)
+                        p->messagebits[i] = IS_DIGIT(d[i]) ? '0' :
+                                (d[i] >= 'P') ? '1' : '2';
+                else if ((d[i] >= 'A') && (d[i] <= 'J'))
+                        return -1; /* Custom message bits only in 1-3 */
+        }
+        p->messagebits[3] = 0;
+
+        for (i = 1; i < 9; i++)
+                if ((b[i] < 0x1c) || (b[i] > 0x7f))
+                        return -1;
+
+        lond = b[1] - 28;
+        if (d[4] >= 'P')
+                lond += 100;
+        if ((lond >= 180) && (lond <= 189))
+                lond -= 80;
+        else if ((lond >= 190) && (lond <= 199))
+                lond -= 190;
+        lonm = b[2] - 28;
+        if (lonm >= 60)
+                lonm -= 60;
+        lonh = b[3] - 28;
+
+        if (((lat[0] * 10) + lat[1] > 89) || ((lat[2] * 10) + lat[3] > 59) ||
+            (lond > 179) || (lonh > 99) ||
+            (b[7] < 0x21) || (b[7] > 0x7e) || !fast_symbol_table(b[8]))
+                return -1;
+
+        p->lat = (lat[0] * 10) + lat[1] +
+                (((lat[2] * 10) + lat[3] + (((lat[4] * 10) + lat[5]) / 100.0)) / 60.0);
+        p->lon = lond + ((lonm + (lonh / 100.0)) / 60.0);
+        if (d[3] < 'P')
+                p->lat = -p->lat;
+        if (d[5] >= 'P')
+                p->lon = -p->lon;
+
+        speed = ((b[4] - 28) * 10) + ((b[5] - 28) / 10);
+        course = (((b[5] - 28) % 10) * 100) + (b[6] - 28);
+        if (speed >= 800)
+                speed -= 800;
+        if (course >= 400)
+                course -= 400;
+
+        p->speed = speed * KNOT_TO_KMH;
+        p->course = ((course >= 1) && (course <= 360)) ? course : 0;
+        p->symbol_code = b[7];
+        p->symbol_table = b[8];
+        p->type = fapLOCATION;
+        p->format = fapPOS_MICE;
+        p->pos_resolution = 18.52;
+        p->have |= FAST_HAVE_POS | FAST_HAVE_SPEED | FAST_HAVE_COURSE;
+
+        /* Comment, with an optional "xxx}" base-91 altitude */
+        len = p->body_len - 9;
+        if ((len >= sizeof(buf)) || memchr(b + 9, '|', len) ||
+            (len && ((b[9] == '`') || (b[9] == '\''))))
+                return -1;
+        memcpy(buf, b + 9, len);
+        buf[len] = 0;
+
+        for (i = 0; i + 3 < len; i++) {
+                if ((buf[i + 3] == '}') &&
+                    IS_B91(buf[i]) && IS_B91(buf[i + 1]) && IS_B91(buf[i + 2])) {
+                        p->alt = b91(buf + i, 3) - 10000;
+                        p->have |= FAST_HAVE_ALT;
+                        memmove(buf + i, buf + i + 4, len - i - 4 + 1);
+                        len -= 4;
+                        break;
+                }
+        }
+
+        if (fast_has_dao(buf, len))
+                return -1;
+
+        return fast_text(p, buf, len);
+}
+
+static int fast_status(struct fast_packet *p)
+{
+        const char *s = p->body + 1;
+        int len = p->body_len - 1;
+
+        if ((len < 1) ||
+            ((len >= 7) && (digits(s, 6) >= 0) && (s[6] == 'z')))
+                return -1;
+
+        p->type = fapSTATUS;
+
+        return fast_text(p, s, len);
+}
+
+static int fast_posless_wx(struct fast_packet *p)
+{
+        if ((p->body_len < 9) || (digits(p->body + 1, 8) < 0))
+                return -1;
+
+        p->type = fapWX;
+
+        return fast_wx(p, p->body + 9, p->body_len - 9, 1);
+}
+
+/* Returns 0 and fills @p if we could decode @packet (TNC2 text),
+ * else -1 and libfap should have it
+ */
+int fast_parse(struct fast_packet *p, const char *packet, int len)
+{
+        p->have = 0;
+        p->wx.have = 0;
+        p->text_len = 0;
+        p->orig = packet;
+        p->orig_len = len;
+
+        if (memchr(packet, '\r', len) || memchr(packet, '\n', len) ||
+            memchr(packet, '\0', len))
+                return -1;
+
+        if (fast_header(p, packet, len))
+                return -1;
+
+        switch (p->body[0]) {
+        case '!':
+        case '=':
+        case '/':
+        case '@':
+                return fast_position(p);
+        case '`':
+        case '\'':
+                return fast_mice(p);
+        case '>':
+                return fast_status(p);
+        case '_':
+                return fast_posless_wx(p);
+        }
+
+        return -1;
+}
+
+#define FAST_NEW(ptr, val) do {                         \
+                (ptr) = malloc(sizeof(*(ptr)));         \
+                if (!(ptr))                             \
+                        goto fail;                      \
+                *(ptr) = (val);                         \
+        } while (0)
+
+#define FAST_STR(ptr, str) do {                         \
+                (ptr) = strdup(str);                    \
+                if (!(ptr))                             \
+                        goto fail;                      \
+        } while (0)
+
+/* Build a libfap packet from @p, one allocation per field present so
+ * that fap_free() can release it like any other. That's still well
+ * short of what fap_parseaprs() allocates, but it isn't none. Returns
+ * NULL if any allocation fails.
+ */
+fap_packet_t *fast_to_fap(struct fast_packet *p)
+{
+        fap_packet_t *fap;
+        int i;
+
+        fap = calloc(1, sizeof(*fap));
+        if (!fap)
+                return NULL;
+
+        FAST_NEW(fap->type, p->type);
+        fap->orig_packet = strndup(p->orig, p->orig_len);
+        if (!fap->orig_packet)
+                goto fail;
+        fap->orig_packet_len = p->orig_len;
+        fap->body = strndup(p->body, p->body_len);
+        if (!fap->body)
+                goto fail;
+        fap->body_len = p->body_len;
+        FAST_STR(fap->src_callsign, p->src);
+        FAST_STR(fap->dst_callsign, p->dst);
+
+        if (p->path_len) {
+                fap->path = calloc(p->path_len, sizeof(char *));
+                if (!fap->path)
+                        goto fail;
+                fap->path_len = p->path_len;
+                for (i = 0; i < p->path_len; i++)
+                        FAST_STR(fap->path[i], p->path[i]);
+        }
+
+        if (p->have & FAST_HAVE_POS) {
+                FAST_NEW(fap->latitude, p->lat);
+                FAST_NEW(fap->longitude, p->lon);
+                FAST_NEW(fap->format, p->format);
+                FAST_NEW(fap->pos_resolution, p->pos_resolution);
+                FAST_NEW(fap->pos_ambiguity, 0);
+                fap->symbol_table = p->symbol_table;
+                fap->symbol_code = p->symbol_code;
+        }
+        if (p->have & FAST_HAVE_ALT)
+                FAST_NEW(fap->altitude, p->alt);
+        if (p->have & FAST_HAVE_COURSE)
+                FAST_NEW(fap->course, p->course);
+        if (p->have & FAST_HAVE_SPEED)
+                FAST_NEW(fap->speed, p->speed);
+        if (p->have & FAST_HAVE_MSGING)
+                FAST_NEW(fap->messaging, p->messaging);
+        if (p->format == fapPOS_MICE && (p->have & FAST_HAVE_POS))
+                FAST_STR(fap->messagebits, p->messagebits);
+
+        if ((p->have & FAST_HAVE_TEXT) && (p->type == fapSTATUS)) {
+                FAST_STR(fap->status, p->text);
+                fap->status_len = p->text_len;
+        } else if (p->have & FAST_HAVE_TEXT) {
+                FAST_STR(fap->comment, p->text);
+                fap->comment_len = p->text_len;
+        }
+
+        if (p->have & FAST_HAVE_WX) {
+                fap_wx_report_t *wx = calloc(1, sizeof(*wx));
+
+                if (!wx)
+                        goto fail;
+                fap->wx_report = wx;
+
+                if (p->wx.have & FAST_WX_DIR)
+                        FAST_NEW(wx->wind_dir, p->wx.wind_dir);
+                if (p->wx.have & FAST_WX_SPEED)
+                        FAST_NEW(wx->wind_speed, p->wx.wind_speed);
+                if (p->wx.have & FAST_WX_GUST)
+                        FAST_NEW(wx->wind_gust, p->wx.wind_gust);
+                if (p->wx.have & FAST_WX_TEMP)
+                        FAST_NEW(wx->temp, p->wx.temp);
+                if (p->wx.have & FAST_WX_RAIN_1H)
+                        FAST_NEW(wx->rain_1h, p->wx.rain_1h);
+                if (p->wx.have & FAST_WX_RAIN_24H)
+                        FAST_NEW(wx->rain_24h, p->wx.rain_24h);
+                if (p->wx.have & FAST_WX_RAIN_MID)
+                        FAST_NEW(wx->rain_midnight, p->wx.rain_midnight);
+                if (p->wx.have & FAST_WX_HUMID)
+                        FAST_NEW(wx->humidity, p->wx.humidity);
+                if (p->wx.have & FAST_WX_PRESS)
+                        FAST_NEW(wx->pressure, p->wx.pressure);
+        }
+
+        return fap;
+ fail:
+        /* Whatever did get allocated is where fap_free() looks */
+        fap_free(fap);
+        return NULL;
+}
@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __FASTPARSE_H
+#define __FASTPARSE_H
+
+#include <fap.h>
+
+#define FAST_CALL_LEN 12
+#define FAST_MAX_PATH 8
+#define FAST_TEXT_LEN 256
+
+#define FAST_HAVE_POS     0x01
+#define FAST_HAVE_ALT     0x02
+#define FAST_HAVE_COURSE  0x04
+#define FAST_HAVE_SPEED   0x08
+#define FAST_HAVE_MSGING  0x10
+#define FAST_HAVE_TEXT    0x20 /* comment, or status for fapSTATUS */
+#define FAST_HAVE_WX      0x40
+
+#define FAST_WX_DIR       0x01
+#define FAST_WX_SPEED     0x02
+#define FAST_WX_GUST      0x04
+#define FAST_WX_TEMP      0x08
+#define FAST_WX_RAIN_1H   0x10
+#define FAST_WX_RAIN_24H  0x20
+#define FAST_WX_RAIN_MID  0x40
+#define FAST_WX_HUMID     0x80
+#define FAST_WX_PRESS     0x100
+
+/* Everything we decode from one packet. fast_parse() fills this in
+ * without touching the heap: strings point into the input or live in
+ * the fixed buffers here. Only fast_to_fap() allocates.
+ */
+struct fast_packet {
+        const char *orig;
+        int orig_len;
+        const char *body;
+        int body_len;
+
+        char src[FAST_CALL_LEN];
+        char dst[FAST_CALL_LEN];
+        char path[FAST_MAX_PATH][FAST_CALL_LEN];
+        int path_len;
+
+        fap_packet_type_t type;
+        fap_pos_format_t format;
+        unsigned int have;
+
+        double lat, lon;
+        double pos_resolution;
+        double alt;             /* m */
+        double speed;           /* km/h, as libfap */
+        unsigned int course;
+        char symbol_table;
+        char symbol_code;
+        short messaging;
+        char messagebits[4];
+
+        char text[FAST_TEXT_LEN];
+        int text_len;
+
+        struct {
+                unsigned int have;
+                unsigned int wind_dir;
+                double wind_speed;      /* m/s */
+                double wind_gust;
+                double temp;            /* C */
+                double rain_1h;         /* mm */
+                double rain_24h;
+                double rain_midnight;
+                unsigned int humidity;
+                double pressure;        /* mbar */
+        } wx;
+};
+
+int fast_parse(struct fast_packet *p, const char *packet, int len);
+fap_packet_t *fast_to_fap(struct fast_packet *p);
+
+#endif
@@ -0,0 +1,143 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/timex.h>
+
+#include "gpsclock.h"
+#include "timespec.h"
+#include "log.h"
+
+static int fix_to_utc(struct posit *fix, struct timespec *ts)
+{
+        struct tm tm;
+
+        memset(&tm, 0, sizeof(tm));
+
+        tm.tm_hour = fix->tstamp / 10000;
+        tm.tm_min = (fix->tstamp / 100) % 100;
+        tm.tm_sec = fix->tstamp % 100;
+
+        tm.tm_mday = fix->dstamp / 10000;
+        tm.tm_mon = ((fix->dstamp / 100) % 100) - 1;
+        tm.tm_year = (fix->dstamp % 100) + 100;
+
+        if ((tm.tm_mday < 1) || (tm.tm_mon < 0))
+                return 0;
+
+        ts->tv_sec = timegm(&tm);
+        ts->tv_nsec = fix->tnsec;
+
+        return 1;
+}
+
+static int gpsclock_step(struct gpsclock *clk, double offset)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        ts_add(&now, (long long)(offset * 1e9));
+
+        if (clock_settime(CLOCK_REALTIME, &now)) {
+                log_error("Clock: step of %+.3f s failed: %m\n", offset);
+                return -1;
+        }
+
+        clk->steps++;
+        log_info("Clock: stepped %+.3f s\n", offset);
+
+        return 0;
+}
+
+static int gpsclock_slew(struct gpsclock *clk, double offset)
+{
+        struct timex tx;
+
+        memset(&tx, 0, sizeof(tx));
+        tx.modes = ADJ_OFFSET_SINGLESHOT;
+        tx.offset = (long)(offset * 1e6); /* usec */
+
+        if (adjtimex(&tx) < 0) {
+                log_error("Clock: slew of %+.6f s failed: %m\n", offset);
+                return -1;
+        }
+
+        clk->slews++;
+
+        return 0;
+}
+
+/* Feed one GPS time fix, received at @rx (CLOCK_REALTIME)
+ *
+ * Returns 1 when a window completed and a correction was applied,
+ * 0 if the sample was only accumulated (or skipped).
+ */
+int gpsclock_sample(struct gpsclock *clk, struct posit *fix,
+                    struct timespec *rx)
+{
+        struct timespec gps;
+        double sample;
+        double var;
+
+        /* The date comes from the RMC that opened this slot. A GGA
+         * sent ahead of its RMC shares a slot with the one from the
+         * second before, which at midnight carries yesterday's date
+         * and would put us a day out.
+         */
+        if (!fix->dstamp || (fix->tstamp < fix->dstamp_tstamp))
+                return 0;
+
+        /* One sample per distinct fix time */
+        if (fix->tstamp == clk->last_tstamp)
+                return 0;
+
+        if (!fix_to_utc(fix, &gps))
+                return 0;
+        clk->last_tstamp = fix->tstamp;
+
+        sample = ts_diff(&gps, rx) + clk->fudge;
+
+        /* Way off (boot, dead RTC): don't wait for a full window, but
+         * don't let one bad sentence move the clock either. Step once
+         * the next sample agrees.
+         */
+        if (fabs(sample) >= GPSCLOCK_PANIC) {
+                int agree = clk->panic &&
+                        (fabs(sample - clk->panic) < GPSCLOCK_STEP);
+
+                clk->sum = clk->sumsq = 0;
+                clk->count = 0;
+                if (!agree) {
+                        clk->panic = sample;
+                        return 0;
+                }
+                clk->panic = 0;
+                clk->offset = sample;
+                gpsclock_step(clk, sample);
+                return 1;
+        }
+        clk->panic = 0;
+
+        clk->sum += sample;
+        clk->sumsq += sample * sample;
+        if (++clk->count < GPSCLOCK_WINDOW)
+                return 0;
+
+        clk->offset = clk->sum / clk->count;
+        var = (clk->sumsq / clk->count) - (clk->offset * clk->offset);
+        clk->jitter = var > 0 ? sqrt(var) : 0;
+
+        clk->sum = clk->sumsq = 0;
+        clk->count = 0;
+
+        if (fabs(clk->offset) >= GPSCLOCK_STEP)
+                gpsclock_step(clk, clk->offset);
+        else if (fabs(clk->offset) > clk->jitter)
+                gpsclock_slew(clk, clk->offset);
+
+        return 1;
+}
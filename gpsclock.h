@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __GPSCLOCK_H
+#define __GPSCLOCK_H
+
+#include <time.h>
+
+#include "nmea.h"
+
+#define GPSCLOCK_WINDOW 16     /* Samples averaged per correction */
+#define GPSCLOCK_STEP   0.5    /* Step (rather than slew) above this, sec */
+#define GPSCLOCK_PANIC  2.0    /* Step on two samples above this, sec */
+
+struct gpsclock {
+        double fudge;          /* Receiver + serial latency to remove, sec */
+
+        double offset;         /* GPS minus system time, last window */
+        double jitter;         /* RMS deviation within the last window */
+
+        double sum;
+        double sumsq;
+        int count;
+
+        time_t last_tstamp;
+
+        double panic;          /* Last sample over GPSCLOCK_PANIC, or 0 */
+
+        unsigned int steps;
+        unsigned int slews;
+};
+
+int gpsclock_sample(struct gpsclock *clk, struct posit *fix,
+                    struct timespec *rx);
+
+#endif
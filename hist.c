@@ -0,0 +1,42 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include "hist.h"
+
+/* Upper bound of bucket @i, in seconds */
+static double bucket_limit(int i)
+{
+        return (1UL << i) / 1e6;
+}
+
+void hist_add(struct hist *h, double secs)
+{
+        double us = secs * 1e6;
+        int i;
+
+        for (i = 0; (i < HIST_BUCKETS - 1) && (us > (1UL << i)); i++);
+
+        h->bucket[i]++;
+        h->count++;
+        h->sum += secs;
+        if (secs > h->max)
+                h->max = secs;
+}
+
+/* Upper bound of the bucket holding the @pct percentile. The top
+ * bucket has no bound, so the most we can say there is the max.
+ */
+double hist_percentile(struct hist *h, double pct)
+{
+        unsigned long want = h->count * pct / 100;
+        unsigned long seen = 0;
+        int i;
+
+        for (i = 0; i < HIST_BUCKETS - 1; i++) {
+                seen += h->bucket[i];
+                if (seen > want)
+                        return bucket_limit(i);
+        }
+
+        return h->max;
+}
@@ -0,0 +1,20 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __HIST_H
+#define __HIST_H
+
+#define HIST_BUCKETS 24        /* Powers of two from 1us; the top bucket
+                                * is open-ended, everything over ~4s */
+
+struct hist {
+        unsigned long bucket[HIST_BUCKETS];
+        unsigned long count;
+        double sum;
+        double max;
+};
+
+void hist_add(struct hist *h, double secs);
+double hist_percentile(struct hist *h, double pct);
+
+#endif
@@ -0,0 +1,287 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+/* Messages are formatted by the caller into a fixed ring and written
+ * out in batches by a flusher thread, so logging never blocks on the
+ * disk. If the ring is full the message is counted and dropped.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+struct log_slot {
+        int ready;
+        int len;
+        char text[LOG_LINE];
+};
+
+static struct {
+        struct log_slot slots[LOG_SLOTS];
+        unsigned long head;    /* Claimed by any thread */
+        unsigned long tail;    /* Only the flusher */
+        unsigned long dropped;
+
+        int running;
+        int stop;
+        int level;
+        int fd;
+        const char *path;
+        long max_size;
+        pthread_t thread;
+} logger;
+
+static const char *level_names[] = {
+        [L_DEBUG] = "debug",
+        [L_INFO] = "info",
+        [L_WARN] = "warn",
+        [L_ERROR] = "error",
+};
+
+int log_level_parse(const char *name)
+{
+        int i;
+
+        for (i = L_DEBUG; i <= L_ERROR; i++)
+                if (strcmp(name, level_names[i]) == 0)
+                        return i;
+
+        return -1;
+}
+
+static int format_line(char *buf, int size, int level,
+                       const char *fmt, va_list args)
+{
+        struct timespec ts;
+        struct tm tm;
+        int saved_errno = errno; /* For %m */
+        int len;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        localtime_r(&ts.tv_sec, &tm);
+
+        len = snprintf(buf, size, "%02i:%02i:%02i.%03li ",
+                       tm.tm_hour, tm.tm_min, tm.tm_sec,
+                       ts.tv_nsec / 1000000);
+        if (level >= L_WARN)
+                len += snprintf(buf + len, size - len, "%s: ",
+                                level_names[level]);
+
+        errno = saved_errno;
+        len += vsnprintf(buf + len, size - len, fmt, args);
+        if (len >= size)
+                len = size - 1;
+
+        /* Every message is a line, whether or not it ended in one */
+        if (len && (buf[len - 1] != '\n')) {
+                if (len == size - 1)
+                        len--;
+                buf[len++] = '\n';
+                buf[len] = 0;
+        }
+
+        return len;
+}
+
+void log_msg(int level, const char *fmt, ...)
+{
+        struct log_slot *slot;
+        unsigned long head;
+        va_list args;
+
+        if (level < logger.level)
+                return;
+
+        va_start(args, fmt);
+
+        /* Before the flusher is running (and in tools), just print */
+        if (!LOAD(logger.running)) {
+                char buf[LOG_LINE];
+                int len = format_line(buf, sizeof(buf), level, fmt, args);
+
+                va_end(args);
+                fwrite(buf, 1, len, stdout);
+                return;
+        }
+
+        head = LOAD(logger.head);
+        do {
+                if (head - LOAD(logger.tail) >= LOG_SLOTS) {
+                        __atomic_add_fetch(&logger.dropped, 1, __ATOMIC_RELAXED);
+                        va_end(args);
+                        return;
+                }
+        } while (!__atomic_compare_exchange_n(&logger.head, &head, head + 1, 0,
+                                              __ATOMIC_ACQ_REL,
+                                              __ATOMIC_ACQUIRE));
+
+        slot = &logger.slots[head % LOG_SLOTS];
+        slot->len = format_line(slot->text, sizeof(slot->text),
+                                level, fmt, args);
+        va_end(args);
+
+        STORE(slot->ready, 1);
+}
+
+unsigned long log_dropped(void)
+{
+        return LOAD(logger.dropped);
+}
+
+/* Point the log, and stray stdout/stderr output, at a fresh file */
+static int log_reopen(void)
+{
+        int fd;
+
+        fd = open(logger.path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (fd < 0)
+                return -errno;
+
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (logger.fd > STDERR_FILENO)
+                close(logger.fd);
+        logger.fd = fd;
+
+        return 0;
+}
+
+/* Keep one old log: <path> -> <path>.1 */
+static void log_rotate(void)
+{
+        struct stat st;
+        char old[256];
+
+        if (!logger.path || (logger.max_size <= 0))
+                return;
+
+        if (fstat(logger.fd, &st) || (st.st_size < logger.max_size))
+                return;
+
+        fflush(stdout);
+        snprintf(old, sizeof(old), "%s.1", logger.path);
+        rename(logger.path, old);
+        log_reopen();
+}
+
+static void log_write(const char *buf, int len)
+{
+        int ret;
+
+        while (len > 0) {
+                ret = write(logger.fd, buf, len);
+                if (ret < 0 && errno == EINTR)
+                        continue;
+                if (ret <= 0)
+                        return; /* Nowhere to complain to */
+                buf += ret;
+                len -= ret;
+        }
+}
+
+/* Write out everything that's ready in as few write()s as possible */
+static void log_flush(void)
+{
+        static char batch[LOG_LINE * 64];
+        static unsigned long reported;
+        unsigned long dropped;
+        int len = 0;
+
+        while (1) {
+                struct log_slot *slot = &logger.slots[logger.tail % LOG_SLOTS];
+
+                if (!LOAD(slot->ready))
+                        break;
+
+                if (len + slot->len > sizeof(batch)) {
+                        log_write(batch, len);
+                        len = 0;
+                }
+                memcpy(batch + len, slot->text, slot->len);
+                len += slot->len;
+
+                STORE(slot->ready, 0);
+                STORE(logger.tail, logger.tail + 1);
+        }
+
+        dropped = LOAD(logger.dropped);
+        if ((dropped != reported) && (len + LOG_LINE <= sizeof(batch))) {
+                len += snprintf(batch + len, LOG_LINE,
+                                "log: dropped %lu messages\n",
+                                dropped - reported);
+                reported = dropped;
+        }
+
+        if (len) {
+                log_write(batch, len);
+                log_rotate();
+        }
+}
+
+static void *log_thread(void *data)
+{
+        struct timespec delay = {0, LOG_FLUSH_MS * 1000000L};
+
+        while (!LOAD(logger.stop)) {
+                log_flush();
+                nanosleep(&delay, NULL);
+        }
+
+        log_flush();
+
+        return NULL;
+}
+
+/* Start logging to @path (or stdout if NULL), rotating it when it
+ * passes @max_size bytes, and discarding messages below @level
+ */
+int log_start(const char *path, long max_size, int level)
+{
+        int ret;
+
+        logger.path = path;
+        logger.max_size = max_size;
+        logger.level = level;
+        logger.fd = STDOUT_FILENO;
+
+        if (path) {
+                ret = log_reopen();
+                if (ret) {
+                        perror(path);
+                        return ret;
+                }
+        }
+
+        /* Stray printf()s from libraries go straight to the file */
+        setvbuf(stdout, NULL, _IOLBF, 0);
+
+        STORE(logger.running, 1);
+        ret = pthread_create(&logger.thread, NULL, log_thread, NULL);
+        if (ret) {
+                STORE(logger.running, 0);
+                return -ret;
+        }
+
+        return 0;
+}
+
+void log_stop(void)
+{
+        if (!LOAD(logger.running))
+                return;
+
+        STORE(logger.stop, 1);
+        pthread_join(logger.thread, NULL);
+        STORE(logger.running, 0);
+}
@@ -0,0 +1,30 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __LOG_H
+#define __LOG_H
+
+#define LOG_SLOTS    1024      /* Power of two */
+#define LOG_LINE     256
+#define LOG_FLUSH_MS 200
+
+enum log_level {
+        L_DEBUG = 0,
+        L_INFO,
+        L_WARN,
+        L_ERROR,
+};
+
+#define log_debug(fmt, ...) log_msg(L_DEBUG, fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...)  log_msg(L_INFO, fmt, ##__VA_ARGS__)
+#define log_warn(fmt, ...)  log_msg(L_WARN, fmt, ##__VA_ARGS__)
+#define log_error(fmt, ...) log_msg(L_ERROR, fmt, ##__VA_ARGS__)
+
+int log_level_parse(const char *name);
+int log_start(const char *path, long max_size, int level);
+void log_stop(void);
+unsigned long log_dropped(void);
+void log_msg(int level, const char *fmt, ...)
+        __attribute__ ((format (printf, 2, 3)));
+
+#endif
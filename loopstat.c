@@ -0,0 +1,134 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "loopstat.h"
+#include "timespec.h"
+#include "log.h"
+#include "soak.h"
+
+static const char *handler_names[LH_HANDLERS] = {
+        [LH_TNC] = "tnc",
+        [LH_GPS] = "gps",
+        [LH_TELEMETRY] = "telemetry",
+        [LH_DISPLAY] = "display",
+        [LH_TXBUF] = "txbuf",
+        [LH_METRICS] = "metrics",
+        [LH_UI] = "ui",
+        [LH_DIGI] = "digi",
+        [LH_BEACON] = "beacon",
+};
+
+const char *loop_handler_name(enum loop_handler h)
+{
+        return handler_names[h];
+}
+
+/* select() has returned */
+void loop_begin(struct loop_stats *l)
+{
+        clock_gettime(CLOCK_MONOTONIC, &l->start);
+        memset(l->took, 0, sizeof(l->took));
+        memset(l->took_cpu, 0, sizeof(l->took_cpu));
+
+        if (!l->rate_start.tv_sec)
+                l->rate_start = l->start;
+}
+
+void loop_enter(struct loop_stats *l)
+{
+        if (l->track_heap)
+                l->heap_at = heap_in_use();
+        clock_gettime(CLOCK_MONOTONIC, &l->at);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &l->cpu_at);
+}
+
+void loop_leave(struct loop_stats *l, enum loop_handler h)
+{
+        struct timespec now, cpu;
+        double wall, used;
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        wall = ts_diff(&now, &l->at);
+        used = ts_diff(&cpu, &l->cpu_at);
+        l->took[h] += wall;
+        l->took_cpu[h] += used;
+
+        if (l->track_heap)
+                l->heap[h] += heap_in_use() - l->heap_at;
+
+        hist_add(&l->wall[h], wall);
+        hist_add(&l->cpu[h], used);
+}
+
+/* Passes over budget get logged with the handler that took longest.
+ * If the handlers don't add up to much, the time went on something
+ * between them (fflush() on a slow terminal, say).
+ */
+void loop_end(struct loop_stats *l)
+{
+        struct timespec now;
+        double pass;
+        double rate_secs;
+        int worst = 0;
+        int i;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        pass = ts_diff(&now, &l->start);
+        hist_add(&l->pass, pass);
+        l->wakeups++;
+
+        rate_secs = ts_diff(&now, &l->rate_start);
+        if (rate_secs >= 1.0) {
+                l->wakeup_rate = (l->wakeups - l->rate_wakeups) / rate_secs;
+                l->rate_wakeups = l->wakeups;
+                l->rate_start = now;
+        }
+
+        if (!l->budget || (pass <= l->budget))
+                return;
+
+        l->stalls++;
+
+        for (i = 1; i < LH_HANDLERS; i++)
+                if (l->took[i] > l->took[worst])
+                        worst = i;
+
+        log_warn("LOOP stalled %.1f ms (budget %.1f ms), "
+                 "%s took %.1f ms, %.1f ms CPU\n",
+                 pass * 1000, l->budget * 1000,
+                 handler_names[worst], l->took[worst] * 1000,
+                 l->took_cpu[worst] * 1000);
+}
+
+void loop_report(struct loop_stats *l)
+{
+        int i;
+
+        log_info("LOOP: %lu wakeups, %.1f/s lately, %lu stalls, "
+                 "pass p99 <%.3f ms, max %.3f ms\n",
+                 l->wakeups, l->wakeup_rate, l->stalls,
+                 hist_percentile(&l->pass, 99) * 1000,
+                 l->pass.max * 1000);
+
+        for (i = 0; i < LH_HANDLERS; i++) {
+                struct hist *w = &l->wall[i];
+                struct hist *c = &l->cpu[i];
+
+                if (!w->count)
+                        continue;
+
+                log_info("LOOP %s: %lu calls, mean %.3f ms, "
+                         "p99 <%.3f ms, max %.3f ms; "
+                         "CPU mean %.3f ms, p99 <%.3f ms, max %.3f ms\n",
+                         handler_names[i], w->count,
+                         (w->sum / w->count) * 1000,
+                         hist_percentile(w, 99) * 1000, w->max * 1000,
+                         (c->sum / c->count) * 1000,
+                         hist_percentile(c, 99) * 1000, c->max * 1000);
+        }
+}
@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __LOOPSTAT_H
+#define __LOOPSTAT_H
+
+#include <time.h>
+
+#include "hist.h"
+
+/* Everything the main loop calls out to after select() */
+enum loop_handler {
+        LH_TNC,                /* Packets in, whichever way they arrive */
+        LH_GPS,                /* These three include replayed input */
+        LH_TELEMETRY,
+        LH_DISPLAY,
+        LH_TXBUF,
+        LH_METRICS,
+        LH_UI,                 /* update_packets_ui() when idle */
+        LH_DIGI,               /* send_queued() */
+        LH_BEACON,
+        LH_HANDLERS,
+};
+
+struct loop_stats {
+        struct hist wall[LH_HANDLERS];
+        struct hist cpu[LH_HANDLERS];  /* CLOCK_THREAD_CPUTIME_ID */
+        struct hist pass;              /* Whole pass, minus the wait */
+
+        double budget;         /* Warn on passes slower than this (sec), 0 for none */
+        unsigned long wakeups;
+        unsigned long stalls;
+        double wakeup_rate;    /* Per second, over the last second or so */
+
+        int track_heap;        /* Soak runs only; see heap_in_use() */
+        long heap[LH_HANDLERS];        /* Net bytes allocated */
+
+        /* The pass in progress */
+        struct timespec start;
+        struct timespec at, cpu_at;     /* Handler being timed */
+        long heap_at;
+        double took[LH_HANDLERS];
+        double took_cpu[LH_HANDLERS];
+
+        struct timespec rate_start;
+        unsigned long rate_wakeups;
+};
+
+void loop_begin(struct loop_stats *l);
+void loop_enter(struct loop_stats *l);
+void loop_leave(struct loop_stats *l, enum loop_handler h);
+void loop_end(struct loop_stats *l);
+void loop_report(struct loop_stats *l);
+const char *loop_handler_name(enum loop_handler h);
+
+#endif
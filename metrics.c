@@ -0,0 +1,212 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "log.h"
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+void metrics_init(struct metrics *r)
+{
+        memset(r, 0, sizeof(*r));
+        r->fd = -1;
+}
+
+int metric_add(struct metrics *r, const char *name, enum metric_kind kind,
+               void *value, const char *help)
+{
+        struct metric *m;
+
+        if (r->count == METRICS_MAX)
+                return -ENOSPC;
+
+        m = &r->m[r->count++];
+        m->name = name;
+        m->kind = kind;
+        m->value = value;
+        m->help = help;
+
+        return 0;
+}
+
+struct out {
+        char *buf;
+        int size;
+        int len;
+};
+
+static void out(struct out *o, const char *fmt, ...)
+{
+        va_list ap;
+        int ret;
+
+        if (o->len >= o->size)
+                return;
+
+        va_start(ap, fmt);
+        ret = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+        va_end(ap);
+
+        o->len += ret;
+}
+
+/* Length of the name without any {labels} */
+static int family_len(const char *name)
+{
+        return strcspn(name, "{");
+}
+
+/* Any {labels} on the name go in front of le="" */
+static void format_hist(struct out *o, struct metric *m, int flen)
+{
+        struct hist *h = m->value;
+        const char *labels = m->name + flen;
+        int llen = strlen(labels);
+        const char *sep = llen ? "," : "";
+        unsigned long seen = 0;
+        int i;
+
+        if (llen) {
+                labels++;       /* Past the braces */
+                llen -= 2;
+        }
+
+        /* The last bucket also holds everything beyond it, so it
+         * only shows up as +Inf
+         */
+        for (i = 0; i < HIST_BUCKETS - 1; i++) {
+                seen += LOAD(h->bucket[i]);
+                out(o, "%.*s_bucket{%.*s%sle=\"%g\"} %lu\n",
+                    flen, m->name, llen, labels, sep,
+                    (1UL << i) / 1e6, seen);
+        }
+        out(o, "%.*s_bucket{%.*s%sle=\"+Inf\"} %lu\n",
+            flen, m->name, llen, labels, sep, LOAD(h->count));
+        out(o, "%.*s_sum%s %f\n", flen, m->name, m->name + flen, h->sum);
+        out(o, "%.*s_count%s %lu\n", flen, m->name, m->name + flen,
+            LOAD(h->count));
+}
+
+static const char *type_name(enum metric_kind kind)
+{
+        switch (kind) {
+        case MK_COUNTER:
+        case MK_COUNTER_FN:
+                return "counter";
+        case MK_HIST:
+                return "histogram";
+        default:
+                return "gauge";
+        }
+}
+
+/* Everything, in the Prometheus text exposition format. Metrics that
+ * share a name and differ only in labels must be added one after the
+ * other. Returns the length, truncated to fit @size.
+ */
+int metrics_format(struct metrics *r, char *buf, int size)
+{
+        struct out o = {buf, size, 0};
+        const char *last = NULL;
+        int last_len = 0;
+        int i;
+
+        for (i = 0; i < r->count; i++) {
+                struct metric *m = &r->m[i];
+                unsigned long (*fn)(void) = m->value;
+                int flen = family_len(m->name);
+
+                if (!last || (flen != last_len) ||
+                    strncmp(m->name, last, flen)) {
+                        out(&o, "# HELP %.*s %s\n", flen, m->name, m->help);
+                        out(&o, "# TYPE %.*s %s\n", flen, m->name,
+                            type_name(m->kind));
+                        last = m->name;
+                        last_len = flen;
+                }
+
+                switch (m->kind) {
+                case MK_COUNTER:
+                        out(&o, "%s %lu\n", m->name,
+                            LOAD(*(unsigned long *)m->value));
+                        break;
+                case MK_COUNTER_FN:
+                        out(&o, "%s %lu\n", m->name, fn());
+                        break;
+                case MK_GAUGE_INT:
+                        out(&o, "%s %i\n", m->name,
+                            LOAD(*(int *)m->value));
+                        break;
+                case MK_GAUGE_UINT:
+                        out(&o, "%s %u\n", m->name,
+                            LOAD(*(unsigned int *)m->value));
+                        break;
+                case MK_GAUGE_DOUBLE:
+                        out(&o, "%s %f\n", m->name, *(double *)m->value);
+                        break;
+                case MK_HIST:
+                        format_hist(&o, m, flen);
+                        break;
+                }
+        }
+
+        return o.len < size ? o.len : size - 1;
+}
+
+/* A UNIX socket that answers every connection with one scrape */
+int metrics_listen(struct metrics *r, const char *path)
+{
+        struct sockaddr_un sun;
+        int ret;
+
+        if (strlen(path) >= sizeof(sun.sun_path))
+                return -EINVAL;
+
+        r->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (r->fd < 0)
+                return -errno;
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, path);
+        unlink(path);
+
+        if (bind(r->fd, (struct sockaddr *)&sun, sizeof(sun)) ||
+            listen(r->fd, 4)) {
+                ret = -errno;
+                close(r->fd);
+                r->fd = -1;
+                return ret;
+        }
+
+        fcntl(r->fd, F_SETFL, O_NONBLOCK);
+
+        return 0;
+}
+
+/* Call when r->fd is readable. The answer fits in the socket buffer,
+ * so a client that never reads can't hold up the main loop.
+ */
+void metrics_serve(struct metrics *r)
+{
+        static char buf[131072];
+        int len;
+        int fd;
+
+        while ((fd = accept(r->fd, NULL, NULL)) >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                len = metrics_format(r, buf, sizeof(buf));
+                if (write(fd, buf, len) != len)
+                        log_warn("metrics: short write: %m\n");
+                close(fd);
+        }
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include "hist.h"
+
+#define METRICS_MAX 128
+
+enum metric_kind {
+        MK_COUNTER,            /* unsigned long */
+        MK_COUNTER_FN,         /* unsigned long (*)(void) */
+        MK_GAUGE_INT,          /* int */
+        MK_GAUGE_UINT,         /* unsigned int */
+        MK_GAUGE_DOUBLE,       /* double */
+        MK_HIST,               /* struct hist, in seconds */
+};
+
+/* The registry only points at values; each stays where it was, owned
+ * and written by one thread. Reads are relaxed, so a scrape may see
+ * another thread's values (or histogram buckets) a moment apart.
+ */
+struct metric {
+        const char *name;      /* May carry {labels} */
+        const char *help;
+        enum metric_kind kind;
+        void *value;
+};
+
+struct metrics {
+        struct metric m[METRICS_MAX];
+        int count;
+        int fd;                /* Listening socket, or -1 */
+};
+
+void metrics_init(struct metrics *r);
+int metric_add(struct metrics *r, const char *name, enum metric_kind kind,
+               void *value, const char *help);
+int metrics_format(struct metrics *r, char *buf, int size);
+int metrics_listen(struct metrics *r, const char *path);
+void metrics_serve(struct metrics *r);
+
+#endif
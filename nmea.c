@@ -63,6 +63,7 @@ int parse_gga(struct posit *mypos, char *str)
                 switch (num) {
                 case 1:
                         mypos->tstamp = atoi(str);
+                        mypos->tnsec = (atof(str) - mypos->tstamp) * 1e9;
                         break;
                 case 2:
                         mypos->lat = parse_lat(str);
@@ -102,11 +103,16 @@ int parse_rmc(struct posit *mypos, char *str)
         int num = 0;
         char *field = strchr(str, ',');
 
+        /* Whatever this slot held before, it's not today's date */
+        mypos->dstamp = 0;
 
         while (str && field) {
                 *field = 0;
 
                 switch (num) {
+                case 1:
+                        mypos->dstamp_tstamp = atoi(str);
+                        break;
                 case 2:
                         if (*str != 'A') /* Not ACTIVE */
                                 return 1;
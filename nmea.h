@@ -13,7 +13,9 @@ struct posit {
         int qual;
         int sats;
         time_t tstamp;
+        long tnsec;
         int dstamp;
+        time_t dstamp_tstamp;  /* Time of the sentence dstamp came in */
 };
 
 int valid_checksum(char *str);
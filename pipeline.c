@@ -0,0 +1,209 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "pipeline.h"
+#include "probes.h"
+
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+static void wake_main(struct pipeline *p)
+{
+        /* If the pipe is full the main thread has wakeups pending */
+        if (write(p->notify[1], "", 1) < 0 && errno != EAGAIN)
+                perror("pipeline notify");
+}
+
+static void queue_line(struct pipeline *p, const char *line, int len,
+                       struct timespec *rx)
+{
+        struct pipe_ring *r = &p->rings[p->read % p->workers];
+        struct pipe_item *item;
+
+        while (sem_wait(&r->space) && errno == EINTR);
+
+        item = &r->slots[r->head % PIPE_RING];
+        if (len >= PIPE_TEXT)
+                len = PIPE_TEXT - 1;
+        memcpy(item->packet, line, len);
+        item->packet[len] = 0;
+        item->len = len;
+        item->rx = *rx;
+        item->fap = NULL;
+        PROBE2(packet_read, len, probe_ns(rx));
+
+        STORE(r->head, r->head + 1);
+        STORE(p->read, p->read + 1);
+        sem_post(&r->ready);
+}
+
+/* Read in big chunks and split into lines, dropping the CR/LF */
+static void *reader_thread(void *data)
+{
+        struct pipeline *p = data;
+        struct timespec rx;
+        char buf[4096];
+        int have = 0;
+        int ret;
+        char *start, *nl;
+
+        while (!LOAD(p->stop)) {
+                ret = read(p->fd, buf + have, sizeof(buf) - have);
+                if (ret < 0 && errno == EINTR)
+                        continue;
+                if (ret <= 0)
+                        break;
+                clock_gettime(CLOCK_MONOTONIC, &rx);
+                have += ret;
+
+                start = buf;
+                while ((nl = memchr(start, '\n', have - (start - buf)))) {
+                        int len = nl - start;
+
+                        if (len && start[len - 1] == '\r')
+                                len--;
+                        if (len)
+                                queue_line(p, start, len, &rx);
+                        start = nl + 1;
+                }
+
+                have -= start - buf;
+                if (have == sizeof(buf))
+                        have = 0; /* No newline in 4K, give up on it */
+                else
+                        memmove(buf, start, have);
+        }
+
+        STORE(p->eof, 1);
+        wake_main(p);
+
+        return NULL;
+}
+
+static void *worker_thread(void *data)
+{
+        struct pipe_ring *r = data;
+        struct pipeline *p = r->p;
+
+        while (1) {
+                while (sem_wait(&r->ready) && errno == EINTR);
+                if (r->done == LOAD(r->head))
+                        break; /* Woken by pipeline_stop() */
+
+                p->parse(p->ctx, &r->slots[r->done % PIPE_RING]);
+                STORE(r->done, r->done + 1);
+                wake_main(p);
+        }
+
+        return NULL;
+}
+
+/* Start a reader on @fd and @workers parser threads calling @parse on
+ * each line. Returns NULL on failure.
+ */
+struct pipeline *pipeline_start(int fd, int workers,
+                                pipe_parse_t parse, void *ctx)
+{
+        struct pipeline *p;
+        int i;
+
+        if (workers < 1 || workers > PIPE_MAX_WORKERS)
+                return NULL;
+
+        p = calloc(1, sizeof(*p));
+        if (!p)
+                return NULL;
+
+        p->fd = fd;
+        p->workers = workers;
+        p->parse = parse;
+        p->ctx = ctx;
+
+        if (pipe(p->notify)) {
+                free(p);
+                return NULL;
+        }
+        fcntl(p->notify[0], F_SETFL, O_NONBLOCK);
+        fcntl(p->notify[1], F_SETFL, O_NONBLOCK);
+
+        for (i = 0; i < workers; i++) {
+                struct pipe_ring *r = &p->rings[i];
+
+                r->p = p;
+                sem_init(&r->ready, 0, 0);
+                sem_init(&r->space, 0, PIPE_RING);
+                pthread_create(&r->thread, NULL, worker_thread, r);
+        }
+
+        pthread_create(&p->reader, NULL, reader_thread, p);
+
+        return p;
+}
+
+/* Readable when results may be waiting */
+int pipeline_fd(struct pipeline *p)
+{
+        return p->notify[0];
+}
+
+/* The next result in arrival order, or NULL if it isn't parsed yet */
+struct pipe_item *pipeline_next(struct pipeline *p)
+{
+        struct pipe_ring *r = &p->rings[p->merged % p->workers];
+        char buf[64];
+
+        if (r->tail == LOAD(r->done)) {
+                /* Clear wakeups first; anything finished after this
+                 * will leave a new one
+                 */
+                while (read(p->notify[0], buf, sizeof(buf)) > 0);
+                if (r->tail == LOAD(r->done))
+                        return NULL;
+        }
+
+        return &r->slots[r->tail % PIPE_RING];
+}
+
+void pipeline_pop(struct pipeline *p)
+{
+        struct pipe_ring *r = &p->rings[p->merged % p->workers];
+
+        STORE(r->tail, r->tail + 1);
+        p->merged++;
+        sem_post(&r->space);
+}
+
+/* Input is gone and every line has been consumed */
+int pipeline_eof(struct pipeline *p)
+{
+        return LOAD(p->eof) && (p->merged == LOAD(p->read));
+}
+
+/* Only once pipeline_eof(); the reader must be finished and every
+ * queued line consumed
+ */
+void pipeline_stop(struct pipeline *p)
+{
+        int i;
+
+        STORE(p->stop, 1);
+        pthread_join(p->reader, NULL);
+
+        for (i = 0; i < p->workers; i++) {
+                sem_post(&p->rings[i].ready);
+                pthread_join(p->rings[i].thread, NULL);
+                sem_destroy(&p->rings[i].ready);
+                sem_destroy(&p->rings[i].space);
+        }
+
+        close(p->notify[0]);
+        close(p->notify[1]);
+        free(p);
+}
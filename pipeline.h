@@ -0,0 +1,78 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <fap.h>
+
+#include "classify.h"
+
+#define PIPE_MAX_WORKERS 8
+#define PIPE_RING        128   /* Slots per worker, power of two */
+#define PIPE_TEXT        512
+
+struct pipe_item {
+        char packet[PIPE_TEXT];
+        int len;
+        struct timespec rx;    /* When the read that completed it returned */
+
+        /* Filled in by the parse callback on a worker thread */
+        struct cls_header hdr;
+        enum cls_action action;
+        fap_packet_t *fap;
+};
+
+typedef void (*pipe_parse_t)(void *ctx, struct pipe_item *item);
+
+/* One per worker. Each index has exactly one writer: the reader thread
+ * fills slots at head, the worker parses them at done, and the main
+ * thread consumes them at tail. So reader->worker and worker->main are
+ * both single-producer single-consumer, and items never get copied.
+ */
+struct pipe_ring {
+        struct pipe_item slots[PIPE_RING];
+        unsigned long head;
+        unsigned long done;
+        unsigned long tail;
+
+        sem_t ready;           /* Slots between done and head */
+        sem_t space;           /* Slots free for the reader */
+
+        pthread_t thread;
+        struct pipeline *p;
+};
+
+/* Lines are dealt to workers round-robin and collected the same way,
+ * so results come out in the order they arrived.
+ */
+struct pipeline {
+        struct pipe_ring rings[PIPE_MAX_WORKERS];
+        int workers;
+
+        int fd;
+        int notify[2];         /* Workers -> main thread wakeup */
+        pthread_t reader;
+
+        pipe_parse_t parse;
+        void *ctx;
+
+        unsigned long read;    /* Lines handed out by the reader */
+        unsigned long merged;  /* Lines consumed by the main thread */
+        int eof;
+        int stop;
+};
+
+struct pipeline *pipeline_start(int fd, int workers,
+                                pipe_parse_t parse, void *ctx);
+int pipeline_fd(struct pipeline *p);
+struct pipe_item *pipeline_next(struct pipeline *p);
+void pipeline_pop(struct pipeline *p);
+int pipeline_eof(struct pipeline *p);
+void pipeline_stop(struct pipeline *p);
+
+#endif
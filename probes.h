@@ -0,0 +1,35 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __PROBES_H
+#define __PROBES_H
+
+/* USDT probes (provider "aprs") for perf and bpftrace, as used by the
+ * scripts in tools/. Built with make SDT=1, which needs sys/sdt.h from
+ * systemtap-sdt-dev. Built in, each is a nop until something attaches;
+ * otherwise they and their arguments compile away entirely. bpftrace
+ * can't read floating point arguments, so positions go as integer
+ * microdegrees and times as CLOCK_MONOTONIC ns, comparable with its
+ * nsecs.
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)          DTRACE_PROBE1(aprs, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2(aprs, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(aprs, name, a, b, c)
+#else
+#define PROBE1(name, a)          do {} while (0)
+#define PROBE2(name, a, b)       do {} while (0)
+#define PROBE3(name, a, b, c)    do {} while (0)
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t probe_ns(const struct timespec *ts)
+{
+        return (ts->tv_sec * 1000000000ULL) + ts->tv_nsec;
+}
+
+#endif
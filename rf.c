@@ -0,0 +1,417 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+
+#include <fap.h>
+
+#include "rf.h"
+#include "timespec.h"
+#include "probes.h"
+#include "log.h"
+
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/* Producer side: a free slot, or NULL if the ring is full */
+static struct rf_msg *ring_reserve(struct rf_ring *r)
+{
+        if (r->head - LOAD(r->tail) == RF_RING) {
+                r->dropped++;
+                return NULL;
+        }
+
+        return &r->slots[r->head % RF_RING];
+}
+
+static void ring_commit(struct rf_ring *r)
+{
+        STORE(r->head, r->head + 1);
+}
+
+/* Consumer side: the oldest message, or NULL if the ring is empty */
+static struct rf_msg *ring_peek(struct rf_ring *r)
+{
+        if (r->tail == LOAD(r->head))
+                return NULL;
+
+        return &r->slots[r->tail % RF_RING];
+}
+
+static void ring_pop(struct rf_ring *r)
+{
+        STORE(r->tail, r->tail + 1);
+}
+
+static void poke(int fd)
+{
+        if (write(fd, "", 1) < 0 && errno != EAGAIN)
+                log_error("rf wakeup: %m\n");
+}
+
+static void drain(int fd)
+{
+        char buf[64];
+
+        while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+/* Hash a TNC2 packet the same way dupe_hash() does for parsed ones */
+static uint32_t tnc2_hash(const char *packet, int len)
+{
+        const char *gt, *colon, *end;
+        char src[16], dst[16];
+
+        gt = memchr(packet, '>', len);
+        colon = memchr(packet, ':', len);
+        if (!gt || !colon || (colon < gt) ||
+            (gt - packet >= sizeof(src)))
+                return 0;
+
+        for (end = gt + 1; (end < colon) && (*end != ','); end++);
+        if (end - (gt + 1) >= sizeof(dst))
+                return 0;
+
+        memcpy(src, packet, gt - packet);
+        src[gt - packet] = 0;
+        memcpy(dst, gt + 1, end - (gt + 1));
+        dst[end - (gt + 1)] = 0;
+
+        return dupe_hash(src, dst, colon + 1, len - (colon + 1 - packet));
+}
+
+static int rf_digi(struct rf *rf, uint8_t *frame, int len,
+                   struct timespec *rx)
+{
+        uint8_t kiss[TXQ_PACKET];
+        int ret;
+
+        if (!rf->conf.digi_enabled)
+                return 0;
+
+        len = ax25_digipeat(frame, len, AX25_MAX_FRAME,
+                            rf->conf.mycall, rf->conf.alias,
+                            rf->conf.append_path);
+        if (len <= 0)
+                return 0;
+
+        len = kiss_escape(frame, len, kiss, sizeof(kiss));
+        if (len < 0)
+                return 0;
+
+        ret = txq_push(&rf->txq, kiss, len, rf->conf.digi_delay, rx) == 0;
+        PROBE3(digi_enqueue, len, ret, probe_ns(rx));
+
+        return ret;
+}
+
+/* A complete KISS frame from the TNC: drop dupes, decide on the digi,
+ * and pass the TNC2 form to the main thread
+ */
+static void rf_frame(struct rf *rf, uint8_t *kiss, int kiss_len,
+                     struct timespec *rx)
+{
+        uint8_t frame[AX25_MAX_FRAME];
+        char text[512];
+        unsigned int len = sizeof(text);
+        unsigned int tnc_id;
+        struct rf_msg *m;
+        uint32_t hash;
+        int frame_len;
+
+        capture_write(rf->conf.capture, CAP_TNC, kiss, kiss_len);
+        PROBE2(packet_read, kiss_len, probe_ns(rx));
+
+        frame_len = kiss_unescape(kiss, kiss_len, frame, sizeof(frame));
+        if (frame_len <= 0)
+                return;
+
+        if (!fap_kiss_to_tnc2((char *)kiss, kiss_len, text, &len, &tnc_id))
+                return;
+        rf->frames++;
+
+        hash = tnc2_hash(text, len);
+        if (hash && dupe_check(&rf->dupes, hash, time(NULL)))
+                return;
+
+        m = ring_reserve(&rf->rx);
+        if (m) {
+                if (len >= sizeof(m->data))
+                        len = sizeof(m->data) - 1;
+                memcpy(m->data, text, len);
+                m->data[len] = 0;
+                m->len = len;
+                m->rx = *rx;
+                m->digi = rf_digi(rf, frame, frame_len, rx);
+                ring_commit(&rf->rx);
+                poke(rf->notify[1]);
+        } else {
+                rf_digi(rf, frame, frame_len, rx);
+        }
+}
+
+static void rf_read(struct rf *rf)
+{
+        struct timespec rx;
+        uint8_t buf[256];
+        int ret;
+        int len;
+        int i;
+
+        ret = read(rf->rxfd, buf, sizeof(buf));
+        clock_gettime(CLOCK_MONOTONIC, &rx);
+        for (i = 0; i < ret; i++) {
+                len = kiss_rx_byte(&rf->kiss, buf[i]);
+                if (len)
+                        rf_frame(rf, rf->kiss.buf, len, &rx);
+        }
+}
+
+static void rf_transmit(struct rf *rf)
+{
+        struct timespec due[TXQ_SLOTS];
+        struct timespec rx[TXQ_SLOTS];
+        struct timespec now;
+        struct txq_entry *e;
+        struct rf_msg *m;
+        int count = 0;
+        int i;
+
+        /* Beacons from the main thread go out right away */
+        while ((m = ring_peek(&rf->tx))) {
+                txbuf_put(&rf->txbuf, m->data, m->len);
+                ring_pop(&rf->tx);
+        }
+
+        while ((e = txq_next(&rf->txq))) {
+                txbuf_put(&rf->txbuf, e->data, e->len);
+                due[count] = e->due;
+                rx[count++] = e->rx;
+                PROBE2(digi_transmit, e->len, probe_ns(&e->rx));
+                txq_pop(&rf->txq);
+                rf->digis++;
+        }
+
+        if (!txbuf_pending(&rf->txbuf))
+                return;
+
+        txbuf_drain(&rf->txbuf, rf->txfd);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (i = 0; i < count; i++) {
+                hist_add(&rf->late, ts_diff(&now, &due[i]));
+                hist_add(&rf->rx_tx, ts_diff(&now, &rx[i]));
+        }
+}
+
+static void *rf_thread(void *data)
+{
+        struct rf *rf = data;
+        struct pollfd fds[3];
+        struct timeval tv;
+        int timeout;
+
+        if (rf->conf.priority) {
+                struct sched_param param = {
+                        .sched_priority = rf->conf.priority,
+                };
+                int ret;
+
+                ret = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+                                            &param);
+                if (ret)
+                        log_warn("RF: SCHED_FIFO %i failed: %s\n",
+                                 rf->conf.priority, strerror(ret));
+        }
+
+        while (!LOAD(rf->stop)) {
+                tv.tv_sec = 1;
+                tv.tv_usec = 0;
+                txq_timeout(&rf->txq, &tv);
+                timeout = (tv.tv_sec * 1000) + ((tv.tv_usec + 999) / 1000);
+
+                fds[0].fd = rf->rxfd;
+                fds[0].events = POLLIN;
+                fds[1].fd = rf->wake[0];
+                fds[1].events = POLLIN;
+                fds[2].fd = rf->txfd;
+                fds[2].events = txbuf_pending(&rf->txbuf) ? POLLOUT : 0;
+
+                if (poll(fds, 3, timeout) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        log_error("RF poll: %m\n");
+                        goto fail;
+                }
+
+                if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                        log_error("RF: lost the TNC\n");
+                        goto fail;
+                }
+                if (fds[0].revents & POLLIN)
+                        rf_read(rf);
+                if (fds[1].revents & POLLIN)
+                        drain(rf->wake[0]);
+
+                rf_transmit(rf);
+        }
+
+        return NULL;
+ fail:
+        /* Tell the main thread, or RX and digipeating just stop */
+        STORE(rf->failed, 1);
+        poke(rf->notify[1]);
+
+        return NULL;
+}
+
+static int make_pipe(int fds[2])
+{
+        if (pipe(fds)) {
+                fds[0] = fds[1] = -1;
+                return -1;
+        }
+
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+        return 0;
+}
+
+static void close_pipes(struct rf *rf)
+{
+        int i;
+
+        for (i = 0; i < 2; i++) {
+                if (rf->notify[i] >= 0)
+                        close(rf->notify[i]);
+                if (rf->wake[i] >= 0)
+                        close(rf->wake[i]);
+        }
+}
+
+/* Hand the TNC over to a thread of its own. Returns NULL on failure. */
+struct rf *rf_start(int rxfd, int txfd, struct rf_config *conf)
+{
+        struct rf *rf;
+
+        rf = calloc(1, sizeof(*rf));
+        if (!rf)
+                return NULL;
+
+        rf->conf = *conf;
+        rf->rxfd = rxfd;
+        rf->txfd = txfd;
+        rf->notify[0] = rf->notify[1] = -1;
+        rf->wake[0] = rf->wake[1] = -1;
+
+        if (make_pipe(rf->notify) || make_pipe(rf->wake))
+                goto err;
+
+        if (pthread_create(&rf->thread, NULL, rf_thread, rf))
+                goto err;
+
+        return rf;
+ err:
+        close_pipes(rf);
+        free(rf);
+        return NULL;
+}
+
+/* Readable when received packets may be waiting */
+int rf_fd(struct rf *rf)
+{
+        return rf->notify[0];
+}
+
+struct rf_msg *rf_next(struct rf *rf)
+{
+        struct rf_msg *m;
+
+        m = ring_peek(&rf->rx);
+        if (!m) {
+                drain(rf->notify[0]);
+                m = ring_peek(&rf->rx);
+        }
+
+        return m;
+}
+
+void rf_pop(struct rf *rf)
+{
+        ring_pop(&rf->rx);
+}
+
+/* Queue a TNC2 packet for transmission from the main thread */
+int rf_send(struct rf *rf, const char *packet)
+{
+        struct rf_msg *m;
+        int len;
+
+        m = ring_reserve(&rf->tx);
+        if (!m)
+                return -1;
+
+        len = kiss_encode_tnc2(m->data, sizeof(m->data), packet);
+        if (len < 0)
+                return -1;
+
+        m->len = len;
+        m->digi = 0;
+        ring_commit(&rf->tx);
+        poke(rf->wake[1]);
+
+        return 0;
+}
+
+/* The thread has given up on the TNC; nothing more will come in */
+int rf_failed(struct rf *rf)
+{
+        return LOAD(rf->failed);
+}
+
+/* Stop the thread, if it hasn't stopped itself, and free @rf. The
+ * TNC fds stay open; they belong to the caller.
+ */
+void rf_stop(struct rf *rf)
+{
+        STORE(rf->stop, 1);
+        poke(rf->wake[1]);
+        pthread_join(rf->thread, NULL);
+
+        close_pipes(rf);
+        free(rf);
+}
+
+void rf_report(struct rf *rf)
+{
+        struct hist *h = &rf->late;
+
+        log_info("RF: %lu frames, %lu dupes, %lu digipeated, "
+                 "%lu/%lu ring drops\n",
+                 rf->frames, rf->dupes.dupes, rf->digis,
+                 rf->rx.dropped, rf->tx.dropped);
+
+        if (h->count)
+                log_info("RF: digipeat past txdelay: mean %.3f ms, "
+                         "p50 <%.3f ms, p99 <%.3f ms, max %.3f ms\n",
+                         (h->sum / h->count) * 1000,
+                         hist_percentile(h, 50) * 1000,
+                         hist_percentile(h, 99) * 1000,
+                         h->max * 1000);
+
+        h = &rf->rx_tx;
+        if (h->count)
+                log_info("RF: digipeat read to write: p50 <%.3f ms, "
+                         "p99 <%.3f ms, max %.3f ms\n",
+                         hist_percentile(h, 50) * 1000,
+                         hist_percentile(h, 99) * 1000,
+                         h->max * 1000);
+}
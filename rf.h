@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __RF_H
+#define __RF_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ax25.h"
+#include "txq.h"
+#include "dupe.h"
+#include "hist.h"
+#include "capture.h"
+
+#define RF_RING 64             /* Power of two */
+
+struct rf_msg {
+        struct timespec rx;    /* RX: when the frame was read */
+        int len;
+        int digi;              /* RX: we queued a digipeat of it */
+        uint8_t data[TXQ_PACKET];
+};
+
+/* Single producer, single consumer; head is only written by the
+ * producer and tail only by the consumer
+ */
+struct rf_ring {
+        struct rf_msg slots[RF_RING];
+        unsigned long head;
+        unsigned long tail;
+        unsigned long dropped;
+};
+
+struct rf_config {
+        const char *mycall;
+        const char *alias;
+        const char *append_path; /* NULL unless digi:append_path */
+        int digi_enabled;
+        int digi_delay;
+        int priority;          /* SCHED_FIFO priority, 0 for none */
+        struct capture *capture; /* NULL unless capturing */
+};
+
+/* Everything the TNC needs, owned by the RF thread. The main thread
+ * only touches the rings, the wakeup pipes and (for reports) the
+ * counters.
+ */
+struct rf {
+        struct rf_config conf;
+        int rxfd;
+        int txfd;
+
+        struct rf_ring rx;     /* RF -> main, TNC2 text */
+        struct rf_ring tx;     /* main -> RF, KISS frames */
+        int notify[2];         /* Wakes the main thread */
+        int wake[2];           /* Wakes the RF thread */
+
+        struct kiss_rx kiss;
+        struct txq txq;
+        struct txbuf txbuf;
+        struct dupe_table dupes;
+
+        struct hist late;      /* Digipeats, beyond txdelay */
+        struct hist rx_tx;     /* Digipeats, frame read to write */
+        unsigned long frames;
+        unsigned long digis;
+
+        pthread_t thread;
+        int stop;              /* Set by rf_stop() */
+        int failed;            /* Set by the thread when it gives up */
+};
+
+struct rf *rf_start(int rxfd, int txfd, struct rf_config *conf);
+int rf_fd(struct rf *rf);
+struct rf_msg *rf_next(struct rf *rf);
+void rf_pop(struct rf *rf);
+int rf_send(struct rf *rf, const char *packet);
+void rf_report(struct rf *rf);
+int rf_failed(struct rf *rf);
+void rf_stop(struct rf *rf);
+
+#endif
@@ -0,0 +1,557 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+/* SmartBeaconing simulator
+ *
+ * Replays a recorded (NMEA or GPX) or synthetic track through the same
+ * sb_should_beacon() used by aprs, with a simulated clock, and reports
+ * how many beacons the [beaconing] settings would send, how far the
+ * last beaconed position lags our real one, and the airtime spent.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
+
+#include <iniparser.h>
+
+#include "nmea.h"
+#include "track.h"
+#include "beacon.h"
+#include "smartbeacon.h"
+
+#define STATUS_EVERY 120       /* Seconds, as beacon() sends them */
+#define MAX_COMMENTS 16
+
+#define KTS_TO_MPH(kts) (kts * 1.15077945)
+#define MPH_TO_KTS(mph) (mph / 1.15077945)
+#define EARTH_R 6371000.0
+#define RAD(d) ((d) * (M_PI / 180.0))
+#define DEG(r) ((r) * (180.0 / M_PI))
+
+static const char *REASONS[] = {
+        "STOPPED", "ATREST", "COURSE", "SLOWTO", "FASTTO", "FRACTO", NULL
+};
+
+struct sim {
+        struct sb_config conf;
+        struct sb_state sb;
+        struct track track;
+        struct posit pos;
+        time_t now;
+        time_t start;
+
+        const char *mycall;
+        const char *path;
+        int air_rate;
+        int posit_format;      /* FMT_*, as aprs reads [beaconing] */
+        int moving_format;
+        int speedup;
+
+        /* Comment text as configured, $subst$ and all, which is near
+         * enough in length to what goes out in the status beacons
+         */
+        const char *comments[MAX_COMMENTS];
+        int comments_count;
+        int comment_idx;
+        time_t last_status;
+        unsigned int statuses;
+
+        struct posit beaconed;
+        int have_beaconed;
+
+        unsigned int beacons;
+        unsigned int by_reason[6];
+        unsigned long air_bytes;
+        double err_sum;
+        double err_max;
+        unsigned int samples;
+};
+
+static double distance_m(double lat1, double lon1, double lat2, double lon2)
+{
+        double dlat = RAD(lat2 - lat1);
+        double dlon = RAD(lon2 - lon1);
+        double a = sin(dlat / 2) * sin(dlat / 2) +
+                cos(RAD(lat1)) * cos(RAD(lat2)) * sin(dlon / 2) * sin(dlon / 2);
+
+        return 2 * EARTH_R * atan2(sqrt(a), sqrt(1 - a));
+}
+
+static double bearing(double lat1, double lon1, double lat2, double lon2)
+{
+        double y = sin(RAD(lon2 - lon1)) * cos(RAD(lat2));
+        double x = cos(RAD(lat1)) * sin(RAD(lat2)) -
+                sin(RAD(lat1)) * cos(RAD(lat2)) * cos(RAD(lon2 - lon1));
+        double b = DEG(atan2(y, x));
+
+        return b < 0 ? b + 360 : b;
+}
+
+/* Bytes on the air for a TNC2 packet: info field plus AX.25 header
+ * (7 per address), control/PID, FCS and two flags
+ */
+static int air_bytes(const char *packet, const char *path)
+{
+        const char *info = strchr(packet, ':');
+        const char *ptr;
+        int digis = 1;
+
+        for (ptr = path; *ptr; ptr++)
+                if (*ptr == ',')
+                        digis++;
+
+        return strlen(info + 1) + (7 * (2 + digis)) + 2 + 2 + 2;
+}
+
+/* The status packet beacon() follows a moving beacon up with */
+static void sim_status(struct sim *sim)
+{
+        char packet[256];
+        const char *comment = "";
+
+        if (sim->statuses && ((sim->now - sim->last_status) <= STATUS_EVERY))
+                return;
+
+        if (sim->comments_count)
+                comment = sim->comments[sim->comment_idx++ %
+                                        sim->comments_count];
+
+        snprintf(packet, sizeof(packet), "%s>%s,%s:>%s",
+                 sim->mycall, "APZDMS", sim->path, comment);
+
+        sim->air_bytes += air_bytes(packet, sim->path);
+        sim->statuses++;
+        sim->last_status = sim->now;
+}
+
+static void sim_beacon(struct sim *sim, double course, const char *reason)
+{
+        char packet[256];
+        int moving = sim->pos.speed > 5;
+        int format = moving ? sim->moving_format : sim->posit_format;
+        int i;
+
+        switch (format) {
+        case FMT_MICE:
+                mice_encode(packet, sizeof(packet),
+                            sim->mycall, sim->path, "/>", &sim->pos);
+                break;
+        case FMT_COMPRESSED:
+                compressed_encode(packet, sizeof(packet),
+                                  sim->mycall, sim->path, '/', '>',
+                                  &sim->pos, moving, "");
+                break;
+        default:
+                posit_encode(packet, sizeof(packet),
+                             sim->mycall, sim->path, '/', '>',
+                             &sim->pos, "");
+                break;
+        }
+
+        sim->air_bytes += air_bytes(packet, sim->path);
+        sim->beacons++;
+
+        if (moving)
+                sim_status(sim);
+
+        for (i = 0; REASONS[i]; i++)
+                if (strcmp(REASONS[i], reason) == 0)
+                        sim->by_reason[i]++;
+
+        sim->sb.last_beacon = sim->now;
+        sim->sb.last_beacon_course = course;
+        sim->beaconed = sim->pos;
+        sim->have_beaconed = 1;
+}
+
+/* One simulated second with sim->pos as the current fix */
+static void sim_step(struct sim *sim)
+{
+        struct timespec mono = { sim->now, 0 };
+        struct sb_decision d;
+        double course = sim->pos.course;
+
+        if (!sim->start)
+                sim->start = sim->now;
+
+        sim->pos.qual = 1;
+        sim->pos.sats = 8;
+        sim->sb.last_gps_data = sim->now;
+        if (sim->pos.speed > 0)
+                sim->sb.last_moving = sim->now;
+
+        track_push(&sim->track, &sim->pos, &mono);
+        track_mean_course(&sim->track, 5, 1.0, &course);
+
+        if (sb_should_beacon(&sim->conf, &sim->sb, &sim->pos, course,
+                             sim->now, &d))
+                sim_beacon(sim, course, d.reason);
+
+        if (sim->have_beaconed) {
+                double err = distance_m(sim->pos.lat, sim->pos.lon,
+                                        sim->beaconed.lat, sim->beaconed.lon);
+                sim->err_sum += err;
+                if (err > sim->err_max)
+                        sim->err_max = err;
+                sim->samples++;
+        }
+
+        if (sim->speedup > 0)
+                usleep(1000000 / sim->speedup);
+}
+
+/* Step once per second from the previous fix to @next, interpolating */
+static void sim_move_to(struct sim *sim, struct posit *next, time_t t)
+{
+        struct posit from = sim->pos;
+        time_t t0 = sim->now;
+        time_t i;
+
+        if (!sim->start || (t <= t0)) {
+                sim->pos = *next;
+                sim->now = t;
+                sim_step(sim);
+                return;
+        }
+
+        for (i = t0 + 1; i <= t; i++) {
+                double f = (double)(i - t0) / (t - t0);
+
+                sim->pos = *next;
+                sim->pos.lat = from.lat + (next->lat - from.lat) * f;
+                sim->pos.lon = from.lon + (next->lon - from.lon) * f;
+                sim->now = i;
+                sim_step(sim);
+        }
+}
+
+static time_t hhmmss_to_sec(time_t hhmmss)
+{
+        return ((hhmmss / 10000) * 3600) +
+                (((hhmmss / 100) % 100) * 60) + (hhmmss % 100);
+}
+
+int run_nmea(struct sim *sim, FILE *fp)
+{
+        char line[256];
+        struct posit pos;
+        time_t last_tod = -1;
+        time_t t = 1;
+        int c;
+        int i = 0;
+
+        memset(&pos, 0, sizeof(pos));
+
+        while ((c = fgetc(fp)) != EOF) {
+                if ((c != '\r') && (c != '\n')) {
+                        if (i < sizeof(line) - 1)
+                                line[i++] = c;
+                        continue;
+                }
+                line[i] = 0;
+                i = 0;
+
+                if (!valid_checksum(line))
+                        continue;
+
+                if (strncmp(line, "$GPGGA", 6) == 0) {
+                        parse_gga(&pos, line);
+                } else if (strncmp(line, "$GPRMC", 6) == 0) {
+                        time_t tod = hhmmss_to_sec(pos.tstamp);
+
+                        parse_rmc(&pos, line);
+
+                        /* Use the fix times if they advance, else 1 Hz */
+                        if ((last_tod >= 0) && (tod > last_tod))
+                                t += tod - last_tod;
+                        else
+                                t += 1;
+                        last_tod = tod;
+
+                        sim_move_to(sim, &pos, t);
+                }
+        }
+
+        return 0;
+}
+
+static int gpx_attr(const char *tag, const char *name, double *value)
+{
+        char key[16];
+        const char *ptr;
+
+        snprintf(key, sizeof(key), "%s=\"", name);
+        ptr = strstr(tag, key);
+        if (!ptr)
+                return 0;
+
+        *value = atof(ptr + strlen(key));
+
+        return 1;
+}
+
+int run_gpx(struct sim *sim, FILE *fp)
+{
+        char *data = NULL;
+        size_t size = 0;
+        char *ptr;
+        struct posit pos, last;
+        time_t t, last_t = 0;
+        int first = 1;
+
+        if (getdelim(&data, &size, '\0', fp) < 0)
+                return -1;
+
+        memset(&pos, 0, sizeof(pos));
+
+        for (ptr = strstr(data, "<trkpt"); ptr; ptr = strstr(ptr + 1, "<trkpt")) {
+                char *end = strstr(ptr, "</trkpt>");
+                char *tm_str;
+                struct tm tm;
+
+                if (!end)
+                        break;
+                *end = 0;
+
+                if (!gpx_attr(ptr, "lat", &pos.lat) ||
+                    !gpx_attr(ptr, "lon", &pos.lon))
+                        goto next;
+
+                if (strstr(ptr, "<ele>"))
+                        pos.alt = atof(strstr(ptr, "<ele>") + 5);
+
+                memset(&tm, 0, sizeof(tm));
+                tm_str = strstr(ptr, "<time>");
+                if (tm_str && strptime(tm_str + 6, "%Y-%m-%dT%H:%M:%S", &tm))
+                        t = timegm(&tm);
+                else
+                        t = last_t + 1;
+
+                if (!first && (t > last_t)) {
+                        double dist = distance_m(last.lat, last.lon,
+                                                 pos.lat, pos.lon);
+
+                        pos.speed = (dist / (t - last_t)) * 1.94384449;
+                        pos.course = dist > 1.0 ?
+                                bearing(last.lat, last.lon, pos.lat, pos.lon) :
+                                last.course;
+                }
+
+                sim_move_to(sim, &pos, t);
+
+                last = pos;
+                last_t = t;
+                first = 0;
+        next:
+                *end = '<';
+        }
+
+        free(data);
+
+        return 0;
+}
+
+/* Park, town driving, a right turn onto the highway, an exit ramp,
+ * a curvy road, and park again
+ */
+int run_synthetic(struct sim *sim)
+{
+        static const struct {
+                int secs;
+                double mph;
+                double turn;    /* Degrees per second */
+        } legs[] = {
+                { 300,  0,   0.0 },
+                { 600, 30,   0.0 },
+                {  20, 25,   4.5 },
+                { 900, 65,   0.0 },
+                {  30, 20,  -3.0 },
+                { 600, 35,   0.2 },
+                { 120, 35,  -0.2 },
+                { 600,  0,   0.0 },
+        };
+        struct posit pos;
+        time_t t = 1;
+        int i, s;
+
+        memset(&pos, 0, sizeof(pos));
+        pos.lat = 45.525;
+        pos.lon = -122.9164;
+        pos.course = 90;
+
+        for (i = 0; i < sizeof(legs) / sizeof(legs[0]); i++) {
+                for (s = 0; s < legs[i].secs; s++) {
+                        double ms = legs[i].mph * 0.44704;
+
+                        pos.speed = MPH_TO_KTS(legs[i].mph);
+                        pos.course = fmod(pos.course + legs[i].turn + 360, 360);
+                        pos.lat += (ms * cos(RAD(pos.course))) / 111320.0;
+                        pos.lon += (ms * sin(RAD(pos.course))) /
+                                (111320.0 * cos(RAD(pos.lat)));
+
+                        sim->pos = pos;
+                        sim->now = t++;
+                        sim_step(sim);
+                }
+        }
+
+        return 0;
+}
+
+void report(struct sim *sim)
+{
+        double hours = (sim->now - sim->start) / 3600.0;
+        double airtime = (sim->air_bytes * 8.0) / sim->air_rate;
+        int i;
+
+        if (hours <= 0) {
+                printf("No fixes simulated\n");
+                return;
+        }
+
+        printf("Simulated:        %.2f h\n", hours);
+        printf("Beacons:          %u (%.1f/h)\n",
+               sim->beacons, sim->beacons / hours);
+        for (i = 0; REASONS[i]; i++)
+                if (sim->by_reason[i])
+                        printf("  %-15s %u\n", REASONS[i], sim->by_reason[i]);
+        printf("Status beacons:   %u\n", sim->statuses);
+        printf("Position error:   mean %.0f m, max %.0f m\n",
+               sim->samples ? sim->err_sum / sim->samples : 0,
+               sim->err_max);
+        printf("Airtime:          %.1f s/h at %i baud (%.2f%% of channel)\n",
+               airtime / hours, sim->air_rate,
+               (airtime / hours) / 36.0);
+}
+
+/* The [comments] that aprs would rotate through */
+static void load_comments(struct sim *sim, dictionary *ini)
+{
+        char *names;
+        char *name;
+        char *save;
+
+        names = strdup(iniparser_getstring(ini, "comments:enabled", ""));
+        if (!names)
+                return;
+
+        for (name = strtok_r(names, ",", &save);
+             name && (sim->comments_count < MAX_COMMENTS);
+             name = strtok_r(NULL, ",", &save)) {
+                char section[32];
+
+                snprintf(section, sizeof(section), "comments:%s", name);
+                sim->comments[sim->comments_count++] =
+                        iniparser_getstring(ini, section, "");
+        }
+
+        free(names);
+}
+
+void usage(char *argv0)
+{
+        printf("Usage:\n"
+               "%s [OPTS] TRACK\n"
+               "  TRACK is an NMEA log, a .gpx file, or 'synthetic'\n"
+               "Options:\n"
+               "  --help, -h       This help message\n"
+               "  --conf, -c       Configuration file for [beaconing]\n"
+               "  --speedup, -x    Times real time (default 1000, 0=max)\n"
+               "\n",
+               argv0);
+}
+
+int main(int argc, char **argv)
+{
+        static struct option lopts[] = {
+                {"help",    0, 0, 'h'},
+                {"conf",    1, 0, 'c'},
+                {"speedup", 1, 0, 'x'},
+                {NULL,      0, 0,  0 },
+        };
+        struct sim sim;
+        dictionary *ini = NULL;
+        const char *track;
+        FILE *fp;
+        int ret;
+
+        memset(&sim, 0, sizeof(sim));
+        sim.speedup = 1000;
+
+        while (1) {
+                int c;
+                int optidx;
+
+                c = getopt_long(argc, argv, "hc:x:", lopts, &optidx);
+                if (c == -1)
+                        break;
+
+                switch (c) {
+                case 'h':
+                        usage(argv[0]);
+                        return 1;
+                case 'c':
+                        ini = iniparser_load(optarg);
+                        if (!ini) {
+                                printf("Unable to load %s\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'x':
+                        sim.speedup = atoi(optarg);
+                        break;
+                default:
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+
+        if (optind >= argc) {
+                usage(argv[0]);
+                return 1;
+        }
+        track = argv[optind];
+
+        sb_load_config(ini, &sim.conf);
+        sim.mycall = iniparser_getstring(ini, "station:mycall", "N0CAL-7");
+        sim.path = iniparser_getstring(ini, "station:digi_path",
+                                       "WIDE1-1,WIDE2-1");
+        sim.air_rate = iniparser_getint(ini, "tnc:air_rate", 1200);
+        sim.posit_format = parse_format(
+                iniparser_getstring(ini, "beaconing:format_posit",
+                        iniparser_getstring(ini, "beaconing:format",
+                                            "uncompressed")), 0);
+        sim.moving_format = parse_format(
+                iniparser_getstring(ini, "beaconing:format_moving", "mice"), 1);
+        load_comments(&sim, ini);
+
+        if (strcmp(track, "synthetic") == 0) {
+                ret = run_synthetic(&sim);
+        } else {
+                fp = fopen(track, "r");
+                if (!fp) {
+                        perror(track);
+                        return 1;
+                }
+                if (strstr(track, ".gpx"))
+                        ret = run_gpx(&sim, fp);
+                else
+                        ret = run_nmea(&sim, fp);
+                fclose(fp);
+        }
+
+        if (ret) {
+                printf("Failed to read track %s\n", track);
+                return 1;
+        }
+
+        report(&sim);
+
+        return 0;
+}
@@ -10,7 +10,9 @@
 
 #include <fap.h>
 
-#define FEND  0xC0
+#include "serial.h"
+#include "ax25.h"
+#include "log.h"
 
 static int ALARM_INSTALLED = 0;
 
@@ -19,13 +21,14 @@ void alarm_handler(int signal)
         printf("IO Timeout\n");
 }
 
-int get_packet(int fd, char *buf, unsigned int *len)
+/* Read one KISS frame, FEND to FEND, into @kiss. Returns its length,
+ * or 0 on failure.
+ */
+int read_kiss_frame(int fd, uint8_t *kiss, int size)
 {
         unsigned char byte = 0x00;
-        char packet[512] = "";
         int ret;
         int pos = 0;
-        unsigned int tnc_id;
 
         if (!ALARM_INSTALLED) {
                 struct sigaction action;
@@ -38,31 +41,49 @@ int get_packet(int fd, char *buf, unsigned int *len)
 
         alarm(5); /* Five second timeout */
 
-        while (byte != FEND) {
+        while (byte != KISS_FEND) {
                 ret = read(fd, &byte, 1);
                 if (ret < 0) {
-                        printf("TNC read failed: %m\n");
+                        log_error("TNC read failed: %m\n");
+                        alarm(0);
                         return 0;
                 }
         }
 
-        packet[pos++] = byte;
+        kiss[pos++] = byte;
 
-        while (1 && (pos < sizeof(packet))) {
+        while (1 && (pos < size)) {
                 ret = read(fd, &byte, 1);
                 if (ret != 1)
                         continue;
-                packet[pos++] = byte;
-                if (byte == FEND)
+                kiss[pos++] = byte;
+                if (byte == KISS_FEND)
                         break;
         }
 
         alarm(0);
 
-        packet[sizeof(packet)-1] = '\0';
-        ret = fap_kiss_to_tnc2(packet, pos, buf, len, &tnc_id);
+        return pos;
+}
+
+/* Decode a KISS frame, returning it as TNC2 text in @buf and, if
+ * @frame is not NULL, as the raw AX.25 frame (AX25_MAX_FRAME bytes)
+ */
+int decode_kiss_frame(uint8_t *kiss, int kiss_len,
+                      char *buf, unsigned int *len,
+                      uint8_t *frame, int *frame_len)
+{
+        unsigned int tnc_id;
+        int ret;
+
+        if (frame)
+                *frame_len = kiss_unescape(kiss, kiss_len,
+                                           frame, AX25_MAX_FRAME);
+
+        ret = fap_kiss_to_tnc2((char *)kiss, kiss_len, buf, len, &tnc_id);
         if (!ret)
-                printf("Failed to convert packet: %s\n", packet);
+                log_warn("Failed to convert packet: %.*s\n",
+                         kiss_len, (char *)kiss);
 
         return ret;
 }
@@ -132,3 +153,11 @@ int serial_open(const char *device, int baudrate, int hwflow)
 
         return fd;
 }
+
+/* A second, non-blocking, write-only handle on an already-configured
+ * device, so TX never stalls the blocking reads on the first one
+ */
+int serial_open_tx(const char *device)
+{
+        return open(device, O_WRONLY | O_NOCTTY | O_NONBLOCK);
+}
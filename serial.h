@@ -4,7 +4,13 @@
 #ifndef __SERIAL_H
 #define __SERIAL_H
 
-int get_packet(int fd, char *buf, unsigned int *len);
+#include <stdint.h>
+
+int read_kiss_frame(int fd, uint8_t *kiss, int size);
+int decode_kiss_frame(uint8_t *kiss, int kiss_len,
+                      char *buf, unsigned int *len,
+                      uint8_t *frame, int *frame_len);
 int serial_open(const char *device, int baudrate, int hwflow);
+int serial_open_tx(const char *device);
 
 #endif
@@ -0,0 +1,143 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "smartbeacon.h"
+#include "track.h"
+
+#define KTS_TO_MPH(kts) (kts * 1.15077945)
+
+void sb_load_config(dictionary *ini, struct sb_config *conf)
+{
+        conf->atrest_rate = iniparser_getint(ini,
+                                             "beaconing:atrest_rate",
+                                             600);
+        conf->low.speed = iniparser_getint(ini,
+                                           "beaconing:min_speed",
+                                           10);
+        conf->low.int_sec = iniparser_getint(ini,
+                                             "beaconing:min_rate",
+                                             600);
+        conf->high.speed = iniparser_getint(ini,
+                                            "beaconing:max_speed",
+                                            60);
+        conf->high.int_sec = iniparser_getint(ini,
+                                              "beaconing:max_rate",
+                                              60);
+        conf->course_change_min = iniparser_getint(ini,
+                                                   "beaconing:course_change_min",
+                                                   30);
+        conf->course_change_slope = iniparser_getint(ini,
+                                                     "beaconing:course_change_slope",
+                                                     255);
+        conf->after_stop = iniparser_getint(ini,
+                                            "beaconing:after_stop",
+                                            180);
+}
+
+static double sb_course_change_thresh(struct sb_config *conf, double speed)
+{
+        double mph = KTS_TO_MPH(speed);
+        double slope = conf->course_change_slope;
+        double min = conf->course_change_min;
+
+        return min + (slope / mph);
+}
+
+/* Decide whether to beacon at @now, given the current fix and the
+ * course (smoothed, if the caller has a track) we are travelling.
+ * All time comes from @now so this can be driven faster than real
+ * time.
+ */
+int sb_should_beacon(struct sb_config *conf, struct sb_state *sb,
+                     struct posit *mypos, double course, time_t now,
+                     struct sb_decision *d)
+{
+        time_t delta = now - sb->last_beacon;
+        time_t sb_min_delta;
+        double speed_frac;
+        double d_speed = conf->high.speed - conf->low.speed;
+        double d_rate = conf->low.int_sec - conf->high.int_sec;
+        double sb_thresh = sb_course_change_thresh(conf, mypos->speed);
+        double sb_change = course_diff(sb->last_beacon_course, course);
+
+        d->reason = NULL;
+        d->req = 0;
+
+        /* NEVER more often than every 10 seconds! */
+        if (delta < 10)
+                return 0;
+
+        /* The fractional penetration into the lo/hi zone */
+        speed_frac = (KTS_TO_MPH(mypos->speed) - conf->low.speed) / d_speed;
+
+        /* Determine the fractional that we are slower than the max */
+        sb_min_delta = (d_rate * (1 - speed_frac)) + conf->high.int_sec;
+
+        /* Never when we aren't getting data anymore */
+        if ((now - sb->last_gps_data) > 30) {
+                mypos->qual = mypos->sats = 0;
+                d->reason = "NODATA";
+                goto out;
+        }
+
+        /* Never when we don't have a fix */
+        if (mypos->qual == 0) {
+                d->reason = "NOLOCK";
+                goto out;
+        }
+
+        /* If we have recently stopped moving, do one beacon */
+        if (sb->last_moving &&
+            ((now - sb->last_moving) > conf->after_stop)) {
+                sb->last_moving = 0;
+                d->req = -1;
+                d->reason = "STOPPED";
+                goto out;
+        }
+
+        /* If we're not moving at all, choose the "at rest" rate */
+        if (mypos->speed <= 1) {
+                d->req = conf->atrest_rate;
+                d->reason = "ATREST";
+                goto out;
+        }
+
+        /* SmartBeaconing: Course Change (only if moving) */
+        if ((sb_change > sb_thresh) && (KTS_TO_MPH(mypos->speed) > 2.0)) {
+                d->reason = "COURSE";
+                d->req = -1;
+                goto out;
+        }
+
+        /* SmartBeaconing: Range-based variable speed beaconing */
+
+        /* If we're going below the low point, use that interval */
+        if (KTS_TO_MPH(mypos->speed) < conf->low.speed) {
+                d->req = conf->low.int_sec;
+                d->reason = "SLOWTO";
+                goto out;
+        }
+
+        /* If we're going above the high point, use that interval */
+        if (KTS_TO_MPH(mypos->speed) > conf->high.speed) {
+                d->req = conf->high.int_sec;
+                d->reason = "FASTTO";
+                goto out;
+        }
+
+        /* We must be in the speed zone, so adjust interval according
+         * to the fractional penetration of the speed range
+         */
+        d->req = sb_min_delta;
+        d->reason = "FRACTO";
+ out:
+        if (d->req == 0)
+                return 0;
+        else if (d->req == -1)
+                return 1;
+        else
+                return delta > d->req;
+}
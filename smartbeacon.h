@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __SMARTBEACON_H
+#define __SMARTBEACON_H
+
+#include <time.h>
+
+#include <iniparser.h>
+
+#include "nmea.h"
+
+struct smart_beacon_point {
+        float int_sec;
+        float speed;
+};
+
+struct sb_config {
+        int atrest_rate;
+        struct smart_beacon_point low;
+        struct smart_beacon_point high;
+        int course_change_min;
+        int course_change_slope;
+        int after_stop;
+};
+
+struct sb_state {
+        time_t last_beacon;
+        time_t last_gps_data;
+        time_t last_moving;
+        double last_beacon_course;
+};
+
+struct sb_decision {
+        const char *reason;
+        time_t req;     /* Interval required, 0 if never, -1 if now */
+};
+
+void sb_load_config(dictionary *ini, struct sb_config *conf);
+int sb_should_beacon(struct sb_config *conf, struct sb_state *sb,
+                     struct posit *mypos, double course, time_t now,
+                     struct sb_decision *d);
+
+#endif
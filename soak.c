@@ -0,0 +1,128 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include "soak.h"
+#include "log.h"
+
+#define KB(b) ((b) / 1024)
+
+/* mallinfo() is deprecated from 2.33, and its ints wrap past 2 GB */
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_MALLINFO2
+#endif
+#endif
+
+static void allocator(long *in_use, long *arena)
+{
+#ifdef HAVE_MALLINFO2
+        struct mallinfo2 mi = mallinfo2();
+#else
+        struct mallinfo mi = mallinfo();
+#endif
+
+        /* Big blocks are mmap()ed on their own and don't count in
+         * either arena figure
+         */
+        *in_use = mi.uordblks + mi.hblkhd;
+        *arena = mi.arena + mi.hblkhd;
+}
+
+/* Walks the allocator's bins, so not something to call per packet
+ * outside of a soak run
+ */
+long heap_in_use(void)
+{
+        long in_use, arena;
+
+        allocator(&in_use, &arena);
+
+        return in_use;
+}
+
+void mem_sample(struct mem_sample *m)
+{
+        long pages = 0;
+        FILE *fp;
+
+        fp = fopen("/proc/self/statm", "r");
+        if (fp) {
+                if (fscanf(fp, "%*d %ld", &pages) != 1)
+                        pages = 0;
+                fclose(fp);
+        }
+        m->rss = pages * sysconf(_SC_PAGESIZE);
+
+        allocator(&m->heap, &m->arena);
+}
+
+void soak_start(struct soak *s, struct loop_stats *l)
+{
+        mem_sample(&s->last);
+        l->track_heap = 1;
+}
+
+/* Call at the end of each pass. Returns 1 if there are more to go */
+int soak_pass(struct soak *s, struct loop_stats *l, unsigned long records)
+{
+        struct mem_sample m;
+
+        mem_sample(&m);
+        s->pass++;
+
+        log_info("SOAK pass %i/%i: %lu records, heap %li KB (%+li), "
+                 "allocator %li KB, RSS %li KB (%+li)\n",
+                 s->pass, s->passes, records,
+                 KB(m.heap), KB(m.heap - s->last.heap), KB(m.arena),
+                 KB(m.rss), KB(m.rss - s->last.rss));
+
+        if (s->pass == s->warmup) {
+                s->steady = m;
+                memcpy(s->handler, l->heap, sizeof(s->handler));
+        }
+        s->last = m;
+
+        return s->pass < s->passes;
+}
+
+/* Heap growth since warm-up, in total and by the main loop handler
+ * that was running when it happened. Returns -1 if it's over the
+ * bound.
+ */
+int soak_report(struct soak *s, struct loop_stats *l)
+{
+        long growth = s->last.heap - s->steady.heap;
+        long rest = growth;
+        int i;
+
+        log_info("SOAK: after %i warm-up passes, %i more: "
+                 "heap %+li bytes, RSS %+li KB\n",
+                 s->warmup, s->pass - s->warmup,
+                 growth, KB(s->last.rss - s->steady.rss));
+
+        for (i = 0; i < LH_HANDLERS; i++) {
+                long delta = l->heap[i] - s->handler[i];
+
+                if (delta)
+                        log_info("SOAK   %-10s %+li bytes\n",
+                                 loop_handler_name(i), delta);
+                rest -= delta;
+        }
+        if (rest)
+                log_info("SOAK   %-10s %+li bytes\n", "elsewhere", rest);
+
+        if (growth > s->max_growth) {
+                log_warn("SOAK: FAIL, heap grew more than %li KB\n",
+                         KB(s->max_growth));
+                return -1;
+        }
+
+        log_info("SOAK: OK\n");
+
+        return 0;
+}
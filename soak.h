@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __SOAK_H
+#define __SOAK_H
+
+#include "loopstat.h"
+
+struct mem_sample {
+        long rss;              /* Bytes resident */
+        long heap;             /* Bytes malloc()ed and not yet freed */
+        long arena;            /* Bytes the allocator has from the system */
+};
+
+/* Replaying a capture over and over, everything kept should reach a
+ * steady state in the first pass or so. After that, heap growth is
+ * a leak.
+ */
+struct soak {
+        int passes;            /* Times through the capture */
+        int warmup;            /* Passes before the heap should be flat */
+        long max_growth;       /* Bytes it may grow after warm-up */
+
+        int pass;              /* Passes done */
+        struct mem_sample steady;  /* At the end of warm-up */
+        struct mem_sample last;
+        long handler[LH_HANDLERS]; /* loop_stats heap[] at the end of warm-up */
+};
+
+long heap_in_use(void);
+void mem_sample(struct mem_sample *m);
+void soak_start(struct soak *s, struct loop_stats *l);
+int soak_pass(struct soak *s, struct loop_stats *l, unsigned long records);
+int soak_report(struct soak *s, struct loop_stats *l);
+
+#endif
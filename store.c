@@ -0,0 +1,166 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "store.h"
+#include "util.h"
+#include "probes.h"
+
+int stored_packet_desc(fap_packet_t *fap, int index, int metric_units,
+                       double mylat, double mylon,
+                       char *buf, int len)
+{
+        if (fap->latitude && fap->longitude) {
+                double km = fap_distance(mylon, mylat,
+                                         *fap->longitude, *fap->latitude);
+
+                snprintf(buf, len,
+                         "%i:%-9s <small>%3.0f%s %-2s</small>",
+                         index, OBJNAME(fap),
+                         metric_units ? km : KPH_TO_MPH(km),
+                         metric_units ? "km" : "mi",
+                         direction(get_direction(mylon, mylat,
+                                                 *fap->longitude,
+                                                 *fap->latitude)));
+        } else
+                snprintf(buf, len,
+                         "%i:%-9s <small>%s</small>",
+                         index, OBJNAME(fap),
+                         fap->timestamp ? format_time(time(NULL) - *fap->timestamp) : "");
+
+        return 0;
+}
+
+/* Move packets below @index to @index */
+int move_packets(struct store *store, int index)
+{
+        int i;
+        const int max = KEEP_PACKETS;
+        int end = (store->recent_idx +1 ) % max;
+
+        fap_free(store->recent[index]);
+
+        for (i = index; i != end; i -= 1) {
+                if (i == 0)
+                        i = KEEP_PACKETS; /* Zero now, KEEP-1 next */
+                store->recent[i % max] = store->recent[(i - 1) % max];
+        }
+
+        /* This made a hole at the bottom */
+        store->recent[end] = NULL;
+
+        return 0;
+}
+
+int find_packet(struct store *store, fap_packet_t *fap)
+{
+        int i;
+
+        for (i = 0; i < KEEP_PACKETS; i++)
+                if (store->recent[i] &&
+                    STREQ(OBJNAME(store->recent[i]), OBJNAME(fap)))
+                        return i;
+
+        return -1;
+}
+
+#define SWAP_VAL(new, old, value)                       \
+        do {                                            \
+                if (old->value && !new->value) {        \
+                        new->value = old->value;        \
+                        old->value = 0;                 \
+                }                                       \
+        } while (0);
+
+int merge_packets(fap_packet_t *new, fap_packet_t *old)
+{
+        SWAP_VAL(new, old, speed);
+        SWAP_VAL(new, old, course);
+        SWAP_VAL(new, old, latitude);
+        SWAP_VAL(new, old, longitude);
+        SWAP_VAL(new, old, altitude);
+        SWAP_VAL(new, old, symbol_table);
+        SWAP_VAL(new, old, symbol_code);
+
+        if (old->comment_len && !new->comment_len) {
+                new->comment_len = old->comment_len;
+                new->comment = old->comment;
+                old->comment_len = 0;
+                old->comment = NULL;
+        }
+
+        if (old->status_len && !new->status_len) {
+                new->status_len = old->status_len;
+                new->status = old->status;
+                old->status_len = 0;
+                old->status = NULL;
+        }
+
+        return 0;
+}
+
+int store_packet(struct store *store, fap_packet_t *fap, const char *mycall)
+{
+        int i;
+
+        /* libfap fills this in if the packet carried a timestamp */
+        if (!fap->timestamp)
+                fap->timestamp = malloc(sizeof(*fap->timestamp));
+        time(fap->timestamp);
+
+        if (store->last_packet &&
+            STREQ(OBJNAME(store->last_packet), OBJNAME(fap))) {
+                /* Received another packet for the latest, merge and bail */
+                merge_packets(fap, store->last_packet);
+                fap_free(store->last_packet);
+                goto out;
+        }
+
+        /* If the station has been heard, remove it from the old position
+         * in the list and merge its data into the current one
+         */
+        i = find_packet(store, fap);
+        if (i != -1) {
+                merge_packets(fap, store->recent[i]);
+                move_packets(store, i);
+        }
+
+        /* Note: we don't store our own packets on the list */
+
+        if (store->last_packet &&
+            !STREQ(store->last_packet->src_callsign, mycall)) {
+                /* Push the previously-current packet onto the list */
+                store->recent_idx = (store->recent_idx + 1) % KEEP_PACKETS;
+                if (store->recent[store->recent_idx])
+                        fap_free(store->recent[store->recent_idx]);
+                store->recent[store->recent_idx] = store->last_packet;
+        } else if (store->last_packet)
+                fap_free(store->last_packet);
+ out:
+        store->last_packet = fap;
+
+        PROBE2(store, OBJNAME(fap), store->recent_idx);
+
+        return 0;
+}
+
+/* Only for tidying up; nothing in the recent list survives this */
+void store_clear(struct store *store)
+{
+        int i;
+
+        for (i = 0; i < KEEP_PACKETS; i++) {
+                if (store->recent[i])
+                        fap_free(store->recent[i]);
+                store->recent[i] = NULL;
+        }
+        if (store->last_packet)
+                fap_free(store->last_packet);
+        store->last_packet = NULL;
+        store->recent_idx = 0;
+}
@@ -0,0 +1,32 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __STORE_H
+#define __STORE_H
+
+#include <fap.h>
+
+#define KEEP_PACKETS 8
+
+#define OBJNAME(p) ((p)->object_or_item_name ? (p)->object_or_item_name : \
+                    (p)->src_callsign)
+
+/* The station heard last, and the ones before it, one entry each.
+ * recent[] is a ring with the newest at recent_idx.
+ */
+struct store {
+        fap_packet_t *last_packet; /* In case we don't store it below */
+        fap_packet_t *recent[KEEP_PACKETS];
+        int recent_idx;
+};
+
+int stored_packet_desc(fap_packet_t *fap, int index, int metric_units,
+                       double mylat, double mylon,
+                       char *buf, int len);
+int move_packets(struct store *store, int index);
+int find_packet(struct store *store, fap_packet_t *fap);
+int merge_packets(fap_packet_t *new, fap_packet_t *old);
+int store_packet(struct store *store, fap_packet_t *fap, const char *mycall);
+void store_clear(struct store *store);
+
+#endif
@@ -0,0 +1,121 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "template.h"
+
+static const char *var_names[TV_MAX] = {
+        [TV_INDEX] = "index",
+        [TV_MYCALL] = "mycall",
+        [TV_TEMP1] = "temp1",
+        [TV_VOLTAGE] = "voltage",
+        [TV_SATS] = "sats",
+        [TV_VER] = "ver",
+        [TV_TIME] = "time",
+        [TV_DATE] = "date",
+        [TV_DIGIQ] = "digiq",
+};
+
+static int add_token(struct tmpl *t, enum tmpl_var var,
+                     const char *text, int len)
+{
+        if (t->count == TMPL_MAX_TOKENS)
+                return -1;
+
+        t->tokens[t->count].var = var;
+        t->tokens[t->count].text = text;
+        t->tokens[t->count].len = len;
+        t->count++;
+
+        return 0;
+}
+
+/* Break @src into literal text and $name$ variables. Returns 0, or -1
+ * (having said why) for an unknown or unterminated variable.
+ */
+int tmpl_compile(struct tmpl *t, const char *src)
+{
+        const char *ptr = src;
+        const char *start, *end;
+        int i;
+
+        t->count = 0;
+
+        while (*ptr) {
+                start = strchr(ptr, '$');
+                if (!start) {
+                        if (add_token(t, TV_LITERAL, ptr, strlen(ptr)))
+                                goto full;
+                        break;
+                }
+
+                if ((start > ptr) &&
+                    add_token(t, TV_LITERAL, ptr, start - ptr))
+                        goto full;
+
+                end = strchr(start + 1, '$');
+                if (!end) {
+                        printf("Bad substitution `%s' in `%s'\n",
+                               start, src);
+                        return -1;
+                }
+
+                for (i = 0; i < TV_MAX; i++)
+                        if ((strlen(var_names[i]) == end - (start + 1)) &&
+                            !strncmp(var_names[i], start + 1,
+                                     end - (start + 1)))
+                                break;
+                if (i == TV_MAX) {
+                        printf("Unknown substitution `%.*s' in `%s'\n",
+                               (int)(end - start + 1), start, src);
+                        return -1;
+                }
+
+                if (add_token(t, i, NULL, 0))
+                        goto full;
+
+                ptr = end + 1;
+        }
+
+        return 0;
+ full:
+        printf("Too many substitutions in `%s'\n", src);
+        return -1;
+}
+
+/* Render into @buf, truncating to fit. Returns the length written. */
+int tmpl_render(struct tmpl *t, char *buf, int size,
+                tmpl_var_t lookup, void *ctx)
+{
+        int len = 0;
+        int ret;
+        int i;
+
+        if (size < 1)
+                return 0;
+        buf[0] = 0;
+
+        for (i = 0; (i < t->count) && (len < size - 1); i++) {
+                struct tmpl_token *tok = &t->tokens[i];
+
+                if (tok->var == TV_LITERAL) {
+                        ret = tok->len;
+                        if (ret > size - 1 - len)
+                                ret = size - 1 - len;
+                        memcpy(buf + len, tok->text, ret);
+                } else {
+                        ret = lookup(ctx, tok->var, buf + len, size - len);
+                        if (ret < 0)
+                                ret = 0;
+                        else if (ret > size - 1 - len)
+                                ret = size - 1 - len; /* snprintf truncated */
+                }
+                len += ret;
+        }
+
+        buf[len] = 0;
+
+        return len;
+}
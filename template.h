@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __TEMPLATE_H
+#define __TEMPLATE_H
+
+#define TMPL_MAX_TOKENS 16
+
+/* Things a comment can say with $name$ */
+enum tmpl_var {
+        TV_LITERAL = -1,
+        TV_INDEX = 0,
+        TV_MYCALL,
+        TV_TEMP1,
+        TV_VOLTAGE,
+        TV_SATS,
+        TV_VER,
+        TV_TIME,
+        TV_DATE,
+        TV_DIGIQ,
+        TV_MAX,
+};
+
+struct tmpl_token {
+        enum tmpl_var var;
+        const char *text;      /* TV_LITERAL only, not terminated */
+        int len;
+};
+
+/* A comment broken into literal spans and variables at load time.
+ * Literals point into the source string, which must outlive this.
+ */
+struct tmpl {
+        struct tmpl_token tokens[TMPL_MAX_TOKENS];
+        int count;
+};
+
+/* Writes the value of @var into @buf, returning its length */
+typedef int (*tmpl_var_t)(void *ctx, enum tmpl_var var, char *buf, int size);
+
+int tmpl_compile(struct tmpl *t, const char *src);
+int tmpl_render(struct tmpl *t, char *buf, int size,
+                tmpl_var_t lookup, void *ctx);
+
+#endif
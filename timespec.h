@@ -0,0 +1,32 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __TIMESPEC_H
+#define __TIMESPEC_H
+
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000L
+
+/* @a - @b, in seconds */
+static inline double ts_diff(const struct timespec *a,
+                             const struct timespec *b)
+{
+        return (a->tv_sec - b->tv_sec) + ((a->tv_nsec - b->tv_nsec) / 1e9);
+}
+
+/* Move @ts by @ns, either way */
+static inline void ts_add(struct timespec *ts, long long ns)
+{
+        ts->tv_sec += ns / NSEC_PER_SEC;
+        ts->tv_nsec += ns % NSEC_PER_SEC;
+        if (ts->tv_nsec >= NSEC_PER_SEC) {
+                ts->tv_sec++;
+                ts->tv_nsec -= NSEC_PER_SEC;
+        } else if (ts->tv_nsec < 0) {
+                ts->tv_sec--;
+                ts->tv_nsec += NSEC_PER_SEC;
+        }
+}
+
+#endif
@@ -0,0 +1,87 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+#include "timespec.h"
+#include "log.h"
+#include "probes.h"
+
+static const char *stage_names[TR_STAGES] = {
+        [TR_READ] = "read",
+        [TR_START] = "receive",
+        [TR_PARSE] = "parse",
+        [TR_STORE] = "store",
+        [TR_DISPLAY] = "display",
+};
+
+const char *trace_stage_name(enum trace_stage stage)
+{
+        return stage_names[stage];
+}
+
+/* @read is when the packet's data was first there to read, or NULL
+ * for now
+ */
+void trace_start(struct trace *t, const struct timespec *read)
+{
+        if (read)
+                t->at[TR_READ] = *read;
+        else
+                clock_gettime(CLOCK_MONOTONIC, &t->at[TR_READ]);
+        t->seen = 1 << TR_READ;
+}
+
+void trace_mark(struct trace *t, enum trace_stage stage)
+{
+        clock_gettime(CLOCK_MONOTONIC, &t->at[stage]);
+        t->seen |= 1 << stage;
+}
+
+/* Record the stages @t reached. Slow ones (and every sample'th) get
+ * logged with the stage that took longest.
+ */
+void trace_end(struct trace_stats *s, struct trace *t, const char *what)
+{
+        double took[TR_STAGES] = {0};
+        double total;
+        int prev = TR_READ;
+        int worst = TR_START;
+        int i;
+
+        for (i = TR_START; i < TR_STAGES; i++) {
+                if (!(t->seen & (1 << i)))
+                        continue;
+                took[i] = ts_diff(&t->at[i], &t->at[prev]);
+                hist_add(&s->stage[i], took[i]);
+                if (took[i] > took[worst])
+                        worst = i;
+                prev = i;
+        }
+
+        total = ts_diff(&t->at[prev], &t->at[TR_READ]);
+        hist_add(&s->total, total);
+        PROBE2(packet_done, probe_ns(&t->at[TR_READ]), what);
+        s->count++;
+
+        if (!(s->outlier && (total > s->outlier)) &&
+            !(s->sample && !(s->count % s->sample)))
+                return;
+
+        log_info("TRACE %.3f ms, mostly %s: "
+                 "receive %.3f parse %.3f store %.3f display %.3f: %s\n",
+                 total * 1000, stage_names[worst],
+                 took[TR_START] * 1000, took[TR_PARSE] * 1000,
+                 took[TR_STORE] * 1000, took[TR_DISPLAY] * 1000, what);
+}
+
+/* A digipeat of a packet read at @read has just been written out */
+void trace_digi(struct trace_stats *s, const struct timespec *read)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        hist_add(&s->digi, ts_diff(&now, read));
+}
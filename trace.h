@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <time.h>
+
+#include "hist.h"
+
+/* Where one received packet has got to. Each stage's time is measured
+ * from the last stage before it that the packet reached, so "receive"
+ * (up to TR_START) covers reading the rest of the packet and any
+ * queueing between threads.
+ */
+enum trace_stage {
+        TR_READ,               /* Data waiting on the fd */
+        TR_START,              /* Whole packet in hand on the main thread */
+        TR_PARSE,              /* Classified and parsed */
+        TR_STORE,              /* In the recent list */
+        TR_DISPLAY,            /* Sent to the display */
+        TR_STAGES,
+};
+
+struct trace {
+        struct timespec at[TR_STAGES];
+        unsigned int seen;     /* Bit per stage reached */
+};
+
+struct trace_stats {
+        struct hist stage[TR_STAGES]; /* [TR_READ] is unused */
+        struct hist total;     /* Read to the last stage reached */
+        struct hist digi;      /* Read to the digipeat leaving for the TNC */
+
+        int sample;            /* Log one trace in this many, 0 for none */
+        double outlier;        /* Log any slower than this (sec), 0 for none */
+        unsigned long count;
+};
+
+void trace_start(struct trace *t, const struct timespec *read);
+void trace_mark(struct trace *t, enum trace_stage stage);
+void trace_end(struct trace_stats *s, struct trace *t, const char *what);
+void trace_digi(struct trace_stats *s, const struct timespec *read);
+const char *trace_stage_name(enum trace_stage stage);
+
+#endif
@@ -0,0 +1,137 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "track.h"
+#include "timespec.h"
+
+#define M_PER_DEG 111320.0
+#define KTS_TO_MS(k) ((k) * 0.514444444)
+#define RAD(d) ((d) * (M_PI / 180.0))
+#define DEG(r) ((r) * (180.0 / M_PI))
+
+/* Smallest angle between two courses, 0-180 */
+double course_diff(double a, double b)
+{
+        double d = fmod(fabs(a - b), 360.0);
+
+        return d > 180.0 ? 360.0 - d : d;
+}
+
+void track_push(struct track *t, struct posit *fix, struct timespec *mono)
+{
+        struct track_point *p;
+
+        t->head = (t->head + 1) % TRACK_POINTS;
+        if (t->count < TRACK_POINTS)
+                t->count++;
+
+        p = &t->pts[t->head];
+        p->mono = *mono;
+        p->lat = fix->lat;
+        p->lon = fix->lon;
+        p->alt = fix->alt;
+        p->speed = fix->speed;
+        p->course = fix->course;
+}
+
+/* Get the point @age fixes ago (0 is the newest), or NULL */
+struct track_point *track_get(struct track *t, int age)
+{
+        if (age >= t->count)
+                return NULL;
+
+        return &t->pts[(t->head + TRACK_POINTS - age) % TRACK_POINTS];
+}
+
+/* Estimate velocity (m/s north and east) from the displacement over
+ * the last @window seconds of fixes. Falls back to the reported
+ * speed and course if there is only one usable point.
+ */
+int track_velocity(struct track *t, double window, double *vn, double *ve)
+{
+        struct track_point *new = track_get(t, 0);
+        struct track_point *old = NULL;
+        struct track_point *p;
+        double dt;
+        int i;
+
+        if (!new)
+                return 0;
+
+        for (i = 1; (p = track_get(t, i)); i++) {
+                if (ts_diff(&new->mono, &p->mono) > window)
+                        break;
+                old = p;
+        }
+
+        if (!old || ((dt = ts_diff(&new->mono, &old->mono)) < 0.5)) {
+                *vn = KTS_TO_MS(new->speed) * cos(RAD(new->course));
+                *ve = KTS_TO_MS(new->speed) * sin(RAD(new->course));
+                return 1;
+        }
+
+        *vn = (new->lat - old->lat) * M_PER_DEG / dt;
+        *ve = (new->lon - old->lon) * M_PER_DEG * cos(RAD(new->lat)) / dt;
+
+        return 1;
+}
+
+/* Dead-reckon the newest fix forward to @when (CLOCK_MONOTONIC) */
+int track_project(struct track *t, struct timespec *when,
+                  double *lat, double *lon)
+{
+        struct track_point *new = track_get(t, 0);
+        double vn, ve;
+        double dt;
+
+        if (!new || !track_velocity(t, 5, &vn, &ve))
+                return 0;
+
+        dt = ts_diff(when, &new->mono);
+        if ((dt < 0) || (dt > 30))
+                dt = 0; /* Stale, don't guess */
+
+        *lat = new->lat + (vn * dt) / M_PER_DEG;
+        *lon = new->lon + (ve * dt) / (M_PER_DEG * cos(RAD(new->lat)));
+
+        return 1;
+}
+
+/* Circular mean of the reported course over the last @window seconds,
+ * ignoring fixes slower than @min_speed (knots) whose course is noise.
+ * Returns the number of fixes used.
+ */
+int track_mean_course(struct track *t, double window, double min_speed,
+                      double *course)
+{
+        struct track_point *new = track_get(t, 0);
+        struct track_point *p;
+        double x = 0, y = 0;
+        int count = 0;
+        int i;
+
+        if (!new)
+                return 0;
+
+        for (i = 0; (p = track_get(t, i)); i++) {
+                if (ts_diff(&new->mono, &p->mono) > window)
+                        break;
+                if (p->speed < min_speed)
+                        continue;
+                x += cos(RAD(p->course));
+                y += sin(RAD(p->course));
+                count++;
+        }
+
+        if (count) {
+                *course = DEG(atan2(y, x));
+                if (*course < 0)
+                        *course += 360.0;
+        }
+
+        return count;
+}
@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __TRACK_H
+#define __TRACK_H
+
+#include <time.h>
+
+#include "nmea.h"
+
+#define TRACK_POINTS 64
+
+struct track_point {
+        struct timespec mono;
+        double lat;
+        double lon;
+        double alt;
+        double speed;   /* knots */
+        double course;
+};
+
+struct track {
+        struct track_point pts[TRACK_POINTS];
+        int head;       /* Newest point */
+        int count;
+};
+
+double course_diff(double a, double b);
+
+void track_push(struct track *t, struct posit *fix, struct timespec *mono);
+struct track_point *track_get(struct track *t, int age);
+int track_velocity(struct track *t, double window, double *vn, double *ve);
+int track_project(struct track *t, struct timespec *when,
+                  double *lat, double *lon);
+int track_mean_course(struct track *t, double window, double min_speed,
+                      double *course);
+
+#endif
@@ -0,0 +1,195 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "txq.h"
+#include "timespec.h"
+
+static struct txq_entry *txq_slot(struct txq *q, int n)
+{
+        return &q->slots[(q->head + n) % TXQ_SLOTS];
+}
+
+/* Queue @len bytes of @data to be written @delay_ms from now. @rx is
+ * when the packet being sent was received, if it's a digipeat. Returns
+ * 0 on success, -1 if the queue is full or the data is too long.
+ */
+int txq_push(struct txq *q, const uint8_t *data, int len, int delay_ms,
+             const struct timespec *rx)
+{
+        struct txq_entry *e;
+        struct txq_entry *prev;
+
+        if ((q->count == TXQ_SLOTS) || (len > TXQ_PACKET)) {
+                q->dropped++;
+                return -1;
+        }
+
+        e = txq_slot(q, q->count);
+        memcpy(e->data, data, len);
+        e->len = len;
+
+        clock_gettime(CLOCK_MONOTONIC, &e->queued);
+        e->rx = rx ? *rx : e->queued;
+        e->due = e->queued;
+        ts_add(&e->due, delay_ms * 1000000LL);
+
+        /* Keep the queue in deadline order */
+        if (q->count) {
+                prev = txq_slot(q, q->count - 1);
+                if (ts_diff(&e->due, &prev->due) < 0)
+                        e->due = prev->due;
+        }
+
+        q->count++;
+
+        return 0;
+}
+
+/* Shorten @tv, if needed, so select() wakes up for the next deadline */
+void txq_timeout(struct txq *q, struct timeval *tv)
+{
+        struct timespec now;
+        double wait;
+
+        if (!q->count)
+                return;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wait = ts_diff(&txq_slot(q, 0)->due, &now);
+        if (wait < 0)
+                wait = 0;
+
+        if (wait < (tv->tv_sec + (tv->tv_usec / 1e6))) {
+                tv->tv_sec = (time_t)wait;
+                tv->tv_usec = (wait - tv->tv_sec) * 1e6;
+        }
+}
+
+/* The head of the queue, if it is due, else NULL */
+struct txq_entry *txq_next(struct txq *q)
+{
+        struct timespec now;
+        struct txq_entry *e;
+
+        if (!q->count)
+                return NULL;
+
+        e = txq_slot(q, 0);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (ts_diff(&e->due, &now) > 0)
+                return NULL;
+
+        return e;
+}
+
+/* Retire the head of the queue after sending it */
+void txq_pop(struct txq *q)
+{
+        struct timespec now;
+
+        if (!q->count)
+                return;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        q->latency = ts_diff(&now, &txq_slot(q, 0)->queued);
+        q->latency_sum += q->latency;
+        if (q->latency > q->latency_max)
+                q->latency_max = q->latency;
+        q->sent++;
+
+        q->head = (q->head + 1) % TXQ_SLOTS;
+        q->count--;
+}
+
+/* Contiguous free space at the end of the buffer, compacting first if
+ * that is needed to make room. Returns NULL if the buffer is full.
+ */
+uint8_t *txbuf_reserve(struct txbuf *b, int *space)
+{
+        if ((b->start > 0) && ((TXBUF_SIZE - b->end) < (TXBUF_SIZE / 2))) {
+                memmove(b->buf, &b->buf[b->start], b->end - b->start);
+                b->end -= b->start;
+                b->start = 0;
+        }
+
+        *space = TXBUF_SIZE - b->end;
+        if (*space == 0) {
+                b->overruns++;
+                return NULL;
+        }
+
+        return &b->buf[b->end];
+}
+
+/* Account for a frame of @len bytes written at txbuf_reserve() */
+void txbuf_commit(struct txbuf *b, int len)
+{
+        if (b->start == b->end)
+                clock_gettime(CLOCK_MONOTONIC, &b->busy_since);
+
+        b->end += len;
+        b->frames++;
+}
+
+/* Copy in an already-encoded frame, all or nothing */
+int txbuf_put(struct txbuf *b, const uint8_t *data, int len)
+{
+        uint8_t *ptr;
+        int space;
+
+        ptr = txbuf_reserve(b, &space);
+        if (!ptr || (space < len)) {
+                if (ptr)
+                        b->overruns++;
+                return -1;
+        }
+
+        memcpy(ptr, data, len);
+        txbuf_commit(b, len);
+
+        return 0;
+}
+
+int txbuf_pending(struct txbuf *b)
+{
+        return b->end - b->start;
+}
+
+/* Write as much as @fd (non-blocking) will take. Returns the number of
+ * bytes still pending, or -1 on a write error.
+ */
+int txbuf_drain(struct txbuf *b, int fd)
+{
+        struct timespec now;
+        int ret;
+
+        if (b->start == b->end)
+                return 0;
+
+        while (b->start < b->end) {
+                ret = write(fd, &b->buf[b->start], b->end - b->start);
+                if ((ret < 0) && (errno == EINTR))
+                        continue;
+                else if ((ret < 0) && (errno == EAGAIN))
+                        return txbuf_pending(b);
+                else if (ret <= 0)
+                        return -1;
+
+                b->start += ret;
+                b->bytes += ret;
+        }
+
+        b->start = b->end = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        b->flush = ts_diff(&now, &b->busy_since);
+        if (b->flush > b->flush_max)
+                b->flush_max = b->flush;
+
+        return 0;
+}
@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __TXQ_H
+#define __TXQ_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define TXQ_SLOTS 16
+#define TXQ_PACKET 1024        /* Escaped KISS frame */
+
+struct txq_entry {
+        struct timespec rx;    /* When what we're sending was received */
+        struct timespec queued;
+        struct timespec due;
+        uint8_t data[TXQ_PACKET];
+        int len;
+};
+
+/* Packets waiting to go out, in the order they were queued. Due times
+ * never go backwards, so the head is always the next deadline.
+ */
+struct txq {
+        struct txq_entry slots[TXQ_SLOTS];
+        int head;
+        int count;
+
+        unsigned long sent;
+        unsigned long dropped;
+        double latency;         /* Queued to sent, last packet, sec */
+        double latency_max;
+        double latency_sum;
+};
+
+/* Bytes on their way to the TNC. Frames are encoded straight into the
+ * free space at the end and drained from the front with non-blocking
+ * writes; the data is slid back to the start only when it has to be.
+ */
+#define TXBUF_SIZE 8192
+
+struct txbuf {
+        uint8_t buf[TXBUF_SIZE];
+        int start;
+        int end;
+
+        struct timespec busy_since;
+        double flush;           /* Time to drain after last going busy */
+        double flush_max;
+
+        unsigned long frames;
+        unsigned long bytes;
+        unsigned long overruns;
+};
+
+int txq_push(struct txq *q, const uint8_t *data, int len, int delay_ms,
+             const struct timespec *rx);
+void txq_timeout(struct txq *q, struct timeval *tv);
+struct txq_entry *txq_next(struct txq *q);
+void txq_pop(struct txq *q);
+
+uint8_t *txbuf_reserve(struct txbuf *b, int *space);
+void txbuf_commit(struct txbuf *b, int len);
+int txbuf_put(struct txbuf *b, const uint8_t *data, int len);
+int txbuf_pending(struct txbuf *b);
+int txbuf_drain(struct txbuf *b, int fd);
+
+#endif
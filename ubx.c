@@ -0,0 +1,244 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ubx.h"
+
+#define MMS_TO_KTS(mms) ((mms) * 0.00194384449)
+
+static uint16_t get_u16(const uint8_t *p)
+{
+        return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void ubx_checksum(const uint8_t *data, int len,
+                         uint8_t *ck_a, uint8_t *ck_b)
+{
+        int i;
+
+        *ck_a = *ck_b = 0;
+
+        for (i = 0; i < len; i++) {
+                *ck_a += data[i];
+                *ck_b += *ck_a;
+        }
+}
+
+int ubx_feed(struct ubx_parser *p, uint8_t byte)
+{
+        uint8_t ck_a, ck_b;
+
+        /* Resync on anything that isn't the two-byte preamble */
+        if ((p->idx == 0) && (byte != UBX_SYNC1))
+                return 0;
+        if ((p->idx == 1) && (byte != UBX_SYNC2)) {
+                p->idx = (byte == UBX_SYNC1) ? 1 : 0;
+                return 0;
+        }
+
+        p->buf[p->idx++] = byte;
+
+        if (p->idx == 6) {
+                p->len = get_u16(&p->buf[4]);
+                if (p->len > UBX_MAX_PAYLOAD) {
+                        printf("UBX: dropping oversized frame (%i)\n", p->len);
+                        p->idx = 0;
+                }
+                return 0;
+        }
+
+        if ((p->idx < 6) || (p->idx < p->len + UBX_OVERHEAD))
+                return 0;
+
+        p->idx = 0;
+
+        ubx_checksum(&p->buf[2], p->len + 4, &ck_a, &ck_b);
+        if ((ck_a != p->buf[p->len + 6]) || (ck_b != p->buf[p->len + 7])) {
+                printf("UBX: bad checksum on %02x/%02x\n",
+                       p->buf[2], p->buf[3]);
+                return 0;
+        }
+
+        return 1;
+}
+
+uint8_t ubx_class(struct ubx_parser *p)
+{
+        return p->buf[2];
+}
+
+uint8_t ubx_id(struct ubx_parser *p)
+{
+        return p->buf[3];
+}
+
+uint8_t *ubx_payload(struct ubx_parser *p)
+{
+        return &p->buf[6];
+}
+
+int ubx_payload_len(struct ubx_parser *p)
+{
+        return p->len;
+}
+
+/* Decode a UBX-NAV-PVT payload directly into @mypos
+ *
+ * Units follow what parse_gga()/parse_rmc() produce so the rest of
+ * the code can't tell the difference: knots, degrees, meters MSL,
+ * HHMMSS and DDMMYY. Without a valid time, the time and date are
+ * zeroed rather than left from whatever fix last used this slot.
+ *
+ * Returns 0 for a short payload, otherwise UBX_PVT_FIX, plus
+ * UBX_PVT_TIME if the time can be used to set the clock.
+ */
+int ubx_parse_nav_pvt(struct posit *mypos, const uint8_t *payload, int len)
+{
+        uint8_t valid;
+        uint8_t fix_type;
+        uint8_t flags;
+        int ret = UBX_PVT_FIX;
+
+        if (len < UBX_NAV_PVT_LEN)
+                return 0;
+
+        valid = payload[11];
+        fix_type = payload[20];
+        flags = payload[21];
+
+        if ((valid & 0x03) == 0x03) {
+                mypos->tstamp = (payload[8] * 10000) +
+                        (payload[9] * 100) + payload[10];
+                mypos->dstamp = (payload[7] * 10000) +
+                        (payload[6] * 100) + (get_u16(&payload[4]) % 100);
+                mypos->tnsec = (int32_t)get_u32(&payload[16]);
+                mypos->dstamp_tstamp = mypos->tstamp;
+                ret |= UBX_PVT_TIME;
+        } else {
+                mypos->tstamp = 0;
+                mypos->dstamp = 0;
+                mypos->tnsec = 0;
+                mypos->dstamp_tstamp = 0;
+        }
+
+        /* GGA quality: 1 for any usable 2D/3D fix, 0 otherwise */
+        mypos->qual = ((flags & 0x01) &&
+                       (fix_type >= 2) && (fix_type <= 4)) ? 1 : 0;
+        mypos->sats = payload[23];
+
+        if (!mypos->qual)
+                return ret;
+
+        mypos->lon = (int32_t)get_u32(&payload[24]) * 1e-7;
+        mypos->lat = (int32_t)get_u32(&payload[28]) * 1e-7;
+        mypos->alt = (int32_t)get_u32(&payload[36]) / 1000.0;
+        mypos->speed = MMS_TO_KTS((int32_t)get_u32(&payload[60]));
+        mypos->course = (int32_t)get_u32(&payload[64]) * 1e-5;
+
+        return ret;
+}
+
+int ubx_make_packet(uint8_t *buf, int len, uint8_t cls, uint8_t id,
+                    const uint8_t *payload, int plen)
+{
+        if (plen + UBX_OVERHEAD > len)
+                return -1;
+
+        buf[0] = UBX_SYNC1;
+        buf[1] = UBX_SYNC2;
+        buf[2] = cls;
+        buf[3] = id;
+        buf[4] = plen & 0xFF;
+        buf[5] = (plen >> 8) & 0xFF;
+        memcpy(&buf[6], payload, plen);
+        ubx_checksum(&buf[2], plen + 4, &buf[plen + 6], &buf[plen + 7]);
+
+        return plen + UBX_OVERHEAD;
+}
+
+static int ubx_send(int fd, uint8_t cls, uint8_t id,
+                    const uint8_t *payload, int plen)
+{
+        uint8_t buf[64];
+        int len;
+
+        len = ubx_make_packet(buf, sizeof(buf), cls, id, payload, plen);
+        if (len < 0)
+                return len;
+
+        return write(fd, buf, len) == len ? 0 : -1;
+}
+
+/* Switch the receiver to NAV-PVT at @rate_hz and silence the NMEA
+ * sentences we would otherwise have to skip over on the wire. The
+ * port stays at @baud, so the rate is held to what that can carry.
+ */
+int ubx_configure(int fd, int rate_hz, int baud)
+{
+        static const uint8_t nmea_ids[] = {
+                0x00, /* GGA */
+                0x01, /* GLL */
+                0x02, /* GSA */
+                0x03, /* GSV */
+                0x04, /* RMC */
+                0x05, /* VTG */
+        };
+        uint8_t msg[3];
+        uint8_t rate[6];
+        uint16_t meas_ms;
+        int max_hz;
+        int ret = 0;
+        int i;
+
+        if (rate_hz < 1)
+                rate_hz = 1;
+        else if (rate_hz > 10)
+                rate_hz = 10;
+
+        /* Ten bits a byte, 8N1 */
+        max_hz = baud / ((UBX_NAV_PVT_LEN + UBX_OVERHEAD) * 10);
+        if (max_hz < 1)
+                max_hz = 1;
+        if (rate_hz > max_hz) {
+                printf("UBX: %i Hz of NAV-PVT won't fit at %i baud, "
+                       "using %i Hz\n", rate_hz, baud, max_hz);
+                rate_hz = max_hz;
+        }
+
+        meas_ms = 1000 / rate_hz;
+
+        for (i = 0; i < sizeof(nmea_ids); i++) {
+                msg[0] = UBX_CLASS_NMEA;
+                msg[1] = nmea_ids[i];
+                msg[2] = 0;
+                ret |= ubx_send(fd, UBX_CLASS_CFG, UBX_CFG_MSG, msg, 3);
+        }
+
+        msg[0] = UBX_CLASS_NAV;
+        msg[1] = UBX_NAV_PVT;
+        msg[2] = 1; /* Every navigation solution */
+        ret |= ubx_send(fd, UBX_CLASS_CFG, UBX_CFG_MSG, msg, 3);
+
+        rate[0] = meas_ms & 0xFF;
+        rate[1] = meas_ms >> 8;
+        rate[2] = 1; /* navRate: one solution per measurement */
+        rate[3] = 0;
+        rate[4] = 0; /* timeRef: UTC */
+        rate[5] = 0;
+        ret |= ubx_send(fd, UBX_CLASS_CFG, UBX_CFG_RATE, rate, 6);
+
+        if (ret)
+                printf("UBX: failed to configure receiver: %m\n");
+        else
+                printf("UBX: configured NAV-PVT at %i Hz\n", rate_hz);
+
+        return ret;
+}
@@ -0,0 +1,49 @@
+/* -*- Mode: C; tab-width: 8;  indent-tabs-mode: nil; c-basic-offset: 8; c-brace-offset: -8; c-argdecl-indent: 8 -*- */
+/* Copyright 2012 Dan Smith <dsmith@danplanet.com> */
+
+#ifndef __UBX_H
+#define __UBX_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "nmea.h"
+
+#define UBX_SYNC1 0xB5
+#define UBX_SYNC2 0x62
+
+#define UBX_CLASS_NAV 0x01
+#define UBX_CLASS_CFG 0x06
+#define UBX_CLASS_NMEA 0xF0
+
+#define UBX_NAV_PVT  0x07
+#define UBX_CFG_MSG  0x01
+#define UBX_CFG_RATE 0x08
+
+#define UBX_NAV_PVT_LEN 92
+#define UBX_MAX_PAYLOAD 256
+#define UBX_OVERHEAD 8 /* sync(2) class id len(2) ... ck_a ck_b */
+
+/* ubx_parse_nav_pvt() results */
+#define UBX_PVT_FIX  0x01      /* Decoded; qual says if it's usable */
+#define UBX_PVT_TIME 0x02      /* Date and time are valid */
+
+struct ubx_parser {
+        uint8_t buf[UBX_MAX_PAYLOAD + UBX_OVERHEAD];
+        int idx;
+        int len;
+};
+
+/* Feed one byte; returns 1 when buf holds a complete, valid frame */
+int ubx_feed(struct ubx_parser *p, uint8_t byte);
+uint8_t ubx_class(struct ubx_parser *p);
+uint8_t ubx_id(struct ubx_parser *p);
+uint8_t *ubx_payload(struct ubx_parser *p);
+int ubx_payload_len(struct ubx_parser *p);
+
+int ubx_parse_nav_pvt(struct posit *mypos, const uint8_t *payload, int len);
+int ubx_make_packet(uint8_t *buf, int len, uint8_t cls, uint8_t id,
+                    const uint8_t *payload, int plen);
+int ubx_configure(int fd, int rate_hz, int baud);
+
+#endif
@@ -22,14 +22,20 @@
 #define DEG2RAD(x) (x*(PI/180))
 #define RAD2DEG(x) (x/(PI/180))
 
-const char *CARDINALS[] = { "N", "NE", "E", "SE", "S", "SW", "W", "NW" };
+/* Everything below is static inline so that any object can include
+ * this, not just aprs.c
+ */
 
-const char *direction(double degrees)
+static inline const char *direction(double degrees)
 {
-        return CARDINALS[((int)((degrees + 22.5) / 45.0)) % 8];
+        static const char *cardinals[] = {
+                "N", "NE", "E", "SE", "S", "SW", "W", "NW"
+        };
+
+        return cardinals[((int)((degrees + 22.5) / 45.0)) % 8];
 }
 
-double get_direction(double fLng, double fLat, double tLng, double tLat)
+static inline double get_direction(double fLng, double fLat, double tLng, double tLat)
 {
         double rads;
         double result;
@@ -50,34 +56,66 @@ double get_direction(double fLng, double fLat, double tLng, double tLat)
                 return result;
 }
 
-char *get_escaped_string(char *string)
+/* Make @len bytes of received text safe for a markup label, in one
+ * pass into @buf: escape &, < and >, and turn control characters
+ * (CR/LF included) into spaces. Stops short rather than split an
+ * entity. Returns @buf.
+ */
+static inline char *escape_markup(char *buf, int size, const char *src, int len)
 {
+        const char *rep;
+        int replen;
+        int out = 0;
         int i;
-        char *escaped = NULL;
-        int length = strlen(string) * 2 + 1;
-
-        escaped = calloc(length, sizeof(char));
-
-        /* Escape values */
-        for (i = 0; i < strlen(string); i++) {
-                if (strlen(escaped) + 6 >= length) {
-                        char *tmp;
-                        tmp = realloc(escaped, length * 2);
-                        escaped = tmp;
-                        length *= 2;
+
+        for (i = 0; (i < len) && src[i]; i++) {
+                unsigned char c = src[i];
+
+                switch (c) {
+                case '&': rep = "&amp;"; replen = 5; break;
+                case '<': rep = "&lt;";  replen = 4; break;
+                case '>': rep = "&gt;";  replen = 4; break;
+                default:
+                        if ((c < 0x20) || (c == 0x7F))
+                                c = ' ';
+                        rep = NULL;
+                        replen = 1;
                 }
 
-                if (string[i] == '&')
-                        strcat(escaped, "&amp;");
-                else if (string[i] == '<')
-                        strcat(escaped, "&lt;");
-                else if (string[i] == '>')
-                        strcat(escaped, "&gt;");
-                else
-                        strncat(escaped, &string[i], 1);
+                if (out + replen >= size)
+                        break;
+
+                if (rep) {
+                        memcpy(buf + out, rep, replen);
+                        out += replen;
+                } else
+                        buf[out++] = c;
         }
 
-        return escaped;
+        buf[out] = 0;
+
+        return buf;
+}
+
+static inline char *format_time(time_t t)
+{
+        static char str[32]; /* STATIC! */
+
+        if (t > (3600 * 24))
+                snprintf(str, sizeof(str), "%lud%luh",
+                         t / (3600 * 24),
+                         t % (3600 * 24));
+        else if (t > 3600)
+                snprintf(str, sizeof(str), "%luh%lum", t / 3600, (t % 3600) / 60);
+        else if (t > 60)
+                if (t % 60)
+                        snprintf(str, sizeof(str), "%lum%lus", t / 60, t % 60);
+                else
+                        snprintf(str, sizeof(str), "%lu min", t / 60);
+        else
+                snprintf(str, sizeof(str), "%lu sec", t);
+
+        return str;
 }
 
 #endif